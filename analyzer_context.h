@@ -2,17 +2,30 @@
 #define ANALYZER_CONTEXT_H
 
 #include "debugger_common.h"
+#include "plugin_profile.h"
+#include "attribute_handler.h"
 
-static std::unordered_set<tree> visited;
+struct analyzer_arena;
 
 struct analyzer_context
 {
 	std::deque<tree> vars_to_track;
+	std::unordered_set<tree> tracked; // the same vars as "vars_to_track", for dedup
+	std::deque<tree> loop_exit_vars;  // written vars captured after the outermost loop around the statement
+	bool in_loop = false;
+
+	/**
+	 *  the parts of the vars the statement writes, e.g. "node.value", see "written_ref_of" in <ast_analyzer.h>.
+	 *  a var in "written_whole" is written as a whole as well.
+	 */
+
+	std::unordered_map<tree, std::vector<tree> > written_refs;
+	std::unordered_set<tree> written_whole;
 
 	/** 
 	 *  "expanded" stores the type_decls that had been expanded for printing
 	 *  to avoid recursion, types that had benn expanded would not be expanded again
-	 *  "expanded" is cleared everytime a new turn of adding printing exprssions is started
+	 *  "expanded" is cleared for every var printed, so that inline and outlined printing expand the same
 	 */
 	
 	std::unordered_set<tree> expanded;
@@ -21,15 +34,32 @@ struct analyzer_context
 	int writing_expr_entering_count = 0;
 	bool writing_if_has_init = false;
 	tree context_func_decl;
+	analyzer_arena* arena = NULL;
 public:
-	analyzer_context(tree context_func)
+	analyzer_context(tree context_func, analyzer_arena* arena = NULL)
 	{
 		this->context_func_decl = context_func;
+		this->arena = arena;
+		profile_contexts_created++;
 	}
-	analyzer_context* new_instance()
+	/**
+	 *  makes the context as good as new for the statement of another function.
+	 */
+	void reset(tree context_func)
 	{
-		return new analyzer_context(context_func_decl);
+		vars_to_track.clear();
+		tracked.clear();
+		loop_exit_vars.clear();
+		in_loop = false;
+		written_refs.clear();
+		written_whole.clear();
+		expanded.clear();
+		writing_expr_entering_count = 0;
+		writing_if_has_init = false;
+		context_func_decl = context_func;
 	}
+	inline analyzer_context* new_instance();
+	inline void release();
 	analyzer_context* enter_writing()
 	{
 		writing_expr_entering_count++;
@@ -48,14 +78,10 @@ public:
 	{
 		return writing_expr_entering_count > 0;
 	}
-	bool has_visited(tree node)
-	{
-		return visited.count(node) > 0;
-	}
-	void push_visited(tree node)
-	{
-		visited.emplace(node);
-	}
+	/**
+	 *  returns false if the decl had already been visited in the function.
+	 */
+	inline bool push_visited(tree decl);
 	bool has_expanded(tree type_decl)
 	{
 		return expanded.count(type_decl) > 0;
@@ -70,18 +96,39 @@ public:
 	}
 	void push_var_to_track(tree decl)
 	{
-		for (tree pushed: vars_to_track)
-		{
-			if (decl == pushed) return;
-		}
-		vars_to_track.push_back(decl);
+		if (tracked.insert(decl).second) vars_to_track.push_back(decl);
 	}
 	tree pop_var_to_track()
 	{
 		tree var_decl = vars_to_track.front();
 		vars_to_track.pop_front();
+		tracked.erase(var_decl);
 		return var_decl;
 	}
+	void push_written(tree written)
+	{
+		if (written == NULL_TREE) return;
+		tree decl = get_base_address(written);
+		if (written == decl)
+		{
+			written_whole.insert(decl);
+			return;
+		}
+		std::vector<tree>& refs = written_refs[decl];
+		for (tree ref: refs)
+		{
+			if (operand_equal_p(ref, written, 0)) return;
+		}
+		refs.push_back(written);
+	}
+	void push_loop_exit_var(tree decl)
+	{
+		for (tree pushed: loop_exit_vars)
+		{
+			if (decl == pushed) return;
+		}
+		loop_exit_vars.push_back(decl);
+	}
 	analyzer_context* set_writing_if_has_init()
 	{
 		writing_if_has_init = true;
@@ -104,5 +151,131 @@ public:
 	}
 };
 
+/**
+ *  "analyzer_arena" owns what the analysis of one function needs: the contexts handed out per statement,
+ *  which are recycled rather than freed, and the decls visited in the function.
+ *  it is reset between functions, so the memory of the plugin is bounded by the largest function
+ *  rather than growing with the unit.
+ */
+
+/**
+ *  a "scope frame" is a block being analyzed, or the parameters of the function,
+ *  with its vars captured when it is left (see "capture_point" in <attribute_handler.h>).
+ */
+
+struct scope_frame
+{
+	tree owner;
+	std::vector<tree> exit_vars;
+};
+
+struct analyzer_arena
+{
+	tree func_decl = NULL_TREE;
+	std::vector<scope_frame> scopes;
+	std::vector<analyzer_context*> contexts;
+	std::vector<analyzer_context*> free_contexts;
+	std::unordered_set<tree> visited;
+	std::unordered_set<tree> fully_captured; // the vars captured whole in the function, for fields=first-full
+	size_t max_visited = 0;
+
+	analyzer_context* acquire()
+	{
+		if (free_contexts.empty())
+		{
+			contexts.push_back(new analyzer_context(func_decl, this));
+			return contexts.back();
+		}
+		analyzer_context* context = free_contexts.back();
+		free_contexts.pop_back();
+		context->reset(func_decl);
+		return context;
+	}
+	void release(analyzer_context* context)
+	{
+		free_contexts.push_back(context);
+	}
+	void reset(tree func_decl)
+	{
+		if (visited.size() > max_visited) max_visited = visited.size();
+		visited.clear();
+		fully_captured.clear();
+		scopes.clear();
+		free_contexts = contexts;
+		this->func_decl = func_decl;
+	}
+	~analyzer_arena()
+	{
+		for (analyzer_context* context: contexts) delete context;
+	}
+	void enter_scope(tree owner, tree decls)
+	{
+		scopes.push_back({ owner, std::vector<tree>() });
+		for (tree decl = decls; decl != NULL_TREE; decl = DECL_CHAIN(decl))
+		{
+			if ((TREE_CODE(decl) != VAR_DECL && TREE_CODE(decl) != PARM_DECL) || !is_var_marked_track(decl)) continue;
+			capture_policy policy = capture_point_of(decl).policy;
+			if (policy == CAPTURE_ON_SCOPE_EXIT || policy == CAPTURE_ON_RETURN) scopes.back().exit_vars.push_back(decl);
+		}
+	}
+	void exit_scope()
+	{
+		scopes.pop_back();
+	}
+	/**
+	 *  the scope-exit vars of the innermost scope, and with "function_body" those of the parameters as well.
+	 */
+	void collect_exit_vars(std::deque<tree>& vars, bool function_body)
+	{
+		for (size_t i = function_body ? 0 : scopes.size() - 1; i < scopes.size(); i++)
+		{
+			for (tree decl: scopes[i].exit_vars)
+			{
+				if (capture_point_of(decl).policy == CAPTURE_ON_SCOPE_EXIT) vars.push_back(decl);
+			}
+		}
+	}
+	/**
+	 *  the vars captured when the function returns.
+	 */
+	void collect_return_vars(std::deque<tree>& vars)
+	{
+		for (scope_frame& frame: scopes)
+		{
+			for (tree decl: frame.exit_vars)
+			{
+				if (capture_point_of(decl).policy == CAPTURE_ON_RETURN) vars.push_back(decl);
+			}
+		}
+	}
+	bool has_return_vars()
+	{
+		for (scope_frame& frame: scopes)
+		{
+			for (tree decl: frame.exit_vars)
+			{
+				if (capture_point_of(decl).policy == CAPTURE_ON_RETURN) return true;
+			}
+		}
+		return false;
+	}
+};
+
+analyzer_context* analyzer_context::new_instance()
+{
+	if (arena != NULL) return arena->acquire();
+	return new analyzer_context(context_func_decl);
+}
+
+void analyzer_context::release()
+{
+	if (arena != NULL) arena->release(this);
+	else delete this;
+}
+
+bool analyzer_context::push_visited(tree decl)
+{
+	return arena == NULL || arena->visited.insert(decl).second;
+}
 
 #endif
\ No newline at end of file
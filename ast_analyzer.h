@@ -3,33 +3,327 @@
 
 #include "attribute_handler.h"
 #include "print_injector.h"
+#include "snapshot_builder.h"
 #include "analyzer_context.h"
+#include "capture_points.h"
 
 /**
- *  function that performs proper DFS on AST.
+ *  the DFS on AST is driven by an explicit stack of steps rather than by recursion, so that the deeply nested
+ *  expressions and long statement lists of generated code cannot overflow the stack of cc1.
+ *  an analyzer does not descend itself, it pushes the steps for the children in their natural order,
+ *  which "analyze_tree" runs before the steps that were already on the stack.
  */
 
 typedef void (*analyzer)(tree, analyzer_context*);
 
 static analyzer analyzer_from_tree_code(tree_code code);
 
+enum analyzer_step_kind
+{
+	STEP_ANALYZE,
+	STEP_ENTER_WRITING,
+	STEP_EXIT_WRITING,
+	STEP_SET_WRITING_IF_HAS_INIT,
+	STEP_EXIT_SCOPE,                    // "node" is a BIND_EXPR, or the function for its parameters
+	STEP_NEXT_STATEMENT,                // the statement at "it" gets a context of its own
+	STEP_INJECT                         // the statement at "it" has been analyzed, its vars are injected after it
+};
+
+struct analyzer_step
+{
+	analyzer_step_kind kind;
+	tree node;
+	analyzer_context* context;
+	statement_list_walk* walk;
+	tree_stmt_iterator it;
+};
+
+static std::vector<analyzer_step> analyzer_stack;
+static std::vector<analyzer_step> analyzer_pending;
+static analyzer_arena function_arena;
+
+static void push_step(analyzer_step_kind kind, tree node, analyzer_context* context,
+	statement_list_walk* walk = NULL, tree_stmt_iterator it = tree_stmt_iterator())
+{
+	analyzer_pending.push_back({ kind, node, context, walk, it });
+}
+
+/**
+ *  with -fplugin-arg-<plugin>-fields=on, the default, a var of which a statement only writes some fields or elements
+ *  is captured as these, e.g. "node.value" rather than the whole of "node". with fields=first-full the first capture
+ *  of a var in the function is whole anyway, fields=off always captures it whole.
+ *  the vars captured elsewhere than on write, and the sites of the ssa pass, are always whole.
+ */
+
+static bool field_tracking_enabled()
+{
+	return !plugin_option_is("fields", "off", "on");
+}
+
+/**
+ *  the part of a var written through "lhs": the var followed by the fields and the elements of constant index
+ *  leading to what is written, as long as they can be named, e.g. "node.name" for "node.name[i] = c".
+ *  as pointer arithmetic reaches the siblings of an element whose address is taken, the path stops before it then.
+ *  NULL_TREE if "lhs" is not based on a var, e.g. "p->value".
+ */
+
+static tree written_ref_of(tree lhs, bool address_taken = false)
+{
+	std::vector<tree> path;
+	tree ref = lhs;
+	for (; handled_component_p(ref); ref = TREE_OPERAND(ref, 0)) path.push_back(ref);
+	if (TREE_CODE(ref) != VAR_DECL && TREE_CODE(ref) != PARM_DECL) return NULL_TREE;
+	tree written = ref;
+	for (size_t i = path.size(); i > 0; i--)
+	{
+		tree step = path[i - 1];
+		if (TREE_CODE(step) == COMPONENT_REF)
+		{
+			tree field = TREE_OPERAND(step, 1);
+			if (DECL_BIT_FIELD(field) || DECL_NAME(field) == NULL_TREE) break;
+		}
+		else if (TREE_CODE(step) != ARRAY_REF || address_taken
+			|| TREE_CODE(TREE_OPERAND(step, 1)) != INTEGER_CST || !tree_fits_shwi_p(TREE_OPERAND(step, 1))) break;
+		written = step;
+	}
+	return written;
+}
+
+/**
+ *  the parts of "var_decl" captured after the statement of "context".
+ */
+
+static std::vector<tree> captured_parts_of(tree var_decl, analyzer_context* context)
+{
+	auto found = context->written_refs.find(var_decl);
+	bool whole = !field_tracking_enabled() || found == context->written_refs.end() || context->written_whole.count(var_decl) > 0;
+	analyzer_arena* arena = context->arena;
+	if (!whole && arena != NULL && plugin_option_is("fields", "first-full", "on")) whole = arena->fully_captured.count(var_decl) == 0;
+	if (whole)
+	{
+		if (arena != NULL) arena->fully_captured.insert(var_decl);
+		return std::vector<tree>(1, var_decl);
+	}
+	std::vector<tree> parts;
+	for (tree ref: found->second) parts.push_back(unshare_expr(ref));
+	return parts;
+}
+
+/**
+ *  whether the statement after "it" overwrites "tracked" without observing it, see "find_observation".
+ *  the lhs names the var as its base, anything else of the statement that refers to the var reads it.
+ *  with field tracking, the next statement only captures what it writes, which has to cover "tracked".
+ */
+
+static bool is_overwritten_unobserved(tree_stmt_iterator it, tree tracked)
+{
+	tree var_decl = get_base_address(tracked);
+	tsi_next(&it);
+	if (tsi_end_p(it)) return false;
+	tree stmt = tsi_stmt(it);
+	while (CONVERT_EXPR_P(stmt) || TREE_CODE(stmt) == CLEANUP_POINT_EXPR) stmt = TREE_OPERAND(stmt, 0);
+	if (TREE_CODE(stmt) != MODIFY_EXPR && TREE_CODE(stmt) != INIT_EXPR) return false;
+	tree lhs = TREE_OPERAND(stmt, 0);
+	if (get_base_address(lhs) != var_decl) return false;
+	if (field_tracking_enabled())
+	{
+		tree written = written_ref_of(lhs);
+		if (written != var_decl && (written == NULL_TREE || !operand_equal_p(written, tracked, 0))) return false;
+	}
+	for (tree ref = lhs; handled_component_p(ref); ref = TREE_OPERAND(ref, 0))
+	{
+		for (int i = 1; i < TREE_OPERAND_LENGTH(ref); i++)
+		{
+			if (walk_tree_without_duplicates(&TREE_OPERAND(ref, i), find_observation, var_decl) != NULL_TREE) return false;
+		}
+	}
+	return walk_tree_without_duplicates(&TREE_OPERAND(stmt, 1), find_observation, var_decl) == NULL_TREE;
+}
+
+/**
+ *  keeps the vars of a statement that are captured right after it, see "capture_point" in <attribute_handler.h>.
+ */
+
+static void keep_vars_captured_on_write(tree_stmt_iterator it, analyzer_context* context)
+{
+	for (size_t i = context->vars_to_track.size(); i > 0; i--)
+	{
+		tree var_decl = context->pop_var_to_track();
+		capture_policy policy = capture_point_of(var_decl).policy;
+		if (policy == CAPTURE_ON_LOOP_EXIT && context->in_loop) context->push_loop_exit_var(var_decl);
+		if (policy != CAPTURE_ON_WRITE && (policy != CAPTURE_ON_LOOP_EXIT || context->in_loop)) continue;
+		for (tree tracked: captured_parts_of(var_decl, context))
+		{
+			if (redundant_snapshots_dropped() && is_overwritten_unobserved(it, tracked)) continue;
+			context->push_var_to_track(tracked);
+		}
+	}
+}
+
+/**
+ *  the return vars are captured once the returned value is computed, which may write them:
+ *  "return <retval> = x++;" becomes "<retval> = x++; return <retval>;", the returned expression of a void function
+ *  a statement of its own. returns false if "return_expr" computes nothing.
+ */
+
+static bool split_return(tree_stmt_iterator& it, tree return_expr)
+{
+	tree value = TREE_OPERAND(return_expr, 0);
+	if (value == NULL_TREE || TREE_CODE(value) == RESULT_DECL) return false;
+	bool assigned = (TREE_CODE(value) == MODIFY_EXPR || TREE_CODE(value) == INIT_EXPR)
+		&& TREE_CODE(TREE_OPERAND(value, 0)) == RESULT_DECL;
+	TREE_OPERAND(return_expr, 0) = assigned ? TREE_OPERAND(value, 0) : NULL_TREE;
+	tsi_link_before(&it, value, TSI_SAME_STMT);
+	tsi_prev(&it);
+	return true;
+}
+
+static void next_statement(analyzer_step& step)
+{
+	statement_list_walk* walk = step.walk;
+	if (tsi_end_p(step.it))
+	{
+		delete walk;
+		return;
+	}
+	tree stmt = tsi_stmt(step.it);
+	analyzer_arena* arena = walk->parent->arena;
+	bool returning = TREE_CODE(stmt) == RETURN_EXPR && arena != NULL && arena->has_return_vars();
+	if (returning && split_return(step.it, stmt)) stmt = tsi_stmt(step.it);
+	else if (returning)
+	{
+		analyzer_context* return_context = walk->parent->new_instance();
+		arena->collect_return_vars(return_context->vars_to_track);
+		inject_snapshot_before(step.it, set_location_of(return_context, stmt), return_context->vars_to_track);
+		return_context->release();
+	}
+	walk->enter(stmt);
+	if (walk->at_iteration_end(stmt))
+	{
+		inject_periodic_snapshot_before(step.it, set_location_of(walk->loop_context, stmt), walk->loop_context->vars_to_track);
+	}
+	analyzer_context* new_context = walk->parent->new_instance();
+	new_context->in_loop = walk->parent->in_loop || walk->inside;
+	push_step(STEP_ANALYZE, stmt, new_context);
+	push_step(STEP_INJECT, NULL_TREE, new_context, walk, step.it);
+}
+
+static void inject_statement(analyzer_step& step)
+{
+	statement_list_walk* walk = step.walk;
+	analyzer_context* new_context = step.context;
+	tree stmt = tsi_stmt(step.it);
+	keep_vars_captured_on_write(step.it, new_context);
+	walk->capture_at_loop_exit(new_context);
+	inject_snapshot(step.it, set_location_of(new_context, stmt), new_context->vars_to_track);
+	for (tree var_decl: new_context->vars_to_track)
+	{
+		debugger_info_printf("var < %s > is registered for printing.\n", tracked_name(var_decl).c_str());
+	}
+	new_context->release();
+	walk->walked(stmt);
+	tree_stmt_iterator next_it = step.it;
+	tsi_next(&next_it);
+	if (walk->leaving && (tsi_end_p(next_it) || TREE_CODE(tsi_stmt(next_it)) != LABEL_EXPR))
+	{
+		loop_region& loop = walk->loops[walk->loop];
+		inject_snapshot(step.it, set_location_of(walk->loop_context, loop.last), walk->loop_context->vars_to_track);
+		walk->loop_context->release();
+		walk->loop_context = NULL;
+		walk->leaving = false;
+		walk->loop++;
+	}
+	tsi_next(&step.it);
+	push_step(STEP_NEXT_STATEMENT, NULL_TREE, NULL, walk, step.it);
+}
+
+/**
+ *  a block captures its scope-exit vars however it is left, the body of the function also the scope-exit vars
+ *  of the parameters, and its return vars at its end.
+ */
+
+static void exit_scope(analyzer_step& step)
+{
+	analyzer_arena* arena = step.context->arena;
+	if (arena == NULL) return;
+	if (TREE_CODE(step.node) == BIND_EXPR)
+	{
+		bool function_body = step.node == DECL_SAVED_TREE(arena->func_decl);
+		analyzer_context* exit_context = step.context->new_instance();
+		set_location_of(exit_context, step.node);
+		if (function_body) arena->collect_return_vars(exit_context->vars_to_track);
+		if (!exit_context->vars_to_track.empty())
+		{
+			tree_stmt_iterator it = tsi_last(wrap_in_statement_list(BIND_EXPR_BODY(step.node)));
+			inject_snapshot(it, exit_context, exit_context->vars_to_track);
+			exit_context->vars_to_track.clear();
+		}
+		arena->collect_exit_vars(exit_context->vars_to_track, function_body);
+		if (!exit_context->vars_to_track.empty()) inject_snapshot_on_leaving(step.node, exit_context, exit_context->vars_to_track);
+		exit_context->release();
+	}
+	arena->exit_scope();
+}
+
 static void analyze_tree(tree generic_tree, analyzer_context* context)
 {
-    if (generic_tree == NULL_TREE) return;
-    analyzer tree_analyzer = analyzer_from_tree_code(TREE_CODE(generic_tree));
-    if (tree_analyzer == NULL) return;
-    tree_analyzer(generic_tree, context);
-    context->push_visited(generic_tree);
+	size_t bottom = analyzer_stack.size();
+	push_step(STEP_ANALYZE, generic_tree, context);
+	while (!analyzer_pending.empty())
+	{
+		analyzer_stack.insert(analyzer_stack.end(), analyzer_pending.rbegin(), analyzer_pending.rend());
+		analyzer_pending.clear();
+		while (analyzer_stack.size() > bottom && analyzer_pending.empty())
+		{
+			analyzer_step step = analyzer_stack.back();
+			analyzer_stack.pop_back();
+			switch (step.kind)
+			{
+				case STEP_ANALYZE:
+				{
+					if (step.node == NULL_TREE) break;
+					analyzer tree_analyzer = analyzer_from_tree_code(TREE_CODE(step.node));
+					if (tree_analyzer != NULL) tree_analyzer(step.node, step.context);
+					break;
+				}
+				case STEP_ENTER_WRITING: step.context->enter_writing(); break;
+				case STEP_EXIT_WRITING: step.context->exit_writing(); break;
+				case STEP_SET_WRITING_IF_HAS_INIT: step.context->set_writing_if_has_init(); break;
+				case STEP_EXIT_SCOPE: exit_scope(step); break;
+				case STEP_NEXT_STATEMENT: next_statement(step); break;
+				case STEP_INJECT: inject_statement(step); break;
+			}
+		}
+	}
 }
 
+/**
+ *  the contexts and the visited decls come from an arena that is reset for every function.
+ */
+
 void add_print_for_var(tree func_decl)
 {
-	analyzer_context* context = new analyzer_context(func_decl);
+	profile_scope scope(PROFILE_ADD_PRINT_FOR_VAR);
+	function_arena.reset(func_decl);
+	default_capture_point();
+	analyzer_context* context = function_arena.acquire();
 	analyze_tree(func_decl, context);
-	delete context;
+	context->release();
+}
+
+/**
+ *  a callback of PLUGIN_FINISH_UNIT.
+ */
+
+void finish_unit(void* event __unused, void* user_data __unused)
+{
+	function_arena.reset(NULL_TREE);
+	profile_report_unit(function_arena.max_visited);
 }
 
-#define ANALYZE(x, context) analyze_tree((x), context)
+#define ANALYZE(x, context) push_step(STEP_ANALYZE, (x), context)
+#define ENTER_WRITING(context) push_step(STEP_ENTER_WRITING, NULL_TREE, context)
+#define EXIT_WRITING(context) push_step(STEP_EXIT_WRITING, NULL_TREE, context)
 
 static void analyze_tree_list(tree tree_list, analyzer_context* context)
 {
@@ -44,26 +338,35 @@ static void analyze_tree_list(tree tree_list, analyzer_context* context)
 
 static void analyze_statement_list(tree stmt_list_tree, analyzer_context* context)
 {
-	tree_stmt_iterator new_it = tsi_start(stmt_list_tree);
-    while (!tsi_end_p(new_it))
-    {
-    	analyzer_context* new_context = context->new_instance();
-    	tree stmt = tsi_stmt(new_it);
-        ANALYZE(stmt, new_context);
-        // TODO: add code to handle marked var in new_context for printing.
-        inject_print(new_it, new_context->set_location(EXPR_FILENAME(stmt), EXPR_LINENO(stmt)), new_context->vars_to_track);
-        for (tree var_decl: new_context->vars_to_track)
-        {
-        	debugger_info_printf("var < %s > is registered for printing.\n", IDENTIFIER_POINTER(DECL_NAME(var_decl)));
-        }
-        delete new_context;
-        tsi_next(&new_it);
-    }
+	statement_list_walk* walk = new statement_list_walk(context, stmt_list_tree);
+	push_step(STEP_NEXT_STATEMENT, NULL_TREE, NULL, walk, tsi_start(stmt_list_tree));
+}
+
+/**
+ *  a return that is not in a list, as the arm of an if, is put in one for its capture, see "next_statement".
+ */
+
+static void wrap_return(tree& stmt, analyzer_context* context)
+{
+	if (stmt == NULL_TREE || TREE_CODE(stmt) != RETURN_EXPR) return;
+	if (context->arena != NULL && context->arena->has_return_vars()) wrap_in_statement_list(stmt);
+}
+
+/**
+ *  a scope is entered as soon as it is reached, before "wrap_return" looks for the return vars of its block.
+ */
+
+static void enter_scope(tree owner, tree decls, analyzer_context* context)
+{
+	if (context->arena != NULL) context->arena->enter_scope(owner, decls);
 }
 
 static void analyze_bind_expr(tree bind_expr, analyzer_context* context)
 {
+	enter_scope(bind_expr, BIND_EXPR_VARS(bind_expr), context);
+	wrap_return(BIND_EXPR_BODY(bind_expr), context);
 	ANALYZE(BIND_EXPR_BODY(bind_expr), context);
+	push_step(STEP_EXIT_SCOPE, bind_expr, context);
 }
 
 static void analyze_var_decl(tree var_decl, analyzer_context* context)
@@ -76,7 +379,7 @@ static void analyze_var_decl(tree var_decl, analyzer_context* context)
         context->push_var_to_track(var_decl);
         context->unset_writing_if_has_init();
     }
-	if (context->has_visited(var_decl)) return;
+	if (!context->push_visited(var_decl)) return;
     tree init = DECL_INITIAL(var_decl);
     if (init != NULL_TREE && init != error_mark_node)
     {
@@ -86,12 +389,20 @@ static void analyze_var_decl(tree var_decl, analyzer_context* context)
 
 static void analyze_function_decl(tree function_decl, analyzer_context* context)
 {
-	if (context->has_visited(function_decl)) return;
+	// a function reached through its address is analyzed when it is finished itself
+	if (function_decl != context->context_func_decl || !context->push_visited(function_decl)) return;
+	enter_scope(function_decl, DECL_ARGUMENTS(function_decl), context);
     ANALYZE(DECL_SAVED_TREE(function_decl), context);
+	push_step(STEP_EXIT_SCOPE, function_decl, context);
 }
 
 static void analyze_ternary_expr(tree cond_expr, analyzer_context* context)
 {
+	if (VOID_TYPE_P(TREE_TYPE(cond_expr)) && TREE_CODE(cond_expr) == COND_EXPR)
+	{
+		wrap_return(TREE_OPERAND(cond_expr, 1), context);
+		wrap_return(TREE_OPERAND(cond_expr, 2), context);
+	}
 	ANALYZE(TREE_OPERAND(cond_expr, 0), context);
     ANALYZE(TREE_OPERAND(cond_expr, 1), context);
     ANALYZE(TREE_OPERAND(cond_expr, 2), context);
@@ -114,8 +425,10 @@ static void analyze_unary_expr(tree unary_expr, analyzer_context* context)
 
 static void analyze_unary_writing_expr(tree unary_expr, analyzer_context* context)
 {
-	ANALYZE(TREE_OPERAND(unary_expr, 0), context->enter_writing());
-	context->exit_writing();
+	context->push_written(written_ref_of(TREE_OPERAND(unary_expr, 0), TREE_CODE(unary_expr) == ADDR_EXPR));
+	ENTER_WRITING(context);
+	ANALYZE(TREE_OPERAND(unary_expr, 0), context);
+	EXIT_WRITING(context);
 }
 
 static void analyze_binary_expr(tree binary_expr, analyzer_context* context)
@@ -126,8 +439,10 @@ static void analyze_binary_expr(tree binary_expr, analyzer_context* context)
 
 static void analyze_modify_expr(tree binary_expr, analyzer_context* context)
 {
-	ANALYZE(TREE_OPERAND(binary_expr, 0), context->enter_writing());
-	context->exit_writing();
+	context->push_written(written_ref_of(TREE_OPERAND(binary_expr, 0)));
+	ENTER_WRITING(context);
+	ANALYZE(TREE_OPERAND(binary_expr, 0), context);
+	EXIT_WRITING(context);
 	ANALYZE(TREE_OPERAND(binary_expr, 1), context);
 }
 
@@ -138,7 +453,8 @@ static void analyze_compound_literal_expr(tree compound_literal_expr, analyzer_c
 
 static void analyze_decl_expr(tree decl_expr, analyzer_context* context)
 {
-	ANALYZE(DECL_EXPR_DECL(decl_expr), context->set_writing_if_has_init());
+	push_step(STEP_SET_WRITING_IF_HAS_INIT, NULL_TREE, context);
+	ANALYZE(DECL_EXPR_DECL(decl_expr), context);
 }
 
 /**
@@ -3,6 +3,7 @@
 
 #include "debugger_common.h"
 #include "debugger_shared.h"
+#include "plugin_profile.h"
 
 /**
  *  a "tracker" is a function that print out the required infomation of a struct which has a signature like tracker(struct foo* ptr, struct context_info* info);
@@ -11,10 +12,10 @@
 static tree handle_tracker_attribute(tree *node, tree name, tree args __unused, int flags __unused, bool *__unused);
 static tree handle_track_value_attribute(tree *node, tree name, tree args __unused, int flags __unused, bool *__unused);
 static tree handle_debugger_print_func_attribute(tree *node, tree name, tree args __unused, int flags __unused, bool *__unused);
-static tree handle_debugger_jmp_buf_attribute(tree *node, tree name, tree args __unused, int flags __unused, bool *__unused);
 static tree handle_debugger_setjmp_attribute(tree *node, tree name, tree args __unused, int flags __unused, bool *__unused);
 static tree handle_debugger_entering_risk_attribute(tree *node, tree name, tree args __unused, int flags __unused, bool *__unused);
 static tree handle_debugger_exiting_risk_attribute(tree *node, tree name, tree args __unused, int flags __unused, bool *__unused);
+static tree handle_debugger_runtime_attribute(tree *node, tree name, tree args, int flags __unused, bool *__unused);
 
 static struct attribute_spec tracker = {
     .name               = "tracker",
@@ -28,84 +29,58 @@ static struct attribute_spec tracker = {
 };
 
 /**
- *  "type_to_print_func" stores the "tracker" to a type given its name.
- *  notice that 'typedef struct foo bar' may require two trackers as their keys are 'foo' and 'bar' respectively.
- *  however, if one also defines 'struct bar', then the code may crash, which is a bug to be fixed.
+ *  "type_to_print_func" stores the "tracker" of a type, keyed by its main variant,
+ *  so that a tracker of 'bar' in 'typedef struct foo bar' also prints 'struct foo', and a 'struct bar' is another type.
+ *  both registration and lookup are a single hash of the type.
  */
 
-static std::unordered_map<const char*, tree> type_to_print_func;
+static std::unordered_map<tree, tree> type_to_print_func;
 
 static std::unordered_set<tree> stored_print_func;
 
-static std::vector<const char*> name_registered;
-
-/**
- *  find out the name in 'const char*' given a tree(RECORD_TYPE)
- */
-
 static const char* type_name_from_type(tree type)
 {
-	gcc_assert(TREE_CODE(type) == RECORD_TYPE);
-
 	tree name = TYPE_NAME(type);
 	// TYPE_NAME(RECORD_TYPE) may get either TYPE_DECL or IDENTIFIER_NODE
-	if (TREE_CODE(name) == TYPE_DECL) 
-	{
-		name = DECL_NAME(name);
-	}
-
-	gcc_assert(TREE_CODE(name) == IDENTIFIER_NODE);
+	if (name != NULL_TREE && TREE_CODE(name) == TYPE_DECL) name = DECL_NAME(name);
+	if (name == NULL_TREE || TREE_CODE(name) != IDENTIFIER_NODE) return "<anonymous>";
 	return IDENTIFIER_POINTER(name);
 }
 
 /**
- *  push the tracker into the map if 'tracker' for the type of identical name hadn't been pushed yet.
+ *  registers the function as the tracker of the type of its parameter if it is a "tracker".
  */
 
 const char* push_print_func(tree func_decl)
 {
+	profile_scope scope(PROFILE_PUSH_PRINT_FUNC);
 	if (stored_print_func.count(func_decl) == 0) return NULL; // not a "tracker" function
-	// TODO: add signature checking for func_decl here
 	gcc_assert(TREE_CODE(func_decl) == FUNCTION_DECL);
 
 	tree arg = DECL_ARGUMENTS(func_decl);
-	gcc_assert(TREE_CODE(arg) == PARM_DECL);
-
-	/*tree type_to_print_ptr = TREE_TYPE(arg);  // the first argument should be a POINTER to the type to print
-	gcc_assert(TREE_CODE(type_to_print_ptr) == POINTER_TYPE);
-
-	tree type_to_print = TREE_TYPE(type_to_print_ptr);  // getting the type the pointer points to*/
+	if (arg == NULL_TREE || TREE_CODE(arg) != PARM_DECL)
+	{
+		debugger_err_printf("tracker < %s > takes no parameter.\n", IDENTIFIER_POINTER(DECL_NAME(func_decl)));
+		return NULL;
+	}
 
 	tree type_to_print = TREE_TYPE(arg);
-
 	const char* name = type_name_from_type(type_to_print);
-	for (const char* registered: name_registered)
+	tree& registered = type_to_print_func[TYPE_MAIN_VARIANT(type_to_print)];
+	if (registered != NULL_TREE && registered != func_decl)
 	{
-		if (strcmp(name, registered) == 0)
-		{
-			debugger_info_printf("printer for < %s > is registered more than once.\n", name);
-			// return registered;
-		}
+		debugger_info_printf("printer for < %s > is registered more than once.\n", name);
 	}
-	name_registered.push_back(name);
-	type_to_print_func[name] = func_decl;
+	registered = func_decl;
 	debugger_info_printf("tracker < %s > has been registered to type < %s >.\n", IDENTIFIER_POINTER(DECL_NAME(func_decl)), name);
 	return name;
 }
 
 tree retrieve_print_function(tree type)
 {
-	const char* type_name = type_name_from_type(type);
-	for (const char* registered: name_registered)
-	{
-		if (strcmp(registered, type_name) == 0)
-		{
-			debugger_info_printf("< %s > uses %p against default print.\n", type_name, type_to_print_func[registered]);
-			return type_to_print_func[registered];
-		}
-	}
-	debugger_info_printf("< %s > uses default print.\n", type_name);
-	return NULL_TREE;
+	if (type_to_print_func.empty()) return NULL_TREE;
+	auto found = type_to_print_func.find(TYPE_MAIN_VARIANT(type));
+	return found == type_to_print_func.end() ? NULL_TREE : found->second;
 }
 
 /**
@@ -135,7 +110,7 @@ static tree handle_tracker_attribute(tree *node, tree name, tree args __unused,
 static struct attribute_spec track_value = {
     .name               = "track_value",
     .min_length         = 0,
-    .max_length         = 2,
+    .max_length         = 3,
     .decl_required          = true,
     .type_required          = false,
     .function_type_required     = false,
@@ -161,23 +136,31 @@ bool is_var_marked_track(tree decl)
 	return track_value_decls.count(decl) > 0;
 }
 
+/**
+ *  the range of a var declared with track_range(a, b), whose pointer is printed as its elements [a, b).
+ *  the bounds are integer expressions, over other vars as well, e.g. track_range(0, length),
+ *  evaluated every time the var is captured. a string argument is the capture point, see "capture_point".
+ */
+
 static void retrieve_print_option(tree decl, print_option& option)
 {
-	if (TREE_CODE(decl) != VAR_DECL || TREE_CODE(decl) != PARM_DECL) return;
-	tree attr_list = DECL_ATTRIBUTES(decl);
-    if (attr_list == NULL_TREE) return;
-    tree bound_attr = TREE_VALUE(attr_list);
-    if (bound_attr == NULL_TREE) return;
-    tree lb = TREE_VALUE(bound_attr);
-    if (lb == NULL_TREE) return;
-    bound_attr = TREE_CHAIN(bound_attr);
-    if (bound_attr == NULL_TREE) return;
-    tree ub = TREE_VALUE(bound_attr);
-    if (ub == NULL_TREE) return;
-
-    option.has_range = true;
-    option.range_start = lb;
-    option.range_end = ub;
+	if (TREE_CODE(decl) != VAR_DECL && TREE_CODE(decl) != PARM_DECL) return;
+	tree attribute = lookup_attribute("track_value", DECL_ATTRIBUTES(decl));
+	if (attribute == NULL_TREE) return;
+	tree bounds[2];
+	int n_bounds = 0;
+	for (tree arg = TREE_VALUE(attribute); arg != NULL_TREE; arg = TREE_CHAIN(arg))
+	{
+		tree bound = TREE_VALUE(arg);
+		if (bound == NULL_TREE || TREE_CODE(bound) == STRING_CST) continue;
+		if (n_bounds == 2 || !INTEGRAL_TYPE_P(TREE_TYPE(bound))) return;
+		bounds[n_bounds++] = bound;
+	}
+	if (n_bounds != 2) return;
+
+	option.has_range = true;
+	option.range_start = unshare_expr(bounds[0]);
+	option.range_end = unshare_expr(bounds[1]);
 }
 
 static void detected_var_to_track(tree decl)
@@ -186,9 +169,94 @@ static void detected_var_to_track(tree decl)
 	track_value_decls.emplace(decl);
 }
 
+/**
+ *  a "capture point" is where a tracked var is snapshotted, given as a string argument of "track_value",
+ *  e.g. track_var_at("loop-exit:1000"), or for every var by -fplugin-arg-<plugin>-capture-at=<point>:
+ *      write           after every statement writing it (the default)
+ *      scope-exit      whenever the block declaring it is left: at its end, or by a return, a break or a goto
+ *      return          at every return of the function once the returned value is computed, and at its end
+ *      loop-exit[:K]   after the outermost loop writing it, and every K iterations of that loop;
+ *                      a write outside of any loop is captured as on write
+ *  the ssa pass (see <ssa_injector.h>) captures every var on write.
+ */
+
+enum capture_policy
+{
+	CAPTURE_ON_WRITE,
+	CAPTURE_ON_SCOPE_EXIT,
+	CAPTURE_ON_RETURN,
+	CAPTURE_ON_LOOP_EXIT
+};
+
+struct capture_point
+{
+	capture_policy policy;
+	long every;
+};
+
+static std::unordered_map<tree, capture_point> capture_points;
+static bool loop_exit_points_used = false;
+
+static bool parse_capture_point(const char* text, capture_point& point)
+{
+	point.every = 0;
+	if (strcmp(text, "write") == 0) point.policy = CAPTURE_ON_WRITE;
+	else if (strcmp(text, "scope-exit") == 0) point.policy = CAPTURE_ON_SCOPE_EXIT;
+	else if (strcmp(text, "return") == 0) point.policy = CAPTURE_ON_RETURN;
+	else if (strncmp(text, "loop-exit", 9) == 0 && (text[9] == 0 || text[9] == ':'))
+	{
+		point.policy = CAPTURE_ON_LOOP_EXIT;
+		if (text[9] == ':')
+		{
+			char* end;
+			point.every = strtol(text + 10, &end, 10);
+			if (*end != 0 || point.every <= 0) return false;
+		}
+	}
+	else return false;
+	if (point.policy == CAPTURE_ON_LOOP_EXIT) loop_exit_points_used = true;
+	return true;
+}
+
+static capture_point default_capture_point()
+{
+	static capture_point point = { CAPTURE_ON_WRITE, 0 };
+	static bool parsed = false;
+	if (parsed) return point;
+	parsed = true;
+	const char* text = get_plugin_option("capture-at", "write");
+	if (!parse_capture_point(text, point))
+	{
+		debugger_err_printf("capture point < %s > is not understood.\n", text);
+		point.policy = CAPTURE_ON_WRITE;
+		point.every = 0;
+	}
+	return point;
+}
+
+capture_point capture_point_of(tree decl)
+{
+	auto found = capture_points.find(decl);
+	return found == capture_points.end() ? default_capture_point() : found->second;
+}
+
 static tree handle_track_value_attribute(tree *node, tree name, tree args __unused, int flags __unused, bool *__unused)
 {
     detected_var_to_track(*node);
+    for (tree arg = args; arg != NULL_TREE; arg = TREE_CHAIN(arg))
+    {
+        if (TREE_VALUE(arg) == NULL_TREE) continue;
+        if (TREE_CODE(TREE_VALUE(arg)) != STRING_CST)
+        {
+            if (TREE_VALUE(arg) != error_mark_node && !INTEGRAL_TYPE_P(TREE_TYPE(TREE_VALUE(arg))))
+                debugger_err_printf("a bound of < %s > is not an integer.\n", IDENTIFIER_POINTER(DECL_NAME(*node)));
+            continue;
+        }
+        capture_point point;
+        if (parse_capture_point(TREE_STRING_POINTER(TREE_VALUE(arg)), point)) capture_points[*node] = point;
+        else debugger_err_printf("capture point < %s > of < %s > is not understood.\n",
+            TREE_STRING_POINTER(TREE_VALUE(arg)), IDENTIFIER_POINTER(DECL_NAME(*node)));
+    }
     debugger_info_printf("var < %s > has been pushed for tracking.\n", IDENTIFIER_POINTER(DECL_NAME(*node)));
     return NULL_TREE;
 }
@@ -284,8 +352,14 @@ tree get_debugger_print_for_base_type(tree type_tree)
 	return debugger_print_func_decls[get_base_type_from_type_tree(type_tree)];
 }
 
+/**
+ *  markup is printed by the STRING_LITERAL printer if <debugger.h> provides one,
+ *  which records only the pointer as the literal lives as long as the program.
+ */
+
 tree get_string_literal_print()
 {
+	if (debugger_print_func_decls.count(STRING_LITERAL)) return debugger_print_func_decls[STRING_LITERAL];
 	return debugger_print_func_decls[CHAR_POINTER];
 }
 
@@ -307,51 +381,38 @@ static tree handle_debugger_print_func_attribute(tree *node, tree name, tree arg
 }
 
 /**
- *  stores the jmp_buf that longjmp requires to escape from segfault during local var expansion
+ *  stores the decl of setjmp(jmp_buf) that handles segfault during local var expansion,
+ *  the jmp_buf is the one returned by entering_risk for the calling thread
  */
 
-static struct attribute_spec debugger_jmp_buf = {
-    .name               = "debugger_jmp_buf",
+static struct attribute_spec debugger_setjmp = {
+    .name               = "debugger_setjmp",
     .min_length         = 0,
     .max_length         = 0,
     .decl_required          = true,
     .type_required          = false,
     .function_type_required     = false,
     .affects_type_identity      = false,
-    .handler            = handle_debugger_jmp_buf_attribute
+    .handler            = handle_debugger_setjmp_attribute
 };
 
-tree segf_jmp_buf_decl;
+tree setjmp_name;
 
-static tree handle_debugger_jmp_buf_attribute(tree *node, tree name, tree args __unused, int flags __unused, bool *__unused)
+static tree handle_debugger_setjmp_attribute(tree *node, tree name, tree args __unused, int flags __unused, bool *__unused)
 {
-    segf_jmp_buf_decl = *node;
-    debugger_info_printf("var < %s > has been pushed as jmp_buf for segfault handling.\n", IDENTIFIER_POINTER(DECL_NAME(*node)));
+    setjmp_name = DECL_NAME(*node);
+    debugger_info_printf("func < %s > has been pushed as setjmp for segfault handling.\n", IDENTIFIER_POINTER(DECL_NAME(*node)));
     return NULL_TREE;
 }
 
 /**
- *  stores the decl of setjmp(jmp_buf) that handles segfault during local var expansion
+ *  the attribute is given to a redeclaration of the setjmp of <setjmp.h>,
+ *  whose node is merged into the first declaration and freed, thus the decl is looked up by name.
  */
 
-static struct attribute_spec debugger_setjmp = {
-    .name               = "debugger_setjmp",
-    .min_length         = 0,
-    .max_length         = 0,
-    .decl_required          = true,
-    .type_required          = false,
-    .function_type_required     = false,
-    .affects_type_identity      = false,
-    .handler            = handle_debugger_setjmp_attribute
-};
-
-tree setjmp_decl;
-
-static tree handle_debugger_setjmp_attribute(tree *node, tree name, tree args __unused, int flags __unused, bool *__unused)
+tree get_setjmp_decl()
 {
-    setjmp_decl = *node;
-    debugger_info_printf("func < %s > has been pushed as setjmp for segfault handling.\n", IDENTIFIER_POINTER(DECL_NAME(*node)));
-    return NULL_TREE;
+    return lookup_name(setjmp_name);
 }
 
 /**
@@ -402,6 +463,41 @@ static tree handle_debugger_exiting_risk_attribute(tree *node, tree name, tree a
     return NULL_TREE;
 }
 
+/**
+ *  a "debugger_runtime" decl is a function or variable of <debugger.h> that the injected code refers to.
+ *  unlike the attributes above, one attribute serves all of them, the decl is stored by the name given as its argument.
+ */
+
+static struct attribute_spec debugger_runtime = {
+    .name               = "debugger_runtime",
+    .min_length         = 1,
+    .max_length         = 1,
+    .decl_required          = true,
+    .type_required          = false,
+    .function_type_required     = false,
+    .affects_type_identity      = false,
+    .handler            = handle_debugger_runtime_attribute
+};
+
+static std::unordered_map<std::string, tree> debugger_runtime_decls;
+
+tree get_debugger_runtime_decl(const char* name)
+{
+	auto found = debugger_runtime_decls.find(name);
+	if (found == debugger_runtime_decls.end()) return NULL_TREE;
+	return found->second;
+}
+
+static tree handle_debugger_runtime_attribute(tree *node, tree name, tree args, int flags __unused, bool *__unused)
+{
+	gcc_assert(args != NULL_TREE && TREE_CODE(args) == TREE_LIST);
+	tree attribute_value = TREE_VALUE(args);
+	gcc_assert(TREE_CODE(attribute_value) == STRING_CST);
+	debugger_runtime_decls[TREE_STRING_POINTER(attribute_value)] = *node;
+	debugger_info_printf("decl < %s > has been pushed as runtime < %s >.\n", IDENTIFIER_POINTER(DECL_NAME(*node)), TREE_STRING_POINTER(attribute_value));
+	return NULL_TREE;
+}
+
 // TODO: attribute declaration of the final items are highly replicated and required reconstruction
 
 void register_attributes(void *event_data __unused, void *data __unused)
@@ -409,10 +505,10 @@ void register_attributes(void *event_data __unused, void *data __unused)
     register_attribute(&tracker);
     register_attribute(&track_value);
     register_attribute(&debugger_print_func);
-    register_attribute(&debugger_jmp_buf);
     register_attribute(&debugger_setjmp);
     register_attribute(&debugger_entering_risk);
     register_attribute(&debugger_exiting_risk);
+    register_attribute(&debugger_runtime);
 }
 
 #endif
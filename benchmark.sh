@@ -0,0 +1,79 @@
+#!/bin/sh
+# overhead of the injected code: every shape of debugger_bench.c is built without the plugin and once per runtime mode,
+# then run with its output kept aside. reports per shape and mode
+#   ns/iter     time of an iteration, which goes through one site
+#   ns/site     ns/iter minus the baseline, the cost of the site
+#   instr/iter  instructions of an iteration, with perf if it is installed
+#   size+       growth of the binary over the baseline, in bytes
+#   out/iter    bytes written by the runtime (stderr or the capture trace) per iteration
+#
+#   sh benchmark.sh [iterations]     CC, PLUGIN and MODES may be overridden from the environment
+#   e.g. MODES="snapshot delta" PLUGIN=./plugin1.so sh benchmark.sh 1000000
+
+CC=${CC:-gcc}
+PLUGIN=${PLUGIN:-./plugin1.so}
+ITERATIONS=${1:-200000}
+SHAPES="base nested recursive array range tracker"
+MODES=${MODES:-"inline snapshot delta capture ring sampled counters"}
+CFLAGS="-O2 -w -pthread -I."
+
+if [ ! -f "$PLUGIN" ]; then
+    echo "$PLUGIN is missing, build it as in compile.sh" >&2
+    exit 1
+fi
+PLUGIN_NAME=$(basename "$PLUGIN" .so)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mode_flags() {
+    case $1 in
+        baseline) echo "" ;;
+        inline)   echo "-fplugin=$PLUGIN -fplugin-arg-$PLUGIN_NAME-snapshot=inline" ;;
+        snapshot) echo "-fplugin=$PLUGIN" ;;
+        delta)    echo "-fplugin=$PLUGIN -fplugin-arg-$PLUGIN_NAME-snapshot=delta" ;;
+        capture)  echo "-fplugin=$PLUGIN -fplugin-arg-$PLUGIN_NAME-capture=raw" ;;
+        ring)     echo "-fplugin=$PLUGIN -DDEBUGGER_RING_BUFFER" ;;
+        sampled)  echo "-fplugin=$PLUGIN -fplugin-arg-$PLUGIN_NAME-sample=every:100" ;;
+        counters) echo "-fplugin=$PLUGIN -fplugin-arg-$PLUGIN_NAME-counters=on" ;;
+    esac
+}
+
+binary_size() {
+    size "$1" | awk 'NR == 2 { print $1 + $2 }'
+}
+
+instructions() {
+    if command -v perf > /dev/null 2>&1; then
+        perf stat -x, -e instructions:u "$@" 2>&1 > /dev/null | awk -F, '/instructions/ { print $1 }' | tail -n 1
+    else
+        echo "-"
+    fi
+}
+
+# one line "ns/iter instr/iter out/iter" for a binary and a shape, run in a fresh directory
+run() {
+    rm -rf "$WORK/run" && mkdir "$WORK/run"
+    ns=$(cd "$WORK/run" && DEBUGGER_COUNTERS_TOP=0 "$1" "$2" "$ITERATIONS" 2> stderr | awk '{ print $3 }')
+    out=$(cat "$WORK"/run/stderr "$WORK"/run/*.trace 2> /dev/null | wc -c)
+    instr=$(cd "$WORK/run" && DEBUGGER_COUNTERS_TOP=0 instructions "$1" "$2" "$ITERATIONS")
+    if [ "$instr" != "-" ] && [ -n "$instr" ]; then instr=$((instr / ITERATIONS)); fi
+    echo "$ns ${instr:--} $((out / ITERATIONS))"
+}
+
+printf "%-10s %-10s %10s %10s %10s %10s %10s\n" shape mode ns/iter ns/site instr/iter size+ out/iter
+$CC $CFLAGS debugger_bench.c -o "$WORK/baseline" || exit 1
+BASE_SIZE=$(binary_size "$WORK/baseline")
+for mode in $MODES; do
+    $CC $CFLAGS $(mode_flags "$mode") debugger_bench.c -o "$WORK/$mode" || exit 1
+done
+for shape in $SHAPES; do
+    set -- $(run "$WORK/baseline" "$shape")
+    base_ns=$1
+    printf "%-10s %-10s %10s %10s %10s %10s %10s\n" "$shape" baseline "$1" 0 "$2" 0 "$3"
+    for mode in $MODES; do
+        set -- $(run "$WORK/$mode" "$shape")
+        site_ns=$(awk -v a="$1" -v b="$base_ns" 'BEGIN { printf "%.2f", a - b }')
+        growth=$(($(binary_size "$WORK/$mode") - BASE_SIZE))
+        printf "%-10s %-10s %10s %10s %10s %10s %10s\n" "$shape" "$mode" "$1" "$site_ns" "$2" "$growth" "$3"
+    done
+done
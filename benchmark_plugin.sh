@@ -0,0 +1,59 @@
+#!/bin/sh
+# compile time of the plugin against the size of its input: debugger_bench_gen.c writes translation units scaled
+# along one dimension at a time (functions, statements per function, tracked vars per function, struct depth),
+# each is compiled with and without the plugin. one line per unit, for plotting:
+#   functions statements vars depth  ms without  ms with  cpu us in finish_func  peak rss kb of cc1 with the plugin
+# the per function profiles of -fplugin-arg-<plugin>-profile are kept in profile.tsv.
+#
+#   sh benchmark_plugin.sh           CC and PLUGIN may be overridden from the environment
+
+CC=${CC:-gcc}
+PLUGIN=${PLUGIN:-./plugin1.so}
+CFLAGS="-O0 -w -c -I$(pwd)"
+
+if [ ! -f "$PLUGIN" ]; then
+    echo "$PLUGIN is missing, build it as in compile.sh" >&2
+    exit 1
+fi
+PLUGIN_NAME=$(basename "$PLUGIN" .so)
+PLUGIN=$(cd "$(dirname "$PLUGIN")" && pwd)/$(basename "$PLUGIN")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+PROFILE=$(pwd)/profile.tsv
+: > "$PROFILE"
+
+$CC -O2 -o "$WORK/gen" debugger_bench_gen.c || exit 1
+
+now_ms() {
+    date +%s%N | awk '{ printf "%d", $1 / 1000000 }'
+}
+
+# peak rss in kb of the compilation, with GNU time if it is installed
+peak_rss() {
+    if /usr/bin/time -f %M true > /dev/null 2>&1; then
+        /usr/bin/time -f %M "$@" 2>&1 > /dev/null | tail -n 1
+    else
+        "$@" > /dev/null 2>&1
+        echo "-"
+    fi
+}
+
+measure() {
+    "$WORK/gen" "$1" "$2" "$3" "$4" > "$WORK/unit.c"
+    start=$(now_ms)
+    $CC $CFLAGS "$WORK/unit.c" -o "$WORK/plain.o" || exit 1
+    plain=$(($(now_ms) - start))
+    start=$(now_ms)
+    $CC $CFLAGS -fplugin="$PLUGIN" -fplugin-arg-$PLUGIN_NAME-profile="$WORK/profile.tsv" "$WORK/unit.c" -o "$WORK/plugin.o" > /dev/null || exit 1
+    with=$(($(now_ms) - start))
+    finish=$(awk -F'\t' '$2 == "*" && $3 == "finish_func" { print $5 }' "$WORK/profile.tsv")
+    cat "$WORK/profile.tsv" >> "$PROFILE" && rm -f "$WORK/profile.tsv"
+    rss=$(peak_rss $CC $CFLAGS -fplugin="$PLUGIN" "$WORK/unit.c" -o "$WORK/plugin.o")
+    printf "%9s %10s %5s %5s %10s %10s %12s %10s\n" "$1" "$2" "$3" "$4" "$plain" "$with" "${finish:--}" "$rss"
+}
+
+printf "%9s %10s %5s %5s %10s %10s %12s %10s\n" functions statements vars depth ms_plain ms_plugin us_finish kb_peak
+for functions in 1 10 100 1000; do measure $functions 20 4 1; done
+for statements in 10 100 1000 5000; do measure 10 $statements 4 1; done
+for vars in 1 8 32 128; do measure 10 100 $vars 1; done
+for depth in 0 2 8 32; do measure 10 100 4 $depth; done
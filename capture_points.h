@@ -0,0 +1,210 @@
+#ifndef CAPTURE_POINTS_H
+#define CAPTURE_POINTS_H
+
+#include <algorithm>
+#include "debugger_common.h"
+#include "attribute_handler.h"
+#include "analyzer_context.h"
+#include "snapshot_builder.h"
+
+/**
+ *  the sites of the vars not captured on write, see "capture_point" in <attribute_handler.h>.
+ *  the C front end lowers a loop into labels and gotos of the statement list holding it:
+ *      goto entry; top: body; continue: increment; entry: if (cond) goto top; else goto break; break:
+ *  a "loop region" of a statement list runs from a label to the last statement jumping back to it,
+ *  overlapping regions being merged. an iteration ends before the labels leading to the last statement,
+ *  and the loop is left after the last statement and the labels following it.
+ */
+
+struct loop_region
+{
+	tree first;
+	tree iteration_end;
+	tree last;
+};
+
+static tree find_goto_destination(tree* node, int* walk_subtrees, void* data)
+{
+	if (TREE_CODE(*node) == BIND_EXPR || TREE_CODE(*node) == STATEMENT_LIST) *walk_subtrees = 0;
+	else if (TREE_CODE(*node) == GOTO_EXPR && TREE_CODE(GOTO_DESTINATION(*node)) == LABEL_DECL)
+	{
+		((std::vector<tree>*) data)->push_back(GOTO_DESTINATION(*node));
+	}
+	return NULL_TREE;
+}
+
+static void find_loop_regions(tree stmt_list, std::vector<loop_region>& loops)
+{
+	std::vector<tree> stmts;
+	std::unordered_map<tree, size_t> label_positions;
+	std::vector<std::pair<size_t, size_t> > spans;
+	for (tree_stmt_iterator it = tsi_start(stmt_list); !tsi_end_p(it); tsi_next(&it))
+	{
+		tree stmt = tsi_stmt(it);
+		if (TREE_CODE(stmt) == LABEL_EXPR) label_positions[LABEL_EXPR_LABEL(stmt)] = stmts.size();
+		std::vector<tree> destinations;
+		walk_tree_without_duplicates(&stmt, find_goto_destination, &destinations);
+		for (tree label: destinations)
+		{
+			auto found = label_positions.find(label);
+			if (found != label_positions.end()) spans.push_back(std::make_pair(found->second, stmts.size()));
+		}
+		stmts.push_back(stmt);
+	}
+	std::sort(spans.begin(), spans.end());
+	for (size_t i = 0; i < spans.size(); )
+	{
+		size_t first = spans[i].first, last = spans[i].second;
+		for (i++; i < spans.size() && spans[i].first <= last; i++) last = std::max(last, spans[i].second);
+		size_t iteration_end = last;
+		while (iteration_end > first + 1 && TREE_CODE(stmts[iteration_end - 1]) == LABEL_EXPR) iteration_end--;
+		loops.push_back({ stmts[first], stmts[iteration_end], stmts[last] });
+	}
+}
+
+/**
+ *  the walk through one statement list: its loop regions, and the vars the loop being walked captures.
+ *  the vars of a loop inside another loop are captured by the outer one.
+ */
+
+struct statement_list_walk
+{
+	analyzer_context* parent;
+	std::vector<loop_region> loops;
+	size_t loop = 0;                         // the region being walked, or the next one
+	bool inside = false;
+	bool leaving = false;                    // the last statement of the region is walked, not the labels after it
+	analyzer_context* loop_context = NULL;   // the loop-exit vars of the region
+public:
+	statement_list_walk(analyzer_context* parent, tree stmt_list)
+	{
+		this->parent = parent;
+		if (loop_exit_points_used) find_loop_regions(stmt_list, loops);
+	}
+	~statement_list_walk()
+	{
+		if (loop_context != NULL) loop_context->release();
+	}
+	void enter(tree stmt)
+	{
+		if (inside || loop >= loops.size() || stmt != loops[loop].first) return;
+		inside = true;
+		loop_context = parent->new_instance();
+	}
+	bool at_iteration_end(tree stmt)
+	{
+		return inside && stmt == loops[loop].iteration_end;
+	}
+	void walked(tree stmt)
+	{
+		if (!inside || stmt != loops[loop].last) return;
+		inside = false;
+		leaving = true;
+	}
+	/**
+	 *  routes the loop-exit vars of a statement just walked to the loop capturing them.
+	 */
+	void capture_at_loop_exit(analyzer_context* context)
+	{
+		for (tree var_decl: context->loop_exit_vars)
+		{
+			if (inside && !parent->in_loop) loop_context->push_var_to_track(var_decl);
+			else parent->push_loop_exit_var(var_decl);
+		}
+	}
+};
+
+static analyzer_context* set_location_of(analyzer_context* context, tree node)
+{
+	location_t location = node != NULL_TREE && EXPR_P(node) ? EXPR_LOCATION(node) : UNKNOWN_LOCATION;
+	if (location == UNKNOWN_LOCATION) location = DECL_SOURCE_LOCATION(context->context_func_decl);
+	return context->set_location(LOCATION_FILE(location), LOCATION_LINE(location));
+}
+
+static tree build_snapshot_list(analyzer_context* context, std::deque<tree>& vars)
+{
+	tree site_list = alloc_stmt_list();
+	tree_stmt_iterator site_it = tsi_start(site_list);
+	inject_snapshot(site_it, context, vars);
+	return site_list;
+}
+
+/**
+ *  injects the site of "vars" before the statement at "it", which it stays at.
+ */
+
+void inject_snapshot_before(tree_stmt_iterator& it, analyzer_context* context, std::deque<tree>& vars)
+{
+	tsi_link_before(&it, build_snapshot_list(context, vars), TSI_SAME_STMT);
+}
+
+/**
+ *  makes a statement that is not a list, e.g. the arm of an if, a list of itself so that sites can be linked around it.
+ */
+
+tree wrap_in_statement_list(tree& stmt)
+{
+	if (stmt != NULL_TREE && TREE_CODE(stmt) == STATEMENT_LIST) return stmt;
+	tree list = alloc_stmt_list();
+	if (stmt != NULL_TREE) append_to_statement_list_force(stmt, &list);
+	stmt = list;
+	return list;
+}
+
+/**
+ *  runs the site of "vars" whenever "bind_expr" is left, as its body becomes the try of a try-finally:
+ *  the gimplifier then runs the site before every goto, break, continue and return leaving the block.
+ */
+
+void inject_snapshot_on_leaving(tree bind_expr, analyzer_context* context, std::deque<tree>& vars)
+{
+	tree body = wrap_in_statement_list(BIND_EXPR_BODY(bind_expr));
+	tree try_finally = build2(TRY_FINALLY_EXPR, void_type_node, body, build_snapshot_list(context, vars));
+	TREE_SIDE_EFFECTS(try_finally) = 1;
+	SET_EXPR_LOCATION(try_finally, EXPR_LOCATION(bind_expr));
+	BIND_EXPR_BODY(bind_expr) = try_finally;
+}
+
+/**
+ *  the passes of a loop are counted per thread, "if (__builtin_expect(++passes % every == 0, 0)) site;".
+ */
+
+static tree build_loop_passes()
+{
+	char name[64];
+	sprintf(name, "__debugger_loop_passes_%d", snapshot_data_count++);
+	tree decl = build_decl(UNKNOWN_LOCATION, VAR_DECL, get_identifier(name), long_unsigned_type_node);
+	TREE_STATIC(decl) = 1;
+	TREE_USED(decl) = 1;
+	DECL_ARTIFICIAL(decl) = 1;
+	DECL_IGNORED_P(decl) = 1;
+	DECL_INITIAL(decl) = build_int_cst(long_unsigned_type_node, 0);
+	set_decl_tls_model(decl, decl_default_tls_model(decl));
+	varpool_node::finalize_decl(decl);
+	return decl;
+}
+
+/**
+ *  the periodic vars of "vars" are grouped by their period, every period has its own counter and site.
+ */
+
+void inject_periodic_snapshot_before(tree_stmt_iterator& it, analyzer_context* context, std::deque<tree>& vars)
+{
+	std::map<long, std::deque<tree> > periodic_vars;
+	for (tree var_decl: vars)
+	{
+		long every = capture_point_of(var_decl).every;
+		if (every > 0) periodic_vars[every].push_back(var_decl);
+	}
+	for (auto& period: periodic_vars)
+	{
+		tree passes = build_loop_passes();
+		tree type = TREE_TYPE(passes);
+		tree incremented = build2(PREINCREMENT_EXPR, type, passes, build_int_cst(type, 1));
+		tree remainder = build2(TRUNC_MOD_EXPR, type, incremented, build_int_cst(type, period.first));
+		tree due = build2(EQ_EXPR, integer_type_node, remainder, build_int_cst(type, 0));
+		tsi_link_before(&it, build_if(build_unlikely(due), build_snapshot_list(context, period.second)), TSI_SAME_STMT);
+	}
+}
+
+#endif
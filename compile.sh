@@ -4,3 +4,48 @@ g++ -I`g++ -print-file-name=plugin`/include -std=c++11 -g -Wall -fno-rtti -Wno-l
 g++ -std=c++11 -dynamiclib -undefined dynamic_lookup -g -o plugin1.so plugin1.o
 gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-port=14857 -O0 -fdump-tree-gimple plugin1_test.c -o plugin1_test.o
 # gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-port=14857 -O0 -S plugin1_test.c
+# ring buffer runtime: values are recorded per thread and written by a background drain thread
+# gcc -fplugin=./plugin1.so -DDEBUGGER_RING_BUFFER -pthread -O0 plugin1_test.c -o plugin1_test.o
+# delta snapshots: a site only prints the fields changed since the thread last went through it
+# gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-snapshot=delta -O0 plugin1_test.c -o plugin1_test.o
+# raw capture: variables are copied into debugger_capture.trace, decoded afterwards into <vars_info>
+# gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-capture=raw -O0 plugin1_test.c -o plugin1_test.o
+# gcc -O2 -o debugger_decode debugger_decode.c && ./debugger_decode debugger_capture.trace
+# network transport (ring buffer runtime): DEBUGGER_TRANSPORT=tcp | tcp://<host>:<port> | unix:<path>
+# DEBUGGER_TRANSPORT=tcp ./plugin1_test.o    # connects to localhost on the port given by -fplugin-arg-plugin1-port
+# shared-memory transport to a local collector (ring buffer runtime)
+# gcc -O2 -o debugger_collector debugger_collector.c && ./debugger_collector -d traces &
+# DEBUGGER_TRANSPORT=shm ./plugin1_test.o
+# indexed trace segments (raw capture): one .dts file per 64 MB, queried by site, variable and time
+# DEBUGGER_TRACE_DIR=traces ./plugin1_test.o
+# gcc -O2 -o debugger_trace_query debugger_trace_query.c && ./debugger_trace_query -s plugin1_test.c:27 -v node traces/*.dts
+# per-site switches: every site can be turned off at startup or while running
+# DEBUGGER_SITES="-*,+plugin1_test.c:27" ./plugin1_test.o
+# DEBUGGER_SITES_CONTROL=/tmp/debugger.sock ./plugin1_test.o &   # then: echo -n "-*" | socat - UNIX-SENDTO:/tmp/debugger.sock
+# sampling: a site sampled at compile time or at startup only records some passes, under an overhead budget
+# gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-sample=every:100 -fplugin-arg-plugin1-overhead=0.05 -O0 plugin1_test.c -o plugin1_test.o
+# DEBUGGER_SAMPLING=rate:1000/10 DEBUGGER_OVERHEAD=0.05 DEBUGGER_SITES="+plugin1_test.c:27@always" ./plugin1_test.o
+# per-site counters: hits, ticks and bytes of every site, a top-N report on stderr at exit and a table in $DEBUGGER_COUNTERS
+# gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-counters=on -O0 plugin1_test.c -o plugin1_test.o
+# DEBUGGER_COUNTERS=counters.tsv DEBUGGER_COUNTERS_TOP=20 ./plugin1_test.o
+# overhead of every injection shape and runtime mode against a build without the plugin
+# sh benchmark.sh 1000000
+# plugin self-profiling: cpu time and peak memory growth per callback, per function and per unit, as tab separated lines
+# gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-profile=profile.tsv -O0 plugin1_test.c -o plugin1_test.o
+# compile time against generated units of growing size: sh benchmark_plugin.sh
+# inline printing calls one outlined printer per type instead of expanding the fields at every site
+# gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-snapshot=inline -fplugin-arg-plugin1-printers=inline -O0 plugin1_test.c -o plugin1_test.o   # the old expansion
+# optimized builds: the sites are injected by a GIMPLE pass after SSA construction instead of into GENERIC
+# gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-pass=ssa -O2 plugin1_test.c -o plugin1_test.o
+# consecutive writes to a var keep only the snapshot of the last one, unless the statements in between observe it
+# gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-redundant=keep -O0 plugin1_test.c -o plugin1_test.o   # a snapshot per write
+# capture points: track_var_at("scope-exit"), track_var_at("return"), track_var_at("loop-exit:1000"), or for every var
+# gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-capture-at=loop-exit -O0 plugin1_test.c -o plugin1_test.o
+# field-granular tracking: "node.value = 4" captures node.value only; fields=first-full captures a var whole the first time
+# gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-fields=first-full -O0 plugin1_test.c -o plugin1_test.o   # or fields=off
+# arrays of scalars and track_range ranges are checked readable once and printed by one buffered write per 16 KB
+# gcc -fplugin=./plugin1.so -DDEBUGGER_ITEMS_BUFFER=65536 -O0 plugin1_test.c -o plugin1_test.o
+# bounds of track_range may be expressions over other vars, evaluated at every capture: int* buf track_range(0, length) = ...
+# heap bounds: a pointer to scalars starting a malloc'ed block is printed as the whole block, up to DEBUGGER_HEAP_CAP bytes
+# gcc -fplugin=./plugin1.so -fplugin-arg-plugin1-heap-bounds=on -O0 plugin1_test.c -o plugin1_test.o
+# DEBUGGER_HEAP_CAP=65536 ./plugin1_test.o    # DEBUGGER_HEAP_CAP=0 dereferences every pointer once again
@@ -4,6 +4,15 @@
 #include "debugger_network.h"
 #include "debugger_shared.h"
 #include "debugger_exception_handler.h"
+#include "debugger_address_map.h"
+#include "debugger_heap.h"
+#include "debugger_site_counters.h"
+#include "debugger_site_switch.h"
+#include <string.h>
+
+#ifdef DEBUGGER_RING_BUFFER
+#include "debugger_ring_buffer.h"
+#endif
 
 /**
  *  this file should be included in the source code to debug
@@ -22,76 +31,107 @@ struct debug_context
 	const char* file_name;
 };
 
+/**
+ *  "DEBUGGER_EMIT" hands a value to the output of the runtime.
+ *  with DEBUGGER_RING_BUFFER the value is stored into the ring of the calling thread and formatted later by the drain thread,
+ *  otherwise it is printed to stderr immediately.
+ */
+
+#ifdef DEBUGGER_RING_BUFFER
+#define DEBUGGER_EMIT(kind, member, v, fmt) debugger_ring_emit_value((kind), 0, (union debugger_value) { .member = (v) })
+#else
+#define DEBUGGER_EMIT(kind, member, v, fmt) debugger_count_emitted(fprintf(stderr, (fmt), (v)))
+#endif
+
 __attribute__((debugger_print_func(SIGNED_CHAR)))
 void print_char(char v)
 {
-	fprintf(stderr, "%c", v);
+	DEBUGGER_EMIT(SIGNED_CHAR, i, v, "%c");
 }
 
 __attribute__((debugger_print_func(UNSIGNED_CHAR)))
 void print_uchar(unsigned char v)
 {
-	fprintf(stderr, "%c", v);
+	DEBUGGER_EMIT(UNSIGNED_CHAR, i, v, "%c");
 }
 
 __attribute__((debugger_print_func(SIGNED_SHORT)))
 void print_short(short v)
 {
-	fprintf(stderr, "%hd", v);
+	DEBUGGER_EMIT(SIGNED_SHORT, i, v, "%hd");
 }
 
 __attribute__((debugger_print_func(UNSIGNED_SHORT)))
 void print_ushort(unsigned short v)
 {
-	fprintf(stderr, "%hu", v);
+	DEBUGGER_EMIT(UNSIGNED_SHORT, u, v, "%hu");
 }
 
 __attribute__((debugger_print_func(SIGNED_INT)))
 void print_int(int v)
 {
-	fprintf(stderr, "%d", v);
+	DEBUGGER_EMIT(SIGNED_INT, i, v, "%d");
 }
 
 __attribute__((debugger_print_func(UNSIGNED_INT)))
 void print_uint(unsigned int v)
 {
-	fprintf(stderr, "%u", v);
+	DEBUGGER_EMIT(UNSIGNED_INT, u, v, "%u");
 }
 
 __attribute__((debugger_print_func(SIGNED_LONG)))
 void print_long(long int v)
 {
-	fprintf(stderr, "%ld", v);
+	DEBUGGER_EMIT(SIGNED_LONG, i, v, "%ld");
 }
 
 __attribute__((debugger_print_func(UNSIGNED_LONG)))
 void print_ulong(unsigned long int v)
 {
-	fprintf(stderr, "%lu", v);
+	DEBUGGER_EMIT(UNSIGNED_LONG, u, v, "%lu");
 }
 
 __attribute__((debugger_print_func(REAL_FLOAT)))
 void print_float(float v)
 {
-	fprintf(stderr, "%f", v);
+	DEBUGGER_EMIT(REAL_FLOAT, d, v, "%f");
 }
 
 __attribute__((debugger_print_func(REAL_DOUBLE)))
 void print_double(double v)
 {
-	fprintf(stderr, "%lf", v);
+	DEBUGGER_EMIT(REAL_DOUBLE, d, v, "%lf");
 }
 
 __attribute__((debugger_print_func(POINTER)))
 void print_pointer(void* v)
 {
-	fprintf(stderr, "%p", v);
+	DEBUGGER_EMIT(POINTER, p, v, "%p");
 }
 
 __attribute__((debugger_print_func(CHAR_POINTER)))
 void print_char_pointer(const char* v)
 {
-	fprintf(stderr, "%s", v);
+	if (v != NULL && !debugger_readable(v, 1)) debugger_guard_fail();
+#ifdef DEBUGGER_RING_BUFFER
+	debugger_ring_emit_string(v);
+#else
+	debugger_count_emitted(fprintf(stderr, "%s", v));
+#endif
+}
+
+/**
+ *  the markup injected by the plugin is always a string literal, thus only the pointer has to be recorded.
+ */
+
+__attribute__((debugger_print_func(STRING_LITERAL)))
+void print_string_literal(const char* v)
+{
+#ifdef DEBUGGER_RING_BUFFER
+	debugger_ring_emit_pointer(STRING_LITERAL, 0, v);
+#else
+	debugger_count_emitted(fprintf(stderr, "%s", v));
+#endif
 }
 
 __attribute__((debugger_print_func(DEBUG_CONTEXT)))
@@ -100,11 +140,149 @@ struct debug_context build_debug_context(const char* file_name, int line_no)
 	struct debug_context result;
 	result.line_no = line_no;
 	result.file_name = file_name;
-	fprintf(stderr, "%s:%d:", file_name, line_no);
+#ifdef DEBUGGER_RING_BUFFER
+	debugger_ring_emit_pointer(DEBUG_CONTEXT, line_no, file_name);
+#else
+	debugger_count_emitted(fprintf(stderr, "%s:%d:", file_name, line_no));
+#endif
 	return result;
 }
 
+/**
+ *  prints a char array in place, the array is not required to be terminated.
+ */
+
+void print_chars(const char* v, long n)
+{
+#ifdef DEBUGGER_RING_BUFFER
+	debugger_ring_emit_chars(v, strnlen(v, n));
+#else
+	debugger_count_emitted(fprintf(stderr, "%.*s", (int) strnlen(v, n), v));
+#endif
+}
+
+/**
+ *  the scalar elements of an array or of a "track_range" are printed at once: the range is checked readable once,
+ *  and the markup and the values are formatted into a buffer written whole, instead of a guard and a print call
+ *  per element. the markup is the one injected for an element, "<item>" at "padding", the value indented by 4.
+ */
+
+#ifndef DEBUGGER_ITEMS_BUFFER
+#define DEBUGGER_ITEMS_BUFFER 16384
+#endif
+
+static unsigned long debugger_value_size(unsigned int kind)
+{
+	switch (kind)
+	{
+		case SIGNED_CHAR:
+		case UNSIGNED_CHAR:  return sizeof(char);
+		case SIGNED_SHORT:
+		case UNSIGNED_SHORT: return sizeof(short);
+		case SIGNED_INT:
+		case UNSIGNED_INT:   return sizeof(int);
+		case SIGNED_LONG:
+		case UNSIGNED_LONG:  return sizeof(long);
+		case REAL_FLOAT:     return sizeof(float);
+		case REAL_DOUBLE:    return sizeof(double);
+		default:             return sizeof(void*);
+	}
+}
+
+static int debugger_format_value(char* out, size_t size, unsigned int kind, const void* p)
+{
+	switch (kind)
+	{
+		case SIGNED_CHAR:    return snprintf(out, size, "%c", *(const char*) p);
+		case UNSIGNED_CHAR:  return snprintf(out, size, "%c", *(const unsigned char*) p);
+		case SIGNED_SHORT:   return snprintf(out, size, "%hd", *(const short*) p);
+		case UNSIGNED_SHORT: return snprintf(out, size, "%hu", *(const unsigned short*) p);
+		case SIGNED_INT:     return snprintf(out, size, "%d", *(const int*) p);
+		case UNSIGNED_INT:   return snprintf(out, size, "%u", *(const unsigned int*) p);
+		case SIGNED_LONG:    return snprintf(out, size, "%ld", *(const long*) p);
+		case UNSIGNED_LONG:  return snprintf(out, size, "%lu", *(const unsigned long*) p);
+		case REAL_FLOAT:     return snprintf(out, size, "%f", *(const float*) p);
+		case REAL_DOUBLE:    return snprintf(out, size, "%lf", *(const double*) p);
+		default:             return snprintf(out, size, "%p", *(void* const*) p);
+	}
+}
+
+static void debugger_emit_formatted(const char* v, size_t len)
+{
+#ifdef DEBUGGER_RING_BUFFER
+	for (size_t at = 0; at < len; at += DEBUGGER_RING_MAX_STRING)
+	{
+		debugger_ring_emit_chars(v + at, len - at < DEBUGGER_RING_MAX_STRING ? len - at : DEBUGGER_RING_MAX_STRING);
+	}
+#else
+	debugger_count_emitted(fwrite(v, 1, len, stderr));
+#endif
+}
+
+static void debugger_emit_padding(size_t padding)
+{
+	static const char spaces[] = "                                                                ";
+	for (; padding > sizeof(spaces) - 1; padding -= sizeof(spaces) - 1) debugger_emit_formatted(spaces, sizeof(spaces) - 1);
+	debugger_emit_formatted(spaces, padding);
+}
+
+/**
+ *  an item whose markup does not fit the buffer is emitted piece by piece.
+ */
+
+static void debugger_print_item_in_pieces(unsigned int kind, const void* p, size_t padding)
+{
+	char value[512];
+	int n = debugger_format_value(value, sizeof(value), kind, p);
+	debugger_emit_padding(padding);
+	debugger_emit_formatted("<item>\n", 7);
+	debugger_emit_padding(padding + 4);
+	debugger_emit_formatted(value, n < 0 ? 0 : (size_t) n < sizeof(value) ? (size_t) n : sizeof(value) - 1);
+	debugger_emit_formatted("\n", 1);
+	debugger_emit_padding(padding);
+	debugger_emit_formatted("</item>\n", 8);
+}
+
+__attribute__((debugger_runtime("print_items")))
+void debugger_print_items(unsigned int kind, const void* v, long count, long stride, unsigned int padding)
+{
+	if (count <= 0) return;
+	if (!debugger_readable(v, (count - 1) * stride + debugger_value_size(kind))) debugger_guard_fail();
+	char buffer[DEBUGGER_ITEMS_BUFFER];
+	size_t used = 0;
+	size_t item_length = 3 * (size_t) padding + 24 + 512; // the paddings and tags, and the longest value, a %lf double
+	if (item_length > sizeof(buffer))
+	{
+		for (long i = 0; i < count; i++) debugger_print_item_in_pieces(kind, (const char*) v + i * stride, padding);
+		return;
+	}
+	for (long i = 0; i < count; i++)
+	{
+		if (used + item_length > sizeof(buffer))
+		{
+			debugger_emit_formatted(buffer, used);
+			used = 0;
+		}
+		used += sprintf(buffer + used, "%*s<item>\n%*s", (int) padding, "", (int) padding + 4, "");
+		int n = debugger_format_value(buffer + used, sizeof(buffer) - used, kind, (const char*) v + i * stride);
+		used += n < 0 ? 0 : (size_t) n;
+		used += sprintf(buffer + used, "\n%*s</item>\n", (int) padding, "");
+	}
+	debugger_emit_formatted(buffer, used);
+}
+
+void debugger_report_segfault(void)
+{
+	print_string_literal("<__SEGFAULT__/>\n");
+}
+
+#include "debugger_snapshot.h"
+#include "debugger_delta.h"
+#include "debugger_capture.h"
+
 #define track_var __attribute__((track_value))
 #define track_range(a, b) __attribute__((track_value(a, b)))
+#define track_var_at(point) __attribute__((track_value(point)))
+#define track_range_at(a, b, point) __attribute__((track_value(a, b, point)))
 
 #endif
\ No newline at end of file
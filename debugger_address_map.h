@@ -0,0 +1,318 @@
+#ifndef DEBUGGER_ADDRESS_MAP_H
+#define DEBUGGER_ADDRESS_MAP_H
+
+/**
+ *  this file is part of the runtime included by <debugger.h>, after <debugger_exception_handler.h>.
+ *
+ *  before following a pointer the injected code asks "debugger_readable", which looks the address up
+ *  in a sorted copy of the readable mappings of /proc/self/maps, so that a garbage pointer costs a binary search
+ *  instead of a segfault. the copy is refreshed lazily, when an address is missing and the copy is older than
+ *  $DEBUGGER_MAPS_REFRESH_MS (10 by default), a miss in between is checked with mincore, once per page and thread
+ *  until the next refresh.
+ *  the segfault guard is still there for what the copy gets wrong, e.g. a mapping removed since the last refresh.
+ *
+ *  without /proc/self/maps, or with DEBUGGER_ADDRESS_MAP=0, every address is considered readable.
+ *
+ *  the mappings that may hold heap blocks are kept apart for <debugger_heap.h>: [heap], and the writable anonymous
+ *  mappings that do not directly follow a file, which would be the .bss of a binary.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef DEBUGGER_ADDRESS_MAP_CAPACITY
+#define DEBUGGER_ADDRESS_MAP_CAPACITY 8192  // readable ranges kept, adjacent mappings are merged
+#endif
+
+#ifndef DEBUGGER_HEAP_MAP_CAPACITY
+#define DEBUGGER_HEAP_MAP_CAPACITY 1024
+#endif
+
+#ifndef DEBUGGER_PAGE_CACHE
+#define DEBUGGER_PAGE_CACHE 16  // pages per thread whose mincore answer is kept until the next refresh
+#endif
+
+#define DEBUGGER_MIN_ADDRESS 4096
+#define DEBUGGER_SPINS_BEFORE_YIELD 64
+
+struct debugger_address_range
+{
+	uintptr_t start;
+	uintptr_t end;
+};
+
+/**
+ *  the ranges are read under a sequence lock: "sequence" is odd while a refresh rewrites them,
+ *  and a reader retries when it has changed during its search.
+ */
+
+static struct debugger_address_range debugger_address_ranges[DEBUGGER_ADDRESS_MAP_CAPACITY];
+static unsigned long debugger_address_n_ranges;
+static struct debugger_address_range debugger_heap_ranges[DEBUGGER_HEAP_MAP_CAPACITY];
+static unsigned long debugger_heap_n_ranges;
+static struct debugger_address_range debugger_anonymous_ranges[DEBUGGER_HEAP_MAP_CAPACITY];
+static unsigned long debugger_anonymous_n_ranges;
+static unsigned long debugger_address_sequence;
+static long debugger_address_refreshed_ms = -1;
+static long debugger_address_refresh_interval_ms = 10;
+static int debugger_address_map_enabled = 1;
+static uintptr_t debugger_page_size = 4096;
+static pthread_mutex_t debugger_address_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct debugger_page_verdict
+{
+	uintptr_t page;
+	long refreshed_ms;  // the refresh the answer was given after
+	int mapped;
+};
+
+static __thread struct debugger_page_verdict debugger_page_verdicts[DEBUGGER_PAGE_CACHE];
+
+static long debugger_now_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ *  appends [start, end) to the "n_ranges" first "ranges", or extends the last one when they are adjacent.
+ *  returns 0 when the ranges are full.
+ */
+
+static int debugger_address_ranges_append(struct debugger_address_range* ranges, unsigned long* n_ranges,
+	unsigned long capacity, uintptr_t start, uintptr_t end)
+{
+	unsigned long n = *n_ranges;
+	if (n > 0 && ranges[n - 1].end == start)
+	{
+		__atomic_store_n(&ranges[n - 1].end, end, __ATOMIC_RELAXED);
+		return 1;
+	}
+	if (n == capacity) return 0;
+	__atomic_store_n(&ranges[n].start, start, __ATOMIC_RELAXED);
+	__atomic_store_n(&ranges[n].end, end, __ATOMIC_RELAXED);
+	*n_ranges = n + 1;
+	return 1;
+}
+
+/**
+ *  must be called with "debugger_address_map_lock" held.
+ */
+
+void debugger_address_map_refresh(void)
+{
+	FILE* maps = fopen("/proc/self/maps", "r");
+	if (maps == NULL)
+	{
+		debugger_address_map_enabled = 0;
+		return;
+	}
+	__atomic_store_n(&debugger_address_sequence, debugger_address_sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	unsigned long n = 0, n_heap = 0, n_anonymous = 0;
+	unsigned long previous_end = 0;
+	int previous_is_file = 0;
+	char line[512];
+	while (fgets(line, sizeof(line), maps) != NULL)
+	{
+		unsigned long start, end;
+		char perms[5];
+		int path_at = 0;
+		if (sscanf(line, "%lx-%lx %4s %*s %*s %*s %n", &start, &end, perms, &path_at) != 3) continue;
+		const char* path = path_at > 0 ? line + path_at : "";
+		int follows_file = previous_is_file && previous_end == start;
+		previous_end = end;
+		previous_is_file = *path == '/';
+		if (perms[0] != 'r') continue;
+		if (strstr(line, "[vvar") != NULL) continue; // readable on paper, but some of its pages fault
+		if (perms[1] == 'w' && strncmp(path, "[heap]", 6) == 0)
+		{
+			debugger_address_ranges_append(debugger_heap_ranges, &n_heap, DEBUGGER_HEAP_MAP_CAPACITY, start, end);
+		}
+		else if (perms[1] == 'w' && (*path == '\n' || *path == 0) && !follows_file)
+		{
+			debugger_address_ranges_append(debugger_anonymous_ranges, &n_anonymous, DEBUGGER_HEAP_MAP_CAPACITY, start, end);
+		}
+		if (!debugger_address_ranges_append(debugger_address_ranges, &n, DEBUGGER_ADDRESS_MAP_CAPACITY, start, end)) break;
+	}
+	fclose(maps);
+	__atomic_store_n(&debugger_address_n_ranges, n, __ATOMIC_RELAXED);
+	__atomic_store_n(&debugger_heap_n_ranges, n_heap, __ATOMIC_RELAXED);
+	__atomic_store_n(&debugger_anonymous_n_ranges, n_anonymous, __ATOMIC_RELAXED);
+	__atomic_store_n(&debugger_address_sequence, debugger_address_sequence + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&debugger_address_refreshed_ms, debugger_now_ms(), __ATOMIC_RELEASE);
+}
+
+/**
+ *  waits for a refresh to end: a refresh reads /proc/self/maps, thus once a few pauses are not enough,
+ *  the processor is left to the refreshing thread.
+ */
+
+static void debugger_address_map_wait(unsigned int spins)
+{
+	if (spins >= DEBUGGER_SPINS_BEFORE_YIELD)
+	{
+		sched_yield();
+		return;
+	}
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ *  returns 1 if [start, end) lies in one of the "ranges" of the copy.
+ */
+
+static int debugger_ranges_lookup(const struct debugger_address_range* ranges, const unsigned long* n_ranges,
+	uintptr_t start, uintptr_t end)
+{
+	for (unsigned int spins = 0;; spins++)
+	{
+		unsigned long sequence = __atomic_load_n(&debugger_address_sequence, __ATOMIC_ACQUIRE);
+		if (sequence & 1)
+		{
+			debugger_address_map_wait(spins);
+			continue;
+		}
+		unsigned long low = 0, high = __atomic_load_n(n_ranges, __ATOMIC_RELAXED);
+		int found = 0;
+		while (low < high)
+		{
+			unsigned long middle = (low + high) / 2;
+			uintptr_t range_start = __atomic_load_n(&ranges[middle].start, __ATOMIC_RELAXED);
+			uintptr_t range_end = __atomic_load_n(&ranges[middle].end, __ATOMIC_RELAXED);
+			if (start >= range_end) low = middle + 1;
+			else if (start < range_start) high = middle;
+			else
+			{
+				found = end <= range_end;
+				break;
+			}
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&debugger_address_sequence, __ATOMIC_RELAXED) == sequence) return found;
+		debugger_address_map_wait(spins);
+	}
+}
+
+static int debugger_address_map_lookup(uintptr_t start, uintptr_t end)
+{
+	return debugger_ranges_lookup(debugger_address_ranges, &debugger_address_n_ranges, start, end);
+}
+
+/**
+ *  asks the kernel whether "page" is mapped, unless the calling thread already did since the refresh "refreshed_ms".
+ *  a syscall is still far cheaper than a segfault, and a mapped but unreadable page is left to the guard.
+ */
+
+static int debugger_page_mapped(uintptr_t page, long refreshed_ms)
+{
+	struct debugger_page_verdict* verdict = &debugger_page_verdicts[(page / debugger_page_size) % DEBUGGER_PAGE_CACHE];
+	if (verdict->page == page && verdict->refreshed_ms == refreshed_ms) return verdict->mapped;
+	unsigned char resident;
+	verdict->page = page;
+	verdict->refreshed_ms = refreshed_ms;
+	verdict->mapped = mincore((void*) page, 1, (void*) &resident) == 0;
+	return verdict->mapped;
+}
+
+/**
+ *  whether the first and the last page of [start, end) are mapped, for a miss between two refreshes.
+ */
+
+static int debugger_address_mapped(uintptr_t start, uintptr_t end, long refreshed_ms)
+{
+	uintptr_t first = start & ~(debugger_page_size - 1), last = (end - 1) & ~(debugger_page_size - 1);
+	return debugger_page_mapped(first, refreshed_ms) && (last == first || debugger_page_mapped(last, refreshed_ms));
+}
+
+static void debugger_address_map_init(void)
+{
+	const char* enabled = getenv("DEBUGGER_ADDRESS_MAP");
+	if (enabled != NULL && strcmp(enabled, "0") == 0) debugger_address_map_enabled = 0;
+	const char* interval = getenv("DEBUGGER_MAPS_REFRESH_MS");
+	if (interval != NULL) debugger_address_refresh_interval_ms = atol(interval);
+	long page_size = sysconf(_SC_PAGESIZE);
+	if (page_size > 0) debugger_page_size = (uintptr_t) page_size;
+	if (debugger_address_map_enabled) debugger_address_map_refresh();
+}
+
+int debugger_readable(const void* p, unsigned long n)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, debugger_address_map_init);
+	if (!debugger_address_map_enabled) return 1;
+
+	uintptr_t start = (uintptr_t) p;
+	uintptr_t end = start + (n > 0 ? n : 1);
+	if (start < DEBUGGER_MIN_ADDRESS || end < start) return 0;
+	if (debugger_address_map_lookup(start, end)) return 1;
+
+	// missing: the copy may predate the mapping
+	long refreshed_ms = __atomic_load_n(&debugger_address_refreshed_ms, __ATOMIC_ACQUIRE);
+	if (debugger_now_ms() - refreshed_ms < debugger_address_refresh_interval_ms) return debugger_address_mapped(start, end, refreshed_ms);
+	pthread_mutex_lock(&debugger_address_map_lock);
+	if (debugger_address_refreshed_ms == refreshed_ms) debugger_address_map_refresh();
+	pthread_mutex_unlock(&debugger_address_map_lock);
+	return !debugger_address_map_enabled || debugger_address_map_lookup(start, end);
+}
+
+/**
+ *  unlike "debugger_readable" a miss is only looked up again after a refresh, and without the copy nothing is found.
+ */
+
+static int debugger_in_ranges(const struct debugger_address_range* ranges, const unsigned long* n_ranges,
+	const void* p, unsigned long n)
+{
+	if (!debugger_readable(p, n) || !debugger_address_map_enabled) return 0;
+	uintptr_t start = (uintptr_t) p, end = start + (n > 0 ? n : 1);
+	if (debugger_ranges_lookup(ranges, n_ranges, start, end)) return 1;
+	long refreshed_ms = __atomic_load_n(&debugger_address_refreshed_ms, __ATOMIC_ACQUIRE);
+	if (debugger_now_ms() - refreshed_ms < debugger_address_refresh_interval_ms) return 0;
+	pthread_mutex_lock(&debugger_address_map_lock);
+	if (debugger_address_refreshed_ms == refreshed_ms) debugger_address_map_refresh();
+	pthread_mutex_unlock(&debugger_address_map_lock);
+	return debugger_ranges_lookup(ranges, n_ranges, start, end);
+}
+
+/**
+ *  returns 1 if the "n" bytes at "p" lie in [heap], where the main arena of malloc keeps its blocks.
+ */
+
+int debugger_in_heap(const void* p, unsigned long n)
+{
+	return debugger_in_ranges(debugger_heap_ranges, &debugger_heap_n_ranges, p, n);
+}
+
+/**
+ *  returns 1 if the "n" bytes at "p" lie in a single anonymous mapping that may be a block mapped by malloc.
+ */
+
+int debugger_in_anonymous_mapping(const void* p, unsigned long n)
+{
+	return debugger_in_ranges(debugger_anonymous_ranges, &debugger_anonymous_n_ranges, p, n);
+}
+
+/**
+ *  the check injected before a dereference, an unreadable pointer leaves the guarded region as a segfault would.
+ */
+
+__attribute__((debugger_runtime("check_readable")))
+void debugger_check_readable(const void* p, unsigned long n)
+{
+	if (!debugger_readable(p, n)) debugger_guard_fail();
+}
+
+#endif
@@ -0,0 +1,153 @@
+#include "debugger.h"
+
+/**
+ *  synthetic workloads for benchmark.sh, one per shape of injected code.
+ *  every iteration writes a tracked variable once, so that it goes through exactly one site.
+ *  compiled without the plugin the same loops give the baseline, "bench_use" keeps them from being optimized away.
+ *
+ *      ./debugger_bench <shape> <iterations>
+ *  prints "<shape> <iterations> <ns per iteration>" on stdout, the runtime writes on stderr as usual.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define bench_use(p) __asm__ volatile("" : : "r"(p) : "memory")
+
+struct bench_point
+{
+	int x;
+	int y;
+};
+
+struct bench_segment
+{
+	struct bench_point from;
+	struct bench_point to;
+	double weight;
+	char label[8];
+};
+
+typedef struct bench_node
+{
+	long value;
+	struct bench_node* next;
+} bench_node;
+
+typedef struct bench_tracked
+{
+	int id;
+	double score;
+} bench_tracked;
+
+__attribute__((tracker))
+void bench_tracked_tracker(bench_tracked tracked)
+{
+	print_int(tracked.id);
+}
+
+static void bench_base(long n)
+{
+	track_var long counter;
+	for (long i = 0; i < n; i++)
+	{
+		counter = i;
+		bench_use(&counter);
+	}
+}
+
+static void bench_nested(long n)
+{
+	track_var struct bench_segment segment;
+	memset(&segment, 0, sizeof(segment));
+	strcpy(segment.label, "edge");
+	for (long i = 0; i < n; i++)
+	{
+		segment.to.x = (int) i;
+		bench_use(&segment);
+	}
+}
+
+static void bench_recursive(long n)
+{
+	track_var bench_node node;
+	node.next = &node;
+	for (long i = 0; i < n; i++)
+	{
+		node.value = i;
+		bench_use(&node);
+	}
+}
+
+static void bench_array(long n)
+{
+	track_var int values[16];
+	memset(values, 0, sizeof(values));
+	for (long i = 0; i < n; i++)
+	{
+		values[i & 15] = (int) i;
+		bench_use(values);
+	}
+}
+
+static void bench_range(long n)
+{
+	int buffer[16] = { 0 };
+	track_range(0, 8) int* window;
+	for (long i = 0; i < n; i++)
+	{
+		window = buffer + (i & 7);
+		bench_use(&window);
+	}
+}
+
+static void bench_tracker(long n)
+{
+	track_var bench_tracked tracked;
+	tracked.score = 0.5;
+	for (long i = 0; i < n; i++)
+	{
+		tracked.id = (int) i;
+		bench_use(&tracked);
+	}
+}
+
+struct bench_shape
+{
+	const char* name;
+	void (*run)(long);
+};
+
+static const struct bench_shape bench_shapes[] = {
+	{ "base", bench_base },
+	{ "nested", bench_nested },
+	{ "recursive", bench_recursive },
+	{ "array", bench_array },
+	{ "range", bench_range },
+	{ "tracker", bench_tracker },
+};
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stdout, "usage: %s <shape> <iterations>\n", argv[0]);
+		return 2;
+	}
+	long n = strtol(argv[2], NULL, 10);
+	for (size_t i = 0; i < sizeof(bench_shapes) / sizeof(bench_shapes[0]); i++)
+	{
+		if (strcmp(argv[1], bench_shapes[i].name) != 0) continue;
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		bench_shapes[i].run(n);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		fprintf(stdout, "%s %ld %.2f\n", argv[1], n, n > 0 ? ns / n : 0.0);
+		return 0;
+	}
+	fprintf(stdout, "unknown shape < %s >\n", argv[1]);
+	return 2;
+}
@@ -0,0 +1,58 @@
+/**
+ *  writes a synthetic translation unit for benchmark_plugin.sh on stdout:
+ *      ./debugger_bench_gen <functions> <statements> <tracked vars> <struct depth>
+ *  every function declares <tracked vars> variables of a record nested <struct depth> times (int at depth 0)
+ *  and has <statements> assignments to them in turn, each of which becomes a site.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void print_path(int depth)
+{
+	for (int level = depth; level > 0; level--) printf(".inner");
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 5)
+	{
+		fprintf(stderr, "usage: %s <functions> <statements> <tracked vars> <struct depth>\n", argv[0]);
+		return 2;
+	}
+	int n_functions = atoi(argv[1]);
+	int n_statements = atoi(argv[2]);
+	int n_vars = atoi(argv[3]) > 0 ? atoi(argv[3]) : 1;
+	int depth = atoi(argv[4]);
+
+	printf("#include \"debugger.h\"\n\n");
+	printf("struct level0\n{\n\tint value;\n\tlong extra;\n\tchar name[8];\n};\n\n");
+	for (int level = 1; level <= depth; level++)
+	{
+		printf("struct level%d\n{\n\tstruct level%d inner;\n\tint count;\n\tstruct level%d* self;\n};\n\n", level, level - 1, level);
+	}
+	for (int f = 0; f < n_functions; f++)
+	{
+		printf("int function%d(int seed)\n{\n", f);
+		for (int v = 0; v < n_vars; v++)
+		{
+			if (depth > 0) printf("\ttrack_var struct level%d var%d;\n", depth, v);
+			else printf("\ttrack_var int var%d;\n", v);
+		}
+		for (int s = 0; s < n_statements; s++)
+		{
+			printf("\tvar%d", s % n_vars);
+			if (depth > 0)
+			{
+				print_path(depth);
+				printf(".value");
+			}
+			printf(" = seed + %d;\n", s);
+		}
+		printf("\treturn seed;\n}\n\n");
+	}
+	printf("int main()\n{\n\tint sum = 0;\n");
+	for (int f = 0; f < n_functions; f++) printf("\tsum += function%d(%d);\n", f, f);
+	printf("\treturn sum == 0;\n}\n");
+	return 0;
+}
@@ -0,0 +1,241 @@
+#ifndef DEBUGGER_CAPTURE_H
+#define DEBUGGER_CAPTURE_H
+
+/**
+ *  this file is included at the end of <debugger.h> after <debugger_snapshot.h>.
+ *
+ *  with -fplugin-arg-<plugin>-capture=raw the plugin calls "debugger_capture" instead of "debugger_snapshot".
+ *  nothing is formatted at runtime: the bytes of every tracked variable are copied as they are into a binary trace,
+ *  along with the schema and the site describing them, and "debugger_decode" turns the trace back into <vars_info>.
+ *  as the memory of the process is gone when the trace is decoded, pointers are recorded but not followed.
+ *
+ *  the trace is written to $DEBUGGER_CAPTURE_FILE, "debugger_capture.trace" by default.
+ *  with $DEBUGGER_TRACE_DIR it is written to indexed segments instead, see <debugger_trace_segment.h>.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "debugger_trace_format.h"
+
+#define DEBUGGER_CAPTURE_BUFFER (1 << 20)
+#define DEBUGGER_CAPTURE_SEEN 4096  // descriptors remembered as written, must be a power of two
+
+static FILE* debugger_capture_file;
+static pthread_once_t debugger_capture_once = PTHREAD_ONCE_INIT;
+static const void* debugger_capture_seen[DEBUGGER_CAPTURE_SEEN];
+
+/**
+ *  returns 1 the first time "key" is met in "table", the table is lock-free as every thread may capture.
+ *  when the table is full the descriptor is written again, the decoder keeps the first one.
+ */
+
+int debugger_capture_first_seen(const void** table, const void* key)
+{
+	unsigned long slot = ((unsigned long) key >> 4) * 0x9E3779B97F4A7C15UL;
+	for (unsigned long i = 0; i < DEBUGGER_CAPTURE_SEEN; i++)
+	{
+		const void** entry = &table[(slot + i) & (DEBUGGER_CAPTURE_SEEN - 1)];
+		const void* seen = __atomic_load_n(entry, __ATOMIC_ACQUIRE);
+		if (seen == key) return 0;
+		if (seen != NULL) continue;
+		if (__atomic_compare_exchange_n(entry, &seen, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return 1;
+		if (seen == key) return 0;
+	}
+	return 1;
+}
+
+static size_t debugger_capture_ops_length(const struct debugger_op* ops, unsigned int n_ops)
+{
+	size_t length = n_ops * sizeof(struct debugger_trace_op);
+	for (unsigned int i = 0; i < n_ops; i++)
+	{
+		if (ops[i].text != NULL) length += strlen(ops[i].text);
+	}
+	return length;
+}
+
+static char* debugger_capture_put(char* out, const void* data, size_t length)
+{
+	memcpy(out, data, length);
+	return out + length;
+}
+
+static char* debugger_capture_put_ops(char* out, const struct debugger_op* ops, unsigned int n_ops)
+{
+	for (unsigned int i = 0; i < n_ops; i++)
+	{
+		struct debugger_trace_op op;
+		memset(&op, 0, sizeof(op));
+		op.code = ops[i].code;
+		op.kind = ops[i].kind;
+		op.jump = ops[i].jump;
+		op.offset = ops[i].offset;
+		op.count = ops[i].count;
+		op.stride = ops[i].stride;
+		op.schema = (uint64_t) (uintptr_t) ops[i].schema;
+		op.text_length = ops[i].text != NULL ? strlen(ops[i].text) : 0;
+		out = debugger_capture_put(out, &op, sizeof(op));
+		out = debugger_capture_put(out, ops[i].text, op.text_length);
+	}
+	return out;
+}
+
+/**
+ *  builds the TRACE_SITE or TRACE_SCHEMA record of "id" in a buffer to be freed by the caller,
+ *  so that a single fwrite or copy keeps it in one piece between threads.
+ */
+
+char* debugger_capture_descriptor(uint32_t tag, const void* id, size_t* total_length)
+{
+	struct debugger_trace_schema schema_head;
+	struct debugger_trace_site site_head;
+	const void* head;
+	size_t head_length;
+	const char* name;
+	const struct debugger_op* ops;
+	unsigned int n_ops;
+	if (tag == TRACE_SCHEMA)
+	{
+		const struct debugger_schema* schema = (const struct debugger_schema*) id;
+		schema_head.size = schema->size;
+		schema_head.n_ops = schema->n_ops;
+		schema_head.name_length = strlen(schema->type_name);
+		head = &schema_head;
+		head_length = sizeof(schema_head);
+		name = schema->type_name;
+		ops = schema->ops;
+		n_ops = schema->n_ops;
+	}
+	else
+	{
+		const struct debugger_site* site = (const struct debugger_site*) id;
+		site_head.line_no = site->line_no;
+		site_head.n_ops = site->n_ops;
+		site_head.file_name_length = strlen(site->file_name);
+		site_head.reserved = 0;
+		head = &site_head;
+		head_length = sizeof(site_head);
+		name = site->file_name;
+		ops = site->ops;
+		n_ops = site->n_ops;
+	}
+	size_t name_length = strlen(name);
+	size_t length = head_length + name_length + debugger_capture_ops_length(ops, n_ops);
+	struct debugger_trace_record record = { tag, (uint32_t) length, (uint64_t) (uintptr_t) id };
+	char* buffer = (char*) malloc(sizeof(record) + length);
+	if (buffer == NULL) return NULL;
+	char* out = debugger_capture_put(buffer, &record, sizeof(record));
+	out = debugger_capture_put(out, head, head_length);
+	out = debugger_capture_put(out, name, name_length);
+	debugger_capture_put_ops(out, ops, n_ops);
+	*total_length = sizeof(record) + length;
+	return buffer;
+}
+
+static void debugger_capture_write_descriptor(uint32_t tag, const void* id)
+{
+	size_t length;
+	char* buffer = debugger_capture_descriptor(tag, id, &length);
+	if (buffer == NULL) return;
+	fwrite(buffer, length, 1, debugger_capture_file);
+	free(buffer);
+}
+
+void debugger_capture_write_site(const struct debugger_site* site)
+{
+	debugger_capture_write_descriptor(TRACE_SITE, site);
+	for (unsigned int i = 0; i < site->n_ops; i++)
+	{
+		const struct debugger_schema* schema = site->ops[i].schema;
+		if (site->ops[i].code == OP_SCHEMA && debugger_capture_first_seen(debugger_capture_seen, schema))
+		{
+			debugger_capture_write_descriptor(TRACE_SCHEMA, schema);
+		}
+	}
+}
+
+static size_t debugger_capture_length(const struct debugger_site* site, unsigned int first_op, unsigned int last_op)
+{
+	size_t length = sizeof(struct debugger_trace_capture);
+	for (unsigned int pc = first_op; pc < last_op; pc++)
+	{
+		if (site->ops[pc].code == OP_SCHEMA) length += site->ops[pc].schema->size;
+	}
+	return length;
+}
+
+static uint64_t debugger_capture_now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t) now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+#include "debugger_trace_segment.h"
+
+/**
+ *  the file is only flushed at exit, as threads still running may capture after the handler.
+ */
+
+void debugger_capture_flush(void)
+{
+	if (debugger_capture_file != NULL) fflush(debugger_capture_file);
+}
+
+void debugger_capture_open(void)
+{
+	if (debugger_segment_open()) return;
+	const char* path = getenv("DEBUGGER_CAPTURE_FILE");
+	FILE* file = fopen(path != NULL ? path : "debugger_capture.trace", "wb");
+	if (file == NULL)
+	{
+		perror("debugger_capture");
+		return;
+	}
+	setvbuf(file, NULL, _IOFBF, DEBUGGER_CAPTURE_BUFFER);
+	struct debugger_trace_header header;
+	memcpy(header.magic, DEBUGGER_TRACE_MAGIC, sizeof(header.magic));
+	header.version = DEBUGGER_TRACE_VERSION;
+	header.pointer_size = sizeof(void*);
+	fwrite(&header, sizeof(header), 1, file);
+	debugger_capture_file = file;
+	atexit(debugger_capture_flush);
+}
+
+/**
+ *  same signature as "debugger_snapshot", the cost of a site is the copy of "sizeof" bytes of each variable.
+ */
+
+__attribute__((debugger_runtime("capture")))
+void debugger_capture(const struct debugger_site* site, const void* const* slots, unsigned int first_op, unsigned int last_op)
+{
+	pthread_once(&debugger_capture_once, debugger_capture_open);
+	if (debugger_segment_directory != NULL)
+	{
+		debugger_segment_capture(site, slots, first_op, last_op);
+		return;
+	}
+	FILE* file = debugger_capture_file;
+	if (file == NULL) return;
+	if (debugger_capture_first_seen(debugger_capture_seen, site)) debugger_capture_write_site(site);
+
+	struct debugger_trace_capture capture = { first_op, last_op, debugger_capture_now_ns() };
+	size_t length = debugger_capture_length(site, first_op, last_op);
+	struct debugger_trace_record record = { TRACE_CAPTURE, (uint32_t) length, (uint64_t) (uintptr_t) site };
+
+	flockfile(file); // keeps the record in one piece, fwrite takes the same recursive lock
+	fwrite(&record, sizeof(record), 1, file);
+	fwrite(&capture, sizeof(capture), 1, file);
+	for (unsigned int pc = first_op; pc < last_op; pc++)
+	{
+		const struct debugger_op* op = &site->ops[pc];
+		if (op->code == OP_SCHEMA) fwrite(slots[op->count], op->schema->size, 1, file);
+	}
+	funlockfile(file);
+	debugger_count_emitted(sizeof(record) + length);
+}
+
+#endif
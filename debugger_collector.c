@@ -0,0 +1,206 @@
+/**
+ *  "debugger_collector" creates the shared-memory ring of <debugger_shm_layout.h> and writes out what the
+ *  instrumented processes started with DEBUGGER_TRANSPORT=shm put into it.
+ *
+ *  usage: debugger_collector [-n name] [-d directory]
+ *      -n  the name of the segment, "/debugger_collector" by default, given to the processes as DEBUGGER_TRANSPORT=shm:<name>
+ *      -d  writes the output of every process to <directory>/<pid>.xml, instead of interleaving everything on stdout
+ *
+ *  the collector runs until SIGINT or SIGTERM, then removes the segment and prints its counters to stderr.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include "debugger_shm_layout.h"
+
+#define COLLECTOR_WAIT_NS 100000000L  // the collector checks for a stop at least this often
+#define COLLECTOR_STUCK_NS 1000000000L // a slot unpublished for this long is skipped, if its producer cannot write it
+#define COLLECTOR_OUTPUTS 256
+
+struct collector_output
+{
+	uint32_t pid;
+	FILE* file;
+};
+
+static volatile sig_atomic_t collector_stopping;
+static struct collector_output outputs[COLLECTOR_OUTPUTS];
+static const char* output_directory;
+
+static void collector_stop(int sig)
+{
+	(void) sig;
+	collector_stopping = 1;
+}
+
+/**
+ *  whether the slot at "tail" can be skipped: it is claimed but not taken, then the producer that claimed it
+ *  finds it skipped, or it is taken by a process that is gone.
+ */
+
+static int collector_skippable(uint64_t sequence, uint64_t tail)
+{
+	if (sequence == tail) return 1;
+	if (sequence != debugger_shm_taken(tail, debugger_shm_taker(sequence))) return 0;
+	return kill((pid_t) debugger_shm_taker(sequence), 0) != 0 && errno == ESRCH;
+}
+
+static long collector_now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ *  the file of a process, opened the first time it is met. the least recently opened one is closed when all are in use.
+ */
+
+static FILE* collector_output_of(uint32_t pid)
+{
+	if (output_directory == NULL) return stdout;
+	static unsigned int next_victim;
+	for (int i = 0; i < COLLECTOR_OUTPUTS; i++)
+	{
+		if (outputs[i].file != NULL && outputs[i].pid == pid) return outputs[i].file;
+	}
+	struct collector_output* output = NULL;
+	for (int i = 0; i < COLLECTOR_OUTPUTS && output == NULL; i++)
+	{
+		if (outputs[i].file == NULL) output = &outputs[i];
+	}
+	if (output == NULL)
+	{
+		output = &outputs[next_victim++ % COLLECTOR_OUTPUTS];
+		fclose(output->file);
+	}
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%u.xml", output_directory, pid);
+	output->pid = pid;
+	output->file = fopen(path, "a");
+	if (output->file == NULL)
+	{
+		perror(path);
+		return stderr;
+	}
+	return output->file;
+}
+
+static void collector_flush(void)
+{
+	fflush(stdout);
+	for (int i = 0; i < COLLECTOR_OUTPUTS; i++)
+	{
+		if (outputs[i].file != NULL) fflush(outputs[i].file);
+	}
+}
+
+static struct debugger_shm_ring* collector_create(const char* name)
+{
+	shm_unlink(name);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 || ftruncate(fd, sizeof(struct debugger_shm_ring)) != 0)
+	{
+		perror(name);
+		return NULL;
+	}
+	void* segment = mmap(NULL, sizeof(struct debugger_shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment == MAP_FAILED)
+	{
+		perror(name);
+		return NULL;
+	}
+	struct debugger_shm_ring* ring = (struct debugger_shm_ring*) segment;
+	ring->n_slots = DEBUGGER_SHM_SLOTS;
+	ring->slot_size = DEBUGGER_SHM_SLOT;
+	for (uint64_t i = 0; i < DEBUGGER_SHM_SLOTS; i++)
+	{
+		ring->slots[i].sequence = i;
+	}
+	__atomic_store_n(&ring->magic, DEBUGGER_SHM_MAGIC, __ATOMIC_RELEASE);
+	return ring;
+}
+
+int main(int argc, char** argv)
+{
+	const char* name = DEBUGGER_SHM_DEFAULT_NAME;
+	int option;
+	while ((option = getopt(argc, argv, "n:d:")) != -1)
+	{
+		if (option == 'n') name = optarg;
+		else if (option == 'd') output_directory = optarg;
+		else
+		{
+			fprintf(stderr, "usage: %s [-n name] [-d directory]\n", argv[0]);
+			return 1;
+		}
+	}
+	struct debugger_shm_ring* ring = collector_create(name);
+	if (ring == NULL) return 1;
+	signal(SIGINT, collector_stop);
+	signal(SIGTERM, collector_stop);
+	fprintf(stderr, "<__COLLECTOR__ name=\"%s\"/>\n", name);
+
+	unsigned long slots = 0, bytes = 0, skipped = 0, wakeups = 0;
+	uint64_t tail = 0;
+	long stuck_since = 0;
+	for (;;)
+	{
+		struct debugger_shm_slot* slot = &ring->slots[tail & (DEBUGGER_SHM_SLOTS - 1)];
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) == tail + 1)
+		{
+			FILE* output = collector_output_of(slot->pid);
+			fwrite(slot->data, 1, slot->length, output);
+			slots++;
+			bytes += slot->length;
+			__atomic_store_n(&slot->sequence, tail + DEBUGGER_SHM_SLOTS, __ATOMIC_RELEASE);
+			__atomic_store_n(&ring->tail, ++tail, __ATOMIC_RELAXED);
+			stuck_since = 0;
+			continue;
+		}
+		collector_flush();
+
+		if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != tail)
+		{
+			// claimed by a producer that has not published it yet, it may have died in between
+			long now = collector_now_ns();
+			uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+			if (stuck_since == 0) stuck_since = now;
+			if (now - stuck_since > COLLECTOR_STUCK_NS && collector_skippable(sequence, tail)
+				&& __atomic_compare_exchange_n(&slot->sequence, &sequence, tail + DEBUGGER_SHM_SLOTS, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			{
+				__atomic_store_n(&ring->tail, ++tail, __ATOMIC_RELAXED);
+				skipped++;
+				stuck_since = 0;
+			}
+			else if (collector_stopping) break;
+			else sched_yield();
+			continue;
+		}
+		if (collector_stopping) break;
+
+		__atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) != tail + 1)
+		{
+			debugger_shm_wait(&ring->sleeping, 1, COLLECTOR_WAIT_NS);
+			wakeups++;
+		}
+		__atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+	}
+
+	collector_flush();
+	shm_unlink(name);
+	fprintf(stderr, "<__COLLECTOR_STATS__ slots=\"%lu\" bytes=\"%lu\" dropped_by_producers=\"%lu\" skipped=\"%lu\" sleeps=\"%lu\"/>\n",
+		slots, bytes, (unsigned long) __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED), skipped, wakeups);
+	return 0;
+}
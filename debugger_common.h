@@ -12,6 +12,7 @@
 #include <limits.h>
 
 #include "tree-iterator.h"
+#include "fold-const.h"
 #include <unordered_set>
 #include "stringpool.h"
 #include "langhooks.h"
@@ -23,6 +24,8 @@
 #include "c-family/c-common.h"
 #include <stdarg.h>
 #include <unordered_map>
+#include <map>
+#include <string>
 #include <vector>
 #include <deque>
 #include <stack>
@@ -55,6 +58,38 @@ tree to_str_cst(const char* str)
     return build_string_literal(strlen(str) + 1, str);
 }
 
+tree build_address_of(tree decl)
+{
+    tree base = get_base_address(decl); // "decl" may be a field or an element of a var, or a dereference
+    if (base != NULL_TREE && DECL_P(base)) TREE_ADDRESSABLE(base) = 1;
+    return build1(ADDR_EXPR, build_pointer_type(TREE_TYPE(decl)), decl);
+}
+
+/**
+ *  a tracked var is a VAR_DECL or a PARM_DECL, or a field or an element of one, e.g. "node.next" or "grid[2].x".
+ */
+
+std::string tracked_name(tree var)
+{
+    char index[32];
+    switch (TREE_CODE(var))
+    {
+        case COMPONENT_REF:
+            return tracked_name(TREE_OPERAND(var, 0)) + "." + IDENTIFIER_POINTER(DECL_NAME(TREE_OPERAND(var, 1)));
+        case ARRAY_REF:
+            sprintf(index, "[%ld]", (long) tree_to_shwi(TREE_OPERAND(var, 1)));
+            return tracked_name(TREE_OPERAND(var, 0)) + index;
+        default:
+            return IDENTIFIER_POINTER(DECL_NAME(var));
+    }
+}
+
+bool is_tracked_var(tree var)
+{
+    tree decl = get_base_address(var);
+    return decl != NULL_TREE && (TREE_CODE(decl) == VAR_DECL || TREE_CODE(decl) == PARM_DECL);
+}
+
 tree build_string_literal_of_source_file_path(const char* source_file_name)
 {
     char cwd[PATH_MAX];
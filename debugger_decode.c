@@ -0,0 +1,111 @@
+/**
+ *  "debugger_decode" turns a trace written by "debugger_capture" (see <debugger_capture.h>) back into <vars_info>.
+ *
+ *  usage: debugger_decode [trace] > output
+ *  the trace defaults to "debugger_capture.trace", and has to be decoded on a machine with the same byte order.
+ *  segment directories written with DEBUGGER_TRACE_DIR are read by "debugger_trace_query" instead.
+ */
+
+#include "debugger_trace_reader.h"
+
+static struct decode_descriptor* descriptors;
+static size_t n_descriptors;
+
+static int compare_descriptors(const void* a, const void* b)
+{
+	const struct decode_descriptor* x = (const struct decode_descriptor*) a;
+	const struct decode_descriptor* y = (const struct decode_descriptor*) b;
+	if (x->tag != y->tag) return x->tag < y->tag ? -1 : 1;
+	if (x->id != y->id) return x->id < y->id ? -1 : 1;
+	return 0;
+}
+
+static const struct decode_descriptor* find_descriptor(uint32_t tag, uint64_t id)
+{
+	struct decode_descriptor key;
+	key.tag = tag;
+	key.id = id;
+	return (const struct decode_descriptor*) bsearch(&key, descriptors, n_descriptors, sizeof(key), compare_descriptors);
+}
+
+static const struct decode_descriptor* find_schema(uint64_t id, void* context)
+{
+	(void) context;
+	return find_descriptor(TRACE_SCHEMA, id);
+}
+
+static char* read_file(const char* path, size_t* length)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return NULL;
+	size_t capacity = 1 << 20;
+	char* data = (char*) malloc(capacity);
+	*length = 0;
+	size_t n;
+	while ((n = fread(data + *length, 1, capacity - *length, file)) > 0)
+	{
+		*length += n;
+		if (*length == capacity) data = (char*) realloc(data, capacity *= 2);
+	}
+	fclose(file);
+	return data;
+}
+
+int main(int argc, char** argv)
+{
+	const char* path = argc > 1 ? argv[1] : "debugger_capture.trace";
+	size_t length;
+	char* data = read_file(path, &length);
+	if (data == NULL)
+	{
+		perror(path);
+		return 1;
+	}
+	const struct debugger_trace_header* header = (const struct debugger_trace_header*) data;
+	if (length < sizeof(*header) || memcmp(header->magic, DEBUGGER_TRACE_MAGIC, sizeof(header->magic)) != 0
+		|| header->version != DEBUGGER_TRACE_VERSION || header->pointer_size != sizeof(void*))
+	{
+		fprintf(stderr, "%s: not a trace of this version and machine.\n", path);
+		return 1;
+	}
+	const char* begin = data + sizeof(*header);
+	const char* end = data + length;
+
+	// the descriptors of a site may follow its first capture when several threads capture at once
+	size_t n_records = 0;
+	for (const char* p = begin; p + sizeof(struct debugger_trace_record) <= end;)
+	{
+		const struct debugger_trace_record* record = (const struct debugger_trace_record*) p;
+		p += sizeof(*record) + record->length;
+		n_records++;
+	}
+	descriptors = (struct decode_descriptor*) calloc(n_records + 1, sizeof(struct decode_descriptor));
+	for (const char* p = begin; p + sizeof(struct debugger_trace_record) <= end;)
+	{
+		const struct debugger_trace_record* record = (const struct debugger_trace_record*) p;
+		const char* payload = p + sizeof(*record);
+		p = payload + record->length;
+		if (p > end) break;
+		if (record->tag != TRACE_SCHEMA && record->tag != TRACE_SITE) continue;
+		if (!read_descriptor(record, payload, p, &descriptors[n_descriptors++]))
+		{
+			fprintf(stderr, "%s: corrupted descriptor.\n", path);
+			return 1;
+		}
+	}
+	qsort(descriptors, n_descriptors, sizeof(struct decode_descriptor), compare_descriptors); // a descriptor written twice is the same
+
+	size_t n_failed = 0;
+	for (const char* p = begin; p + sizeof(struct debugger_trace_record) <= end;)
+	{
+		const struct debugger_trace_record* record = (const struct debugger_trace_record*) p;
+		const char* payload = p + sizeof(*record);
+		p = payload + record->length;
+		if (p > end) break; // the traced process died while writing the record
+		if (record->tag != TRACE_CAPTURE) continue;
+		if (!decode_capture(stdout, find_descriptor(TRACE_SITE, record->id), find_schema, NULL, payload, p)) n_failed++;
+	}
+	if (n_failed > 0) fprintf(stderr, "%s: %zu captures could not be decoded.\n", path, n_failed);
+	free(data);
+	return 0;
+}
@@ -0,0 +1,174 @@
+#ifndef DEBUGGER_DELTA_H
+#define DEBUGGER_DELTA_H
+
+/**
+ *  this file is included at the end of <debugger.h> after <debugger_snapshot.h>.
+ *
+ *  with -fplugin-arg-<plugin>-snapshot=delta the plugin calls "debugger_delta" instead of "debugger_snapshot".
+ *  every thread keeps a shadow copy of the bytes of each variable of each site, and only prints what changed
+ *  since it last went through the site: the fields whose bytes differ from the shadow (see OP_FIELD),
+ *  <__UNCHANGED__/> for a variable whose bytes are all the same, and nothing when no variable of the site changed.
+ *  the first snapshot of a variable is complete. pointees are not compared, only the pointers.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEBUGGER_DELTA_INITIAL 64  // shadows of a thread before its table grows, must be a power of two
+
+struct debugger_shadow
+{
+	const struct debugger_site* site;
+	unsigned int pc;       // of the OP_SCHEMA in the site
+	int fresh;             // nothing has been copied yet
+	char* bytes;
+};
+
+struct debugger_shadow_table
+{
+	unsigned long n_shadows;
+	unsigned long capacity;
+	struct debugger_shadow* shadows;
+};
+
+static __thread struct debugger_shadow_table* debugger_thread_shadows;
+static pthread_once_t debugger_shadow_once = PTHREAD_ONCE_INIT;
+static pthread_key_t debugger_shadow_key;
+
+static void debugger_shadow_free(void* data)
+{
+	struct debugger_shadow_table* table = (struct debugger_shadow_table*) data;
+	for (unsigned long i = 0; i < table->capacity; i++) free(table->shadows[i].bytes);
+	free(table->shadows);
+	free(table);
+}
+
+static void debugger_shadow_init(void)
+{
+	pthread_key_create(&debugger_shadow_key, debugger_shadow_free);
+}
+
+static struct debugger_shadow* debugger_shadow_probe(struct debugger_shadow_table* table, const struct debugger_site* site, unsigned int pc)
+{
+	unsigned long slot = (((unsigned long) site >> 4) + pc) * 0x9E3779B97F4A7C15UL;
+	for (unsigned long i = 0;; i++)
+	{
+		struct debugger_shadow* shadow = &table->shadows[(slot + i) & (table->capacity - 1)];
+		if (shadow->site == NULL || (shadow->site == site && shadow->pc == pc)) return shadow;
+	}
+}
+
+static int debugger_shadow_grow(struct debugger_shadow_table* table)
+{
+	unsigned long capacity = table->capacity == 0 ? DEBUGGER_DELTA_INITIAL : table->capacity * 2;
+	struct debugger_shadow* shadows = (struct debugger_shadow*) calloc(capacity, sizeof(struct debugger_shadow));
+	if (shadows == NULL) return 0;
+	struct debugger_shadow_table grown = { table->n_shadows, capacity, shadows };
+	for (unsigned long i = 0; i < table->capacity; i++)
+	{
+		if (table->shadows[i].site != NULL) *debugger_shadow_probe(&grown, table->shadows[i].site, table->shadows[i].pc) = table->shadows[i];
+	}
+	free(table->shadows);
+	*table = grown;
+	return 1;
+}
+
+/**
+ *  returns the shadow of the variable of the OP_SCHEMA at "pc", NULL if there is no memory for it.
+ */
+
+struct debugger_shadow* debugger_shadow_of(const struct debugger_site* site, unsigned int pc)
+{
+	struct debugger_shadow_table* table = debugger_thread_shadows;
+	if (table == NULL)
+	{
+		pthread_once(&debugger_shadow_once, debugger_shadow_init);
+		table = (struct debugger_shadow_table*) calloc(1, sizeof(struct debugger_shadow_table));
+		if (table == NULL || !debugger_shadow_grow(table))
+		{
+			free(table);
+			return NULL;
+		}
+		pthread_setspecific(debugger_shadow_key, table);
+		debugger_thread_shadows = table;
+	}
+	struct debugger_shadow* shadow = debugger_shadow_probe(table, site, pc);
+	if (shadow->site != NULL) return shadow;
+	if (2 * (table->n_shadows + 1) > table->capacity)
+	{
+		if (!debugger_shadow_grow(table)) return NULL;
+		shadow = debugger_shadow_probe(table, site, pc);
+	}
+	shadow->bytes = (char*) malloc(site->ops[pc].schema->size);
+	if (shadow->bytes == NULL) return NULL;
+	shadow->site = site;
+	shadow->pc = pc;
+	shadow->fresh = 1;
+	table->n_shadows++;
+	return shadow;
+}
+
+/**
+ *  memcmp is the vectorized compare of the libc, a stable variable costs a compare of its size and no formatting.
+ */
+
+static int debugger_delta_changed(const struct debugger_site* site, unsigned int pc, const void* bytes)
+{
+	struct debugger_shadow* shadow = debugger_shadow_of(site, pc);
+	return shadow == NULL || shadow->fresh || memcmp(shadow->bytes, bytes, site->ops[pc].schema->size) != 0;
+}
+
+/**
+ *  same signature as "debugger_snapshot". a site split in several calls by the plugin always prints its markup,
+ *  so that the parts stay balanced.
+ */
+
+__attribute__((debugger_runtime("delta")))
+void debugger_delta(const struct debugger_site* site, const void* const* slots, unsigned int first_op, unsigned int last_op)
+{
+	if (first_op == 0 && last_op == site->n_ops)
+	{
+		int changed = 0;
+		for (unsigned int pc = first_op; pc < last_op && !changed; pc++)
+		{
+			const struct debugger_op* op = &site->ops[pc];
+			if (op->code == OP_SCHEMA) changed = debugger_delta_changed(site, pc, slots[op->count]);
+		}
+		if (!changed) return;
+	}
+	for (unsigned int pc = first_op; pc < last_op; pc++)
+	{
+		const struct debugger_op* op = &site->ops[pc];
+		switch (op->code)
+		{
+			case OP_TEXT:
+				print_string_literal(op->text);
+				break;
+			case OP_CONTEXT:
+				build_debug_context(site->file_name, site->line_no);
+				break;
+			case OP_SCHEMA:
+			{
+				const void* bytes = slots[op->count];
+				struct debugger_shadow* shadow = debugger_shadow_of(site, pc);
+				if (shadow == NULL)
+				{
+					debugger_run_schema(op->schema, bytes);
+					break;
+				}
+				if (!shadow->fresh && memcmp(shadow->bytes, bytes, op->schema->size) == 0)
+				{
+					print_string_literal("<__UNCHANGED__/>\n");
+					break;
+				}
+				debugger_run_schema_against(op->schema, bytes, shadow->fresh ? NULL : shadow->bytes);
+				memcpy(shadow->bytes, bytes, op->schema->size);
+				shadow->fresh = 0;
+				break;
+			}
+		}
+	}
+}
+
+#endif
@@ -1,141 +1,186 @@
 #ifndef DEBUGGER_EXCEPTION_HANDLER_H
 #define DEBUGGER_EXCEPTION_HANDLER_H
 
-// DIRTY fix: ugly
-
-/*
- * Copyright (c) 2000 Apple Computer, Inc. All rights reserved.
+/**
+ *  the segfault guard of the injected code:
  *
- * @APPLE_LICENSE_HEADER_START@
- * 
- * This file contains Original Code and/or Modifications of Original Code
- * as defined in and that are subject to the Apple Public Source License
- * Version 2.0 (the 'License'). You may not use this file except in
- * compliance with the License. Please obtain a copy of the License at
- * http://www.opensource.apple.com/apsl/ and read it before using this
- * file.
- * 
- * The Original Code and all software distributed under the License are
- * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
- * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
- * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
- * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
- * Please see the License for the specific language governing rights and
- * limitations under the License.
- * 
- * @APPLE_LICENSE_HEADER_END@
- */
-#ifndef _BSD_SETJMP_H
-#define _BSD_SETJMP_H
-
-#include <sys/cdefs.h>
-#include <Availability.h>
-
-#if defined(__x86_64__)
-/*
- * _JBLEN is number of ints required to save the following:
- * rflags, rip, rbp, rsp, rbx, r12, r13, r14, r15... these are 8 bytes each
- * mxcsr, fp control word, sigmask... these are 4 bytes each
- * add 16 ints for future expansion needs...
+ *      if (_setjmp(entering_risk()) == 0) { expansion } <break label>
+ *      exiting_risk();
+ *
+ *  the SIGSEGV handler is installed with sigaction when a thread enters its first guarded region, and every thread
+ *  keeps its own stack of jmp_buf in TLS, thus entering and leaving a guarded region only moves the depth of the
+ *  calling thread. a handler the program installs later replaces the guard until the next thread enters a region:
+ *  a fault is then handled by the program, the guard is not reinstalled at every region as it would cost a syscall.
+ *  the handler runs on an alternate stack so that a stack overflow can be reported as well, which is freed
+ *  when the thread exits.
+ *
+ *  _setjmp does not save the signal mask, which is not required as the handler is installed with SA_NODEFER:
+ *  SIGSEGV is never blocked when the handler jumps back.
  */
-#define _JBLEN ((9 * 2) + 3 + 16)
-typedef int jmp_buf[_JBLEN];
-typedef int sigjmp_buf[_JBLEN + 1];
 
-#elif defined(__i386__)
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <pthread.h>
+
+#ifndef DEBUGGER_GUARD_DEPTH
+#define DEBUGGER_GUARD_DEPTH 64  // nested guarded regions per thread, deeper ones are left through the deepest of them
+#endif
+
+#define DEBUGGER_GUARD_STACK (1 << 16)
 
-/*
- * _JBLEN is number of ints required to save the following:
- * eax, ebx, ecx, edx, edi, esi, ebp, esp, ss, eflags, eip,
- * cs, de, es, fs, gs == 16 ints
- * onstack, mask = 2 ints
+/**
+ *  a redeclaration only to mark the setjmp of <setjmp.h> for the plugin.
  */
 
-#define _JBLEN (18)
-typedef int jmp_buf[_JBLEN];
-typedef int sigjmp_buf[_JBLEN + 1];
+__attribute__((debugger_setjmp))
+int _setjmp(jmp_buf);
 
-#elif defined(__arm__) && !defined(__ARM_ARCH_7K__)
+void debugger_report_segfault(void);  // defined in <debugger.h>, once the print functions are
 
-#include <machine/signal.h>
+static __thread jmp_buf debugger_guard_buf[DEBUGGER_GUARD_DEPTH];
+static __thread jmp_buf debugger_guard_overflow_buf; // set by the regions deeper than DEBUGGER_GUARD_DEPTH, never jumped to
+static __thread unsigned int debugger_guard_depth;
+static __thread int debugger_guard_thread_ready;
 
-/*
- *	_JBLEN is number of ints required to save the following:
- *	r4-r8, r10, fp, sp, lr, sig  == 10 register_t sized
- *	s16-s31 == 16 register_t sized + 1 int for FSTMX
- *	1 extra int for future use
- */
-#define _JBLEN		(10 + 16 + 2)
-#define _JBLEN_MAX	_JBLEN
-
-typedef int jmp_buf[_JBLEN];
-typedef int sigjmp_buf[_JBLEN + 1];
-
-#elif defined(__arm64__) || defined(__ARM_ARCH_7K__)
-/*
- * _JBLEN is the number of ints required to save the following:
- * r21-r29, sp, fp, lr == 12 registers, 8 bytes each. d8-d15
- * are another 8 registers, each 8 bytes long. (aapcs64 specifies
- * that only 64-bit versions of FP registers need to be saved).
- * Finally, two 8-byte fields for signal handling purposes.
- */
-#define _JBLEN		((14 + 8 + 2) * 2)
+static pthread_once_t debugger_guard_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t debugger_guard_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t debugger_guard_stack_key;
+static struct sigaction debugger_saved_action;
 
-typedef int jmp_buf[_JBLEN];
-typedef int sigjmp_buf[_JBLEN + 1];
+/**
+ *  leaves the innermost guarded region of the calling thread as if its expansion had segfaulted.
+ *  a region deeper than DEBUGGER_GUARD_DEPTH has no jmp_buf of its own, the deepest region that has one is left
+ *  with all the regions inside it. outside of any guarded region it returns.
+ */
 
-#else
-#	error Undefined platform for setjmp
-#endif
+void debugger_guard_fail(void)
+{
+	unsigned int depth = debugger_guard_depth;
+	if (depth == 0) return;
+	debugger_report_segfault();
+	if (depth > DEBUGGER_GUARD_DEPTH) debugger_guard_depth = depth = DEBUGGER_GUARD_DEPTH;
+	_longjmp(debugger_guard_buf[depth - 1], 1);
+}
 
-__attribute__((debugger_setjmp))
-__BEGIN_DECLS
-extern int	setjmp(jmp_buf);
-extern void longjmp(jmp_buf, int) __dead2;
+/**
+ *  a segfault that the injected code did not raise goes to the action installed before the guard,
+ *  which stays installed. the default action, or an ignored segfault that is a fault, kills the process
+ *  with the signal as if the guard had never been there.
+ */
 
-#ifndef _ANSI_SOURCE
-int	_setjmp(jmp_buf);
-void	_longjmp(jmp_buf, int) __dead2;
-int	sigsetjmp(sigjmp_buf, int);
-void	siglongjmp(sigjmp_buf, int) __dead2;
-#endif /* _ANSI_SOURCE  */
+static void debugger_chain_segfault(int sig, siginfo_t* info, void* ucontext)
+{
+	struct sigaction previous = debugger_saved_action;
+	if (previous.sa_flags & SA_SIGINFO)
+	{
+		if (previous.sa_sigaction != NULL) previous.sa_sigaction(sig, info, ucontext);
+		return;
+	}
+	if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+	{
+		previous.sa_handler(sig);
+		return;
+	}
+	if (previous.sa_handler == SIG_IGN && info != NULL && info->si_code <= 0) return; // sent by kill(), ignored as before
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
 
-#if !defined(_ANSI_SOURCE) && (!defined(_POSIX_C_SOURCE) || defined(_DARWIN_C_SOURCE))
-void	longjmperror(void);
-#endif /* neither ANSI nor POSIX */
-__END_DECLS
+void segf_handler(int sig, siginfo_t* info, void* ucontext)
+{
+	if (debugger_guard_depth == 0)
+	{
+		debugger_chain_segfault(sig, info, ucontext);
+		return;
+	}
+	debugger_guard_fail();
+}
 
-#endif /* _BSD_SETJMP_H */
+/**
+ *  installs the handler, unless it is already installed. the action it replaces is the one chained to.
+ */
 
+void debugger_guard_install(void)
+{
+	pthread_mutex_lock(&debugger_guard_lock);
+	struct sigaction current;
+	if (sigaction(SIGSEGV, NULL, &current) == 0 && !((current.sa_flags & SA_SIGINFO) && current.sa_sigaction == segf_handler))
+	{
+		struct sigaction action;
+		action.sa_sigaction = segf_handler;
+		action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+		sigemptyset(&action.sa_mask);
+		debugger_saved_action = current;
+		sigaction(SIGSEGV, &action, NULL);
+	}
+	pthread_mutex_unlock(&debugger_guard_lock);
+}
 
+/**
+ *  the destructor of the alternate stack of an exiting thread.
+ */
 
-#include <stdio.h>
-// #include <setjmp.h>
-#include <signal.h>
-#include <execinfo.h>
+static void debugger_guard_release_stack(void* stack)
+{
+	stack_t current;
+	if (sigaltstack(NULL, &current) == 0 && current.ss_sp == stack && !(current.ss_flags & SS_DISABLE))
+	{
+		stack_t disabled;
+		disabled.ss_sp = NULL;
+		disabled.ss_size = 0;
+		disabled.ss_flags = SS_DISABLE;
+		sigaltstack(&disabled, NULL);
+	}
+	free(stack);
+}
 
-__attribute__((debugger_jmp_buf))
-jmp_buf pre_seg_fault_jmp_buf;
+static void debugger_guard_init(void)
+{
+	pthread_key_create(&debugger_guard_stack_key, debugger_guard_release_stack);
+}
 
-void (*saved_handler)(int);
+/**
+ *  the alternate stack is set per thread, unless the thread already has one.
+ */
 
-void segf_handler(int sig)
+void debugger_guard_prepare_thread(void)
 {
-	fprintf(stderr, "<__SEGFAULT__/>\n");
-	longjmp(pre_seg_fault_jmp_buf, 1);
+	pthread_once(&debugger_guard_once, debugger_guard_init);
+	debugger_guard_install();
+	stack_t current;
+	if (sigaltstack(NULL, &current) == 0 && (current.ss_flags & SS_DISABLE))
+	{
+		stack_t alternate;
+		alternate.ss_sp = malloc(DEBUGGER_GUARD_STACK);
+		alternate.ss_size = DEBUGGER_GUARD_STACK;
+		alternate.ss_flags = 0;
+		if (alternate.ss_sp != NULL && sigaltstack(&alternate, NULL) == 0)
+		{
+			pthread_setspecific(debugger_guard_stack_key, alternate.ss_sp);
+		}
+		else free(alternate.ss_sp);
+	}
+	debugger_guard_thread_ready = 1;
 }
 
+/**
+ *  returns the jmp_buf to be given to _setjmp by the caller, as it must be set in the frame of the guarded region.
+ */
+
 __attribute__((debugger_entering_risk))
-void entering_risk()
+void* entering_risk()
 {
-	void (*old_handler)(int) = signal(SIGSEGV, segf_handler);
-	if (old_handler != segf_handler) saved_handler = old_handler;
+	if (__builtin_expect(!debugger_guard_thread_ready, 0)) debugger_guard_prepare_thread();
+	unsigned int depth = debugger_guard_depth++;
+	return depth < DEBUGGER_GUARD_DEPTH ? debugger_guard_buf[depth] : debugger_guard_overflow_buf;
 }
 
 __attribute__((debugger_exiting_risk))
 void exiting_risk()
 {
-	signal(SIGSEGV, saved_handler);
+	debugger_guard_depth--;
 }
 
-#endif
\ No newline at end of file
+#endif
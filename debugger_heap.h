@@ -0,0 +1,89 @@
+#ifndef DEBUGGER_HEAP_H
+#define DEBUGGER_HEAP_H
+
+/**
+ *  this file is part of the runtime included by <debugger.h>, after <debugger_address_map.h>.
+ *
+ *  with -fplugin-arg-<plugin>-heap-bounds=on a pointer to scalars is printed as the whole heap block it points to,
+ *  as a "track_range" would, rather than as its first element. the size of the block is asked to the allocator:
+ *  malloc_size on mach-o, which is 0 for a pointer the allocator does not own, and malloc_usable_size on glibc,
+ *  which trusts the chunk header before the pointer, thus is only asked for a chunk that can only be malloc's:
+ *  an in-use chunk of the main arena lying in [heap], or a chunk mapped on its own, which starts a page of an
+ *  anonymous mapping and spans whole pages of it. at most $DEBUGGER_HEAP_CAP bytes are printed (4096 by default,
+ *  0 turns it off). a pointer that is not to the start of such a block is dereferenced once, and so is a block
+ *  of the arenas of other threads, whose mappings cannot be told apart from those of any other allocator.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#ifndef DEBUGGER_HEAP_CAP
+#define DEBUGGER_HEAP_CAP 4096
+#endif
+
+static unsigned long debugger_heap_cap = DEBUGGER_HEAP_CAP;
+
+static void debugger_heap_init(void)
+{
+	const char* cap = getenv("DEBUGGER_HEAP_CAP");
+	if (cap != NULL) debugger_heap_cap = strtoul(cap, NULL, 10);
+}
+
+/**
+ *  the usable size of the heap block starting at "p", 0 if there is none.
+ */
+
+static unsigned long debugger_heap_block_size(const void* p)
+{
+#if defined(__APPLE__)
+	return malloc_size(p);
+#elif defined(__GLIBC__)
+	const size_t alignment = 2 * sizeof(size_t);
+	const size_t mapped = 2, non_main_arena = 4;
+	if (((uintptr_t) p & (alignment - 1)) != 0) return 0;
+	const size_t* chunk = (const size_t*) p - 2; // the size of the previous chunk, then the size of this one
+	if (!debugger_readable(chunk, alignment)) return 0;
+	size_t chunk_size = chunk[1] & ~(size_t) 7;
+	if (chunk_size < 2 * alignment || (chunk_size & (alignment - 1)) != 0 || (chunk[1] & non_main_arena)) return 0;
+	if (chunk[1] & mapped)
+	{
+		uintptr_t page_mask = debugger_page_size - 1;
+		if (((uintptr_t) chunk & page_mask) != 0 || chunk[0] != 0 || (chunk_size & page_mask) != 0) return 0;
+		if (!debugger_in_anonymous_mapping(chunk, chunk_size)) return 0;
+	}
+	else
+	{
+		// the header of the next chunk tells whether this one is in use
+		const size_t* next = (const size_t*) ((const char*) chunk + chunk_size);
+		if (!debugger_in_heap(chunk, chunk_size + alignment) || !(next[1] & 1)) return 0;
+	}
+	return malloc_usable_size((void*) p);
+#else
+	(void) p;
+	return 0;
+#endif
+}
+
+/**
+ *  the number of elements of "element_size" bytes to print from "p", 0 to dereference it once.
+ */
+
+__attribute__((debugger_runtime("heap_items")))
+long debugger_heap_items(const void* p, unsigned long element_size)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, debugger_heap_init);
+	if (p == NULL || element_size == 0 || debugger_heap_cap == 0) return 0;
+	unsigned long size = debugger_heap_block_size(p);
+	if (size > debugger_heap_cap) size = debugger_heap_cap;
+	return size / element_size;
+}
+
+#endif
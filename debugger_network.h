@@ -2,12 +2,21 @@
 #define DEBUGGER_NETWORK_H
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <strings.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 
 typedef struct sockaddr SA;
 
@@ -32,7 +41,15 @@ int open_clientfd(char *hostname, int port)
     return clientfd;
 }
 
+/**
+ *  the plugin defines DEBUGGER_OPTION_PORT from -fplugin-arg-<plugin>-port=<port>, see "define_plugin_options".
+ */
+
+#ifdef DEBUGGER_OPTION_PORT
+int clientfd, port = DEBUGGER_OPTION_PORT;
+#else
 int clientfd, port = 14857;
+#endif
 char host[] = "localhost";
 char debug_buf[1024];
 
@@ -58,4 +75,351 @@ int close_debugger()
     close(clientfd);
 }
 
-#endif
\ No newline at end of file
+/**
+ *  the asynchronous transport, used as the sink of the drain thread of <debugger_ring_buffer.h>.
+ *
+ *  the output is coalesced into frames of DEBUGGER_NET_FRAME bytes. a dedicated sender thread connects in the background,
+ *  writes every sealed frame at once with a gathered write, and reconnects whenever the connection is lost.
+ *  neither the instrumented threads nor the drain thread ever wait for the peer, unless the block policy is chosen.
+ *
+ *      DEBUGGER_TRANSPORT         "tcp" (localhost:port), "tcp://<host>:<port>" or "unix:<path>", unset for stderr
+ *      DEBUGGER_TRANSPORT_POLICY  "drop" (default) discards the output when all the frames are waiting to be sent,
+ *                                 "block" makes the drain thread wait, the rings then fill up instead
+ *      DEBUGGER_NET_LINGER_MS     how long the exit waits for the pending frames, 2000 by default
+ */
+
+#ifndef DEBUGGER_NET_FRAME
+#define DEBUGGER_NET_FRAME (1 << 16)
+#endif
+
+#ifndef DEBUGGER_NET_FRAMES
+#define DEBUGGER_NET_FRAMES 64             // must be a power of two
+#endif
+
+#define DEBUGGER_NET_FLUSH_MS 10           // a partially filled frame is sealed when idle for this long
+#define DEBUGGER_NET_BACKOFF_MIN_MS 50
+#define DEBUGGER_NET_BACKOFF_MAX_MS 2000
+#define DEBUGGER_NET_IOV 16
+
+enum debugger_net_kind
+{
+    NET_NONE, NET_TCP, NET_UNIX
+};
+
+struct debugger_net_frame
+{
+    size_t used;
+    char data[DEBUGGER_NET_FRAME];
+};
+
+/**
+ *  frames in [tail, head) are sealed and owned by the sender thread,
+ *  frames[head] is filled by the sink unless all the frames are sealed.
+ */
+
+struct debugger_net
+{
+    enum debugger_net_kind kind;
+    char host[256];
+    char service[32];
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    int block;
+    long linger_ms;
+
+    int fd;
+    size_t sent;                   // bytes of frames[tail] already sent
+    unsigned long head, tail;
+    int stopping;
+    unsigned long dropped;
+    unsigned long connections;
+    struct debugger_net_frame* frames;
+
+    pthread_t sender;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+};
+
+static struct debugger_net debugger_net;
+
+static long debugger_net_now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void debugger_net_sleep_ms(long ms)
+{
+    struct timespec duration = { ms / 1000, (ms % 1000) * 1000000 };
+    nanosleep(&duration, NULL);
+}
+
+/**
+ *  returns 0 if DEBUGGER_TRANSPORT does not name a network transport.
+ */
+
+int debugger_net_parse(const char* transport)
+{
+    if (transport == NULL || strncmp(transport, "shm", 3) == 0) return 0;
+    if (strncmp(transport, "unix:", 5) == 0)
+    {
+        debugger_net.kind = NET_UNIX;
+        snprintf(debugger_net.path, sizeof(debugger_net.path), "%s", transport + 5);
+        return 1;
+    }
+    if (strcmp(transport, "tcp") == 0)
+    {
+        debugger_net.kind = NET_TCP;
+        snprintf(debugger_net.host, sizeof(debugger_net.host), "%s", host);
+        snprintf(debugger_net.service, sizeof(debugger_net.service), "%d", port);
+        return 1;
+    }
+    if (strncmp(transport, "tcp://", 6) == 0)
+    {
+        const char* address = transport + 6;
+        const char* colon = strrchr(address, ':');
+        if (colon == NULL) return 0;
+        debugger_net.kind = NET_TCP;
+        snprintf(debugger_net.host, sizeof(debugger_net.host), "%.*s", (int) (colon - address), address);
+        snprintf(debugger_net.service, sizeof(debugger_net.service), "%s", colon + 1);
+        return 1;
+    }
+    fprintf(stderr, "<__NET_ERROR__ transport=\"%s\"/>\n", transport);
+    return 0;
+}
+
+/**
+ *  called by the sender thread only, the lookup of the host never happens on the instrumented threads.
+ */
+
+static int debugger_net_connect(void)
+{
+    int fd = -1;
+    if (debugger_net.kind == NET_UNIX)
+    {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, debugger_net.path, sizeof(address.sun_path));
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+        if (connect(fd, (SA*) &address, sizeof(address)) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        struct addrinfo hints, *addresses, *address;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(debugger_net.host, debugger_net.service, &hints, &addresses) != 0) return -1;
+        for (address = addresses; address != NULL; address = address->ai_next)
+        {
+            if ((fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol)) < 0) continue;
+            if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) break;
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(addresses);
+        if (fd < 0) return -1;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    // a bounded send lets the sender notice the end of the linger period when the peer stops reading
+    struct timeval timeout = { 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+/**
+ *  sends the sealed frames [first, last), returns the number of frames completely sent, or -1 if the connection is lost.
+ */
+
+static long debugger_net_send_frames(unsigned long first, unsigned long last)
+{
+    struct iovec iov[DEBUGGER_NET_IOV];
+    int n_iov = 0;
+    for (unsigned long i = first; i < last && n_iov < DEBUGGER_NET_IOV; i++, n_iov++)
+    {
+        struct debugger_net_frame* frame = &debugger_net.frames[i & (DEBUGGER_NET_FRAMES - 1)];
+        size_t skip = i == first ? debugger_net.sent : 0;
+        iov[n_iov].iov_base = frame->data + skip;
+        iov[n_iov].iov_len = frame->used - skip;
+    }
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = n_iov;
+#ifdef MSG_NOSIGNAL
+    ssize_t written = sendmsg(debugger_net.fd, &message, MSG_NOSIGNAL);
+#else
+    ssize_t written = sendmsg(debugger_net.fd, &message, 0);
+#endif
+    if (written < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+
+    long completed = 0;
+    for (int i = 0; i < n_iov; i++)
+    {
+        if ((size_t) written < iov[i].iov_len)
+        {
+            debugger_net.sent += written;
+            break;
+        }
+        written -= iov[i].iov_len;
+        debugger_net.sent = 0;
+        completed++;
+    }
+    return completed;
+}
+
+void* debugger_net_main(void* unused __attribute__((unused)))
+{
+    long backoff_ms = DEBUGGER_NET_BACKOFF_MIN_MS;
+    long deadline_ms = 0;
+    pthread_mutex_lock(&debugger_net.lock);
+    for (;;)
+    {
+        if (debugger_net.stopping && deadline_ms == 0) deadline_ms = debugger_net_now_ms() + debugger_net.linger_ms;
+        if (debugger_net.head == debugger_net.tail)
+        {
+            struct debugger_net_frame* open = &debugger_net.frames[debugger_net.head & (DEBUGGER_NET_FRAMES - 1)];
+            if (debugger_net.stopping)
+            {
+                if (open->used == 0) break;
+                debugger_net.head++;
+                continue;
+            }
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            long wake_us = now.tv_usec + DEBUGGER_NET_FLUSH_MS * 1000;
+            struct timespec wake = { now.tv_sec + wake_us / 1000000, (wake_us % 1000000) * 1000 };
+            pthread_cond_timedwait(&debugger_net.ready, &debugger_net.lock, &wake);
+            // nothing has been sealed for a whole period, the open frame is sent as it is
+            if (debugger_net.head == debugger_net.tail && open->used > 0) debugger_net.head++;
+            continue;
+        }
+        if (deadline_ms != 0 && debugger_net_now_ms() > deadline_ms) break;
+
+        unsigned long first = debugger_net.tail, last = debugger_net.head;
+        pthread_mutex_unlock(&debugger_net.lock);
+
+        long completed = 0;
+        if (debugger_net.fd < 0)
+        {
+            debugger_net.fd = debugger_net_connect();
+            if (debugger_net.fd < 0)
+            {
+                debugger_net_sleep_ms(backoff_ms);
+                if ((backoff_ms *= 2) > DEBUGGER_NET_BACKOFF_MAX_MS) backoff_ms = DEBUGGER_NET_BACKOFF_MAX_MS;
+            }
+            else
+            {
+                backoff_ms = DEBUGGER_NET_BACKOFF_MIN_MS;
+                debugger_net.connections++;
+            }
+        }
+        else if ((completed = debugger_net_send_frames(first, last)) < 0)
+        {
+            close(debugger_net.fd);
+            debugger_net.fd = -1;
+            completed = 0;
+        }
+
+        pthread_mutex_lock(&debugger_net.lock);
+        for (long i = 0; i < completed; i++)
+        {
+            debugger_net.frames[(debugger_net.tail + i) & (DEBUGGER_NET_FRAMES - 1)].used = 0;
+        }
+        debugger_net.tail += completed;
+        if (completed > 0) pthread_cond_signal(&debugger_net.space);
+    }
+    // what could not be sent before the deadline is lost
+    for (unsigned long i = debugger_net.tail; i != debugger_net.head; i++)
+    {
+        debugger_net.dropped += debugger_net.frames[i & (DEBUGGER_NET_FRAMES - 1)].used;
+    }
+    pthread_mutex_unlock(&debugger_net.lock);
+    return NULL;
+}
+
+/**
+ *  the sink of the drain thread, it only copies the batch into the open frame.
+ */
+
+void debugger_net_send(const char* data, size_t len)
+{
+    pthread_mutex_lock(&debugger_net.lock);
+    while (len > 0)
+    {
+        if (debugger_net.head - debugger_net.tail == DEBUGGER_NET_FRAMES)
+        {
+            if (!debugger_net.block || debugger_net.stopping)
+            {
+                debugger_net.dropped += len;
+                break;
+            }
+            pthread_cond_wait(&debugger_net.space, &debugger_net.lock);
+            continue;
+        }
+        struct debugger_net_frame* open = &debugger_net.frames[debugger_net.head & (DEBUGGER_NET_FRAMES - 1)];
+        size_t n = DEBUGGER_NET_FRAME - open->used < len ? DEBUGGER_NET_FRAME - open->used : len;
+        memcpy(open->data + open->used, data, n);
+        open->used += n;
+        data += n;
+        len -= n;
+        if (open->used == DEBUGGER_NET_FRAME)
+        {
+            debugger_net.head++;
+            pthread_cond_signal(&debugger_net.ready);
+        }
+    }
+    pthread_mutex_unlock(&debugger_net.lock);
+}
+
+/**
+ *  returns 1 if DEBUGGER_TRANSPORT selects the network, the sender thread is started but does not connect yet.
+ */
+
+int debugger_net_open(void)
+{
+    if (!debugger_net_parse(getenv("DEBUGGER_TRANSPORT"))) return 0;
+    const char* policy = getenv("DEBUGGER_TRANSPORT_POLICY");
+    debugger_net.block = policy != NULL && strcmp(policy, "block") == 0;
+    const char* linger = getenv("DEBUGGER_NET_LINGER_MS");
+    debugger_net.linger_ms = linger != NULL ? atol(linger) : 2000;
+    debugger_net.fd = -1;
+    debugger_net.frames = (struct debugger_net_frame*) calloc(DEBUGGER_NET_FRAMES, sizeof(struct debugger_net_frame));
+    if (debugger_net.frames == NULL) return 0;
+    pthread_mutex_init(&debugger_net.lock, NULL);
+    pthread_cond_init(&debugger_net.ready, NULL);
+    pthread_cond_init(&debugger_net.space, NULL);
+    if (pthread_create(&debugger_net.sender, NULL, debugger_net_main, NULL) != 0) return 0;
+    return 1;
+}
+
+/**
+ *  called once the drain thread is done, waits at most DEBUGGER_NET_LINGER_MS for the pending frames.
+ */
+
+void debugger_net_close(void)
+{
+    pthread_mutex_lock(&debugger_net.lock);
+    debugger_net.stopping = 1;
+    pthread_cond_broadcast(&debugger_net.ready);
+    pthread_cond_broadcast(&debugger_net.space);
+    pthread_mutex_unlock(&debugger_net.lock);
+    pthread_join(debugger_net.sender, NULL);
+    if (debugger_net.fd >= 0) close(debugger_net.fd);
+    if (debugger_net.dropped > 0 || getenv("DEBUGGER_RING_STATS") != NULL)
+    {
+        fprintf(stderr, "<__NET_STATS__ dropped_bytes=\"%lu\" connections=\"%lu\"/>\n",
+            debugger_net.dropped, debugger_net.connections);
+    }
+}
+
+#endif
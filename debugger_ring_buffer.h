@@ -0,0 +1,405 @@
+#ifndef DEBUGGER_RING_BUFFER_H
+#define DEBUGGER_RING_BUFFER_H
+
+/**
+ *  this file is part of the runtime included by <debugger.h>, it is only used when DEBUGGER_RING_BUFFER is defined.
+ *
+ *  every instrumented thread owns a single-producer ring of fixed-size records.
+ *  the injected print functions only store the raw value into the ring of the calling thread,
+ *  a background drain thread formats the records and writes them out in batches.
+ *  when the drain can not keep up the record is dropped and counted instead of blocking the instrumented thread.
+ *  when the drain thread cannot be started, or cannot allocate its batch, this is reported once and every thread
+ *  drains the rings itself at each commit, under a lock, as a synchronous output would.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "debugger_shared.h"
+#include "debugger_network.h"
+#include "debugger_shm.h"
+
+#ifndef DEBUGGER_RING_CAPACITY
+#define DEBUGGER_RING_CAPACITY (1 << 16)  // records per thread, must be a power of two
+#endif
+
+#ifndef DEBUGGER_RING_MAX_STRING
+#define DEBUGGER_RING_MAX_STRING 4096     // longest non-literal string copied into a ring
+#endif
+
+#ifndef DEBUGGER_DRAIN_BATCH
+#define DEBUGGER_DRAIN_BATCH (1 << 16)    // bytes formatted by the drain thread before each write
+#endif
+
+#define DEBUGGER_DRAIN_IDLE_NS 1000000
+#define DEBUGGER_CACHE_LINE 64
+
+union debugger_value
+{
+	long i;
+	unsigned long u;
+	double d;
+	const void* p;
+};
+
+/**
+ *  "kind" is an enum base_type, "aux" holds the line number of a DEBUG_CONTEXT or the length of a copied string.
+ *  a copied string is followed by (aux + 15) / 16 records holding its raw bytes.
+ */
+
+struct debugger_record
+{
+	unsigned int kind;
+	unsigned int aux;
+	union debugger_value value;
+};
+
+struct debugger_ring
+{
+	// written by the owning thread only
+	unsigned long head;
+	unsigned long cached_tail;
+	unsigned long dropped;
+	unsigned long high_water;
+	char producer_pad[DEBUGGER_CACHE_LINE - 4 * sizeof(unsigned long)];
+
+	// written by the drain thread only
+	unsigned long tail;
+	unsigned long drained;
+	char consumer_pad[DEBUGGER_CACHE_LINE - 2 * sizeof(unsigned long)];
+
+	int owned;
+	struct debugger_ring* next;
+	struct debugger_record records[DEBUGGER_RING_CAPACITY];
+};
+
+struct debugger_ring_stats
+{
+	unsigned long threads;
+	unsigned long records;
+	unsigned long dropped;
+	unsigned long high_water;
+	unsigned long capacity;
+};
+
+/**
+ *  "debugger_drain_sink" receives every formatted batch, it is replaced by the transports.
+ *  "debugger_drain_close" is called once the drain thread has written everything to the sink.
+ */
+
+void debugger_write_stderr(const char* data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t written = write(STDERR_FILENO, data, len);
+		if (written <= 0) return;
+		data += written;
+		len -= written;
+	}
+}
+
+void (*debugger_drain_sink)(const char* data, size_t len) = debugger_write_stderr;
+void (*debugger_drain_close)(void) = NULL;
+
+struct debugger_ring* debugger_rings;
+static __thread struct debugger_ring* debugger_thread_ring;
+
+pthread_once_t debugger_ring_once = PTHREAD_ONCE_INIT;
+pthread_key_t debugger_ring_key;
+pthread_t debugger_drain_thread;
+int debugger_drain_started;
+int debugger_drain_stopping;
+int debugger_drain_synchronous;
+pthread_mutex_t debugger_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void debugger_ring_start(void);
+void debugger_drain_now(void);
+
+/**
+ *  called when a thread emits its first record.
+ *  rings of exited threads are reused once the drain thread has emptied them.
+ */
+
+struct debugger_ring* debugger_ring_attach(void)
+{
+	pthread_once(&debugger_ring_once, debugger_ring_start);
+
+	struct debugger_ring* ring;
+	for (ring = __atomic_load_n(&debugger_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+	{
+		int free_ring = 0;
+		if (ring->head != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) continue;
+		if (__atomic_compare_exchange_n(&ring->owned, &free_ring, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+	}
+
+	if (ring == NULL)
+	{
+		if (posix_memalign((void**) &ring, DEBUGGER_CACHE_LINE, sizeof(struct debugger_ring)) != 0) return NULL;
+		memset(ring, 0, offsetof(struct debugger_ring, records));
+		ring->owned = 1;
+		ring->next = __atomic_load_n(&debugger_rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&debugger_rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+
+	pthread_setspecific(debugger_ring_key, ring);
+	debugger_thread_ring = ring;
+	return ring;
+}
+
+void debugger_ring_detach(void* ring)
+{
+	__atomic_store_n(&((struct debugger_ring*) ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ *  claims "count" consecutive records of the calling thread's ring, returns NULL if the ring is full.
+ *  the records become visible to the drain thread in debugger_ring_commit.
+ */
+
+static inline struct debugger_ring* debugger_ring_reserve(unsigned long count)
+{
+	struct debugger_ring* ring = debugger_thread_ring;
+	if (__builtin_expect(ring == NULL, 0) && (ring = debugger_ring_attach()) == NULL) return NULL;
+
+	unsigned long used = ring->head - ring->cached_tail;
+	if (__builtin_expect(used + count > DEBUGGER_RING_CAPACITY, 0))
+	{
+		ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		used = ring->head - ring->cached_tail;
+		if (used + count > DEBUGGER_RING_CAPACITY)
+		{
+			__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+	}
+	if (used + count > ring->high_water)
+	{
+		__atomic_store_n(&ring->high_water, used + count, __ATOMIC_RELAXED);
+	}
+	return ring;
+}
+
+static inline void debugger_ring_commit(struct debugger_ring* ring, unsigned long count)
+{
+	__atomic_store_n(&ring->head, ring->head + count, __ATOMIC_RELEASE);
+	debugger_count_emitted(count * sizeof(struct debugger_record));
+	if (__builtin_expect(__atomic_load_n(&debugger_drain_synchronous, __ATOMIC_RELAXED), 0)) debugger_drain_now();
+}
+
+static inline void debugger_ring_emit_value(unsigned int kind, unsigned int aux, union debugger_value value)
+{
+	struct debugger_ring* ring = debugger_ring_reserve(1);
+	if (ring == NULL) return;
+	struct debugger_record* record = &ring->records[ring->head & (DEBUGGER_RING_CAPACITY - 1)];
+	record->kind = kind;
+	record->aux = aux;
+	record->value = value;
+	debugger_ring_commit(ring, 1);
+}
+
+static inline void debugger_ring_emit_pointer(unsigned int kind, unsigned int aux, const void* p)
+{
+	union debugger_value value;
+	value.p = p;
+	debugger_ring_emit_value(kind, aux, value);
+}
+
+/**
+ *  strings that are not literals may change or die before the drain thread reaches them, thus they are copied.
+ */
+
+static inline void debugger_ring_emit_chars(const char* v, size_t len)
+{
+	if (len > DEBUGGER_RING_MAX_STRING) len = DEBUGGER_RING_MAX_STRING;
+	unsigned long chunks = (len + sizeof(struct debugger_record) - 1) / sizeof(struct debugger_record);
+
+	struct debugger_ring* ring = debugger_ring_reserve(1 + chunks);
+	if (ring == NULL) return;
+	unsigned long head = ring->head;
+	struct debugger_record* record = &ring->records[head & (DEBUGGER_RING_CAPACITY - 1)];
+	record->kind = CHAR_POINTER;
+	record->aux = len;
+	for (unsigned long i = 0; i < chunks; i++)
+	{
+		size_t offset = i * sizeof(struct debugger_record);
+		size_t piece = len - offset < sizeof(struct debugger_record) ? len - offset : sizeof(struct debugger_record);
+		memcpy(&ring->records[(head + 1 + i) & (DEBUGGER_RING_CAPACITY - 1)], v + offset, piece);
+	}
+	debugger_ring_commit(ring, 1 + chunks);
+}
+
+static inline void debugger_ring_emit_string(const char* v)
+{
+	if (v == NULL) v = "(null)";
+	debugger_ring_emit_chars(v, strnlen(v, DEBUGGER_RING_MAX_STRING));
+}
+
+/**
+ *  formats the record at "tail" into "out", returns the number of records consumed.
+ */
+
+unsigned long debugger_format_record(struct debugger_ring* ring, unsigned long tail, char* out, size_t* len)
+{
+	struct debugger_record* record = &ring->records[tail & (DEBUGGER_RING_CAPACITY - 1)];
+	union debugger_value v = record->value;
+	int n = 0;
+	switch (record->kind)
+	{
+		case SIGNED_CHAR:
+		case UNSIGNED_CHAR:  n = sprintf(out, "%c", (int) v.i); break;
+		case SIGNED_SHORT:   n = sprintf(out, "%hd", (short) v.i); break;
+		case UNSIGNED_SHORT: n = sprintf(out, "%hu", (unsigned short) v.u); break;
+		case SIGNED_INT:     n = sprintf(out, "%d", (int) v.i); break;
+		case UNSIGNED_INT:   n = sprintf(out, "%u", (unsigned int) v.u); break;
+		case SIGNED_LONG:    n = sprintf(out, "%ld", v.i); break;
+		case UNSIGNED_LONG:  n = sprintf(out, "%lu", v.u); break;
+		case REAL_FLOAT:
+		case REAL_DOUBLE:    n = sprintf(out, "%lf", v.d); break;
+		case POINTER:        n = sprintf(out, "%p", v.p); break;
+		case STRING_LITERAL: n = snprintf(out, DEBUGGER_RING_MAX_STRING, "%s", (const char*) v.p); break;
+		case DEBUG_CONTEXT:  n = snprintf(out, DEBUGGER_RING_MAX_STRING, "%s:%u:", (const char*) v.p, record->aux); break;
+		case CHAR_POINTER:
+		{
+			unsigned long chunks = (record->aux + sizeof(struct debugger_record) - 1) / sizeof(struct debugger_record);
+			for (unsigned long i = 0; i < chunks; i++)
+			{
+				memcpy(out + i * sizeof(struct debugger_record),
+					&ring->records[(tail + 1 + i) & (DEBUGGER_RING_CAPACITY - 1)], sizeof(struct debugger_record));
+			}
+			*len = record->aux;
+			return 1 + chunks;
+		}
+	}
+	*len = n < 0 ? 0 : (n >= DEBUGGER_RING_MAX_STRING ? DEBUGGER_RING_MAX_STRING - 1 : n);
+	return 1;
+}
+
+/**
+ *  moves everything committed so far from all rings to the sink, returns the number of records drained.
+ */
+
+unsigned long debugger_drain_once(char* batch)
+{
+	size_t used = 0;
+	unsigned long total = 0;
+	for (struct debugger_ring* ring = __atomic_load_n(&debugger_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+	{
+		unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long tail = ring->tail;
+		while (tail != head)
+		{
+			if (used + DEBUGGER_RING_MAX_STRING + sizeof(struct debugger_record) > DEBUGGER_DRAIN_BATCH)
+			{
+				debugger_drain_sink(batch, used);
+				used = 0;
+			}
+			size_t len;
+			unsigned long consumed = debugger_format_record(ring, tail, batch + used, &len);
+			used += len;
+			tail += consumed;
+			total += consumed;
+		}
+		__atomic_store_n(&ring->drained, ring->drained + (tail - ring->tail), __ATOMIC_RELAXED);
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+	if (used > 0) debugger_drain_sink(batch, used);
+	return total;
+}
+
+/**
+ *  drains the rings from the calling thread, once there is no drain thread.
+ */
+
+void debugger_drain_now(void)
+{
+	static char batch[DEBUGGER_DRAIN_BATCH];
+	pthread_mutex_lock(&debugger_drain_lock);
+	debugger_drain_once(batch);
+	pthread_mutex_unlock(&debugger_drain_lock);
+}
+
+static void debugger_drain_synchronously(const char* reason)
+{
+	fprintf(stderr, "<__RING_ERROR__ reason=\"%s\"/>\n", reason);
+	__atomic_store_n(&debugger_drain_synchronous, 1, __ATOMIC_RELEASE);
+	debugger_drain_now();
+}
+
+void* debugger_drain_main(void* unused __attribute__((unused)))
+{
+	char* batch = (char*) malloc(DEBUGGER_DRAIN_BATCH);
+	if (batch == NULL)
+	{
+		debugger_drain_synchronously("no drain batch");
+		return NULL;
+	}
+	struct timespec idle = { 0, DEBUGGER_DRAIN_IDLE_NS };
+	for (;;)
+	{
+		int stopping = __atomic_load_n(&debugger_drain_stopping, __ATOMIC_ACQUIRE);
+		if (debugger_drain_once(batch) > 0) continue;
+		if (stopping) break;
+		nanosleep(&idle, NULL);
+	}
+	free(batch);
+	return NULL;
+}
+
+void debugger_ring_stats(struct debugger_ring_stats* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->capacity = DEBUGGER_RING_CAPACITY;
+	for (struct debugger_ring* ring = __atomic_load_n(&debugger_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+	{
+		unsigned long high_water = __atomic_load_n(&ring->high_water, __ATOMIC_RELAXED);
+		stats->threads++;
+		stats->records += __atomic_load_n(&ring->drained, __ATOMIC_RELAXED);
+		stats->dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if (high_water > stats->high_water) stats->high_water = high_water;
+	}
+}
+
+/**
+ *  the counters are always reported when records were dropped, otherwise only if DEBUGGER_RING_STATS is set.
+ */
+
+void debugger_ring_report(void)
+{
+	struct debugger_ring_stats stats;
+	debugger_ring_stats(&stats);
+	if (stats.dropped == 0 && getenv("DEBUGGER_RING_STATS") == NULL) return;
+	fprintf(stderr, "<__RING_STATS__ threads=\"%lu\" records=\"%lu\" dropped=\"%lu\" high_water=\"%lu\" capacity=\"%lu\"/>\n",
+		stats.threads, stats.records, stats.dropped, stats.high_water, stats.capacity);
+}
+
+void debugger_ring_shutdown(void)
+{
+	__atomic_store_n(&debugger_drain_stopping, 1, __ATOMIC_RELEASE);
+	if (debugger_drain_started) pthread_join(debugger_drain_thread, NULL);
+	if (__atomic_load_n(&debugger_drain_synchronous, __ATOMIC_ACQUIRE)) debugger_drain_now();
+	if (debugger_drain_close != NULL) debugger_drain_close();
+	debugger_ring_report();
+}
+
+void debugger_ring_start(void)
+{
+	pthread_key_create(&debugger_ring_key, debugger_ring_detach);
+	if (debugger_shm_open())
+	{
+		debugger_drain_sink = debugger_shm_send;
+	}
+	else if (debugger_net_open())
+	{
+		debugger_drain_sink = debugger_net_send;
+		debugger_drain_close = debugger_net_close;
+	}
+	debugger_drain_started = pthread_create(&debugger_drain_thread, NULL, debugger_drain_main, NULL) == 0;
+	if (!debugger_drain_started) debugger_drain_synchronously("no drain thread");
+	atexit(debugger_ring_shutdown);
+}
+
+#endif
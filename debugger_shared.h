@@ -5,6 +5,9 @@
  *  this files includes the declarations that both <debugger.h> and the debugger plugin would include.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #define CHAR_PRECISION    8
 #define SHORT_PRECISION  16
 #define INT_PRECISION    32
@@ -19,7 +22,93 @@ enum base_type
 	POINTER,
 	CHAR_POINTER,
 	DEBUG_CONTEXT,
+	STRING_LITERAL,
 	ERR_BASE_TYPE
 };
 
+/**
+ *  the operations of a snapshot program, which the plugin emits as static data instead of a chain of print calls.
+ *  offsets are relative to the cursor, which starts at the address of the tracked variable.
+ *  "jump" of an operation that opens a block is the index right after its closing operation.
+ */
+
+enum snapshot_op_code
+{
+	OP_TEXT,         // print "text"
+	OP_CONTEXT,      // print the location of the site
+	OP_SCHEMA,       // run "schema" with the cursor at slots["count"], "text" is the name of the variable
+	OP_VALUE,        // print the base type "kind" stored at cursor + offset
+	OP_CHARS,        // print at most "count" chars stored at cursor + offset
+	OP_GUARD,        // a segfault before the matching OP_END_GUARD continues at "jump"
+	OP_END_GUARD,
+	OP_DEREF,        // move the cursor to the pointer stored at cursor + offset, to "count" readable bytes
+	OP_LEAVE,        // move the cursor back to where it was before the matching OP_DEREF
+	OP_LOOP,         // run the block "count" times, the cursor starts at cursor + offset and moves by "stride"
+	OP_END_LOOP,
+	OP_FIELD,        // the block up to "jump" prints the "count" bytes at cursor + offset, see <debugger_delta.h>
+	OP_ITEMS,        // print "count" values of the base type "kind" from cursor + offset, "stride" bytes apart,
+	                 // each in the <item> markup at the padding "jump", see "debugger_print_items"
+	OP_HEAP          // print the heap block the pointer at cursor + offset starts as OP_ITEMS at the padding "count",
+	                 // then continue at "jump", or go on with the dereference if it is not one, see <debugger_heap.h>
+};
+
+/**
+ *  the state of a "debugger_site_switch", see <debugger_site_switch.h>.
+ *  a sampled site asks the runtime whether to run at every pass, according to its sampling policy.
+ */
+
+enum debugger_site_state
+{
+	DEBUGGER_SITE_OFF,
+	DEBUGGER_SITE_ON,
+	DEBUGGER_SITE_SAMPLED
+};
+
+enum debugger_sampling_policy
+{
+	SAMPLE_ALWAYS,       // only the overhead budget applies
+	SAMPLE_EVERY,        // one pass out of "parameter"
+	SAMPLE_PROBABILITY,  // with a probability of "parameter" millionths
+	SAMPLE_RATE          // at most "parameter" passes per second, "burst" at once
+};
+
+/**
+ *  reads "always", "every:<n>", "probability:<p>" or "rate:<per second>[/<burst>]", as given to the plugin and to the runtime.
+ *  returns 0 if the text is none of them.
+ */
+
+static inline int debugger_parse_sampling(const char* text, unsigned int* policy, unsigned long* parameter, unsigned long* burst)
+{
+	*burst = 1;
+	if (strcmp(text, "always") == 0)
+	{
+		*policy = SAMPLE_ALWAYS;
+		*parameter = 0;
+		return 1;
+	}
+	const char* colon = strchr(text, ':');
+	if (colon == NULL) return 0;
+	size_t length = colon - text;
+	char* end;
+	if (length == 5 && strncmp(text, "every", 5) == 0)
+	{
+		*policy = SAMPLE_EVERY;
+		*parameter = strtoul(colon + 1, &end, 10);
+	}
+	else if (length == 11 && strncmp(text, "probability", 11) == 0)
+	{
+		*policy = SAMPLE_PROBABILITY;
+		double probability = strtod(colon + 1, &end);
+		*parameter = probability <= 0 ? 0 : probability >= 1 ? 1000000 : (unsigned long) (probability * 1000000);
+	}
+	else if (length == 4 && strncmp(text, "rate", 4) == 0)
+	{
+		*policy = SAMPLE_RATE;
+		*parameter = strtoul(colon + 1, &end, 10);
+		if (*end == '/') *burst = strtoul(end + 1, &end, 10);
+	}
+	else return 0;
+	return end != colon + 1;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,129 @@
+#ifndef DEBUGGER_SHM_H
+#define DEBUGGER_SHM_H
+
+/**
+ *  the shared-memory transport, used as the sink of the drain thread of <debugger_ring_buffer.h>
+ *  with DEBUGGER_TRANSPORT=shm or shm:<name>. the segment is created by "debugger_collector",
+ *  which has to be started first, see <debugger_shm_layout.h>.
+ *
+ *  with DEBUGGER_TRANSPORT_POLICY=block the drain thread waits for free slots, otherwise the output is dropped and counted.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "debugger_shm_layout.h"
+
+static struct debugger_shm_ring* debugger_shm;
+static int debugger_shm_block;
+static uint32_t debugger_shm_pid;
+
+/**
+ *  claims and takes a slot, returns NULL if the ring is full. a slot skipped by the collector before it could be
+ *  taken is left to it, and another one is claimed.
+ */
+
+static struct debugger_shm_slot* debugger_shm_claim(uint64_t* position)
+{
+	uint64_t pos = __atomic_load_n(&debugger_shm->head, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		struct debugger_shm_slot* slot = &debugger_shm->slots[pos & (DEBUGGER_SHM_SLOTS - 1)];
+		uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		int64_t diff = (int64_t) (sequence - pos);
+		if (sequence & DEBUGGER_SHM_TAKEN)
+		{
+			// taken in this lap, "pos" is behind the head, otherwise the ring is full
+			if ((sequence & 0xffffffffUL) != (pos & 0xffffffffUL)) return NULL;
+			pos = __atomic_load_n(&debugger_shm->head, __ATOMIC_RELAXED);
+		}
+		else if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&debugger_shm->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				uint64_t claimed = pos;
+				if (__atomic_compare_exchange_n(&slot->sequence, &claimed, debugger_shm_taken(pos, debugger_shm_pid), 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				{
+					*position = pos;
+					return slot;
+				}
+				pos = __atomic_load_n(&debugger_shm->head, __ATOMIC_RELAXED);
+			}
+		}
+		else if (diff < 0) return NULL;
+		else pos = __atomic_load_n(&debugger_shm->head, __ATOMIC_RELAXED);
+	}
+}
+
+static void debugger_shm_publish(struct debugger_shm_slot* slot, uint64_t position)
+{
+	__atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&debugger_shm->sleeping, __ATOMIC_RELAXED)
+		&& __atomic_exchange_n(&debugger_shm->sleeping, 0, __ATOMIC_ACQ_REL)) debugger_shm_wake(&debugger_shm->sleeping);
+}
+
+void debugger_shm_send(const char* data, size_t len)
+{
+	while (len > 0)
+	{
+		uint64_t position;
+		struct debugger_shm_slot* slot = debugger_shm_claim(&position);
+		if (slot == NULL)
+		{
+			if (!debugger_shm_block)
+			{
+				__atomic_fetch_add(&debugger_shm->dropped, len, __ATOMIC_RELAXED);
+				return;
+			}
+			struct timespec retry = { 0, 100000 };
+			nanosleep(&retry, NULL);
+			continue;
+		}
+		size_t n = len < sizeof(slot->data) ? len : sizeof(slot->data);
+		memcpy(slot->data, data, n);
+		slot->length = n;
+		slot->pid = debugger_shm_pid;
+		debugger_shm_publish(slot, position);
+		data += n;
+		len -= n;
+	}
+}
+
+/**
+ *  returns 1 if DEBUGGER_TRANSPORT selects the shared memory and the segment of the collector could be mapped.
+ */
+
+int debugger_shm_open(void)
+{
+	const char* transport = getenv("DEBUGGER_TRANSPORT");
+	if (transport == NULL || strncmp(transport, "shm", 3) != 0) return 0;
+	const char* name = transport[3] == ':' ? transport + 4 : DEBUGGER_SHM_DEFAULT_NAME;
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+	{
+		fprintf(stderr, "<__SHM_ERROR__ name=\"%s\" reason=\"no collector\"/>\n", name);
+		return 0;
+	}
+	void* segment = mmap(NULL, sizeof(struct debugger_shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment == MAP_FAILED) return 0;
+	struct debugger_shm_ring* ring = (struct debugger_shm_ring*) segment;
+	if (ring->magic != DEBUGGER_SHM_MAGIC || ring->n_slots != DEBUGGER_SHM_SLOTS || ring->slot_size != DEBUGGER_SHM_SLOT)
+	{
+		fprintf(stderr, "<__SHM_ERROR__ name=\"%s\" reason=\"layout mismatch\"/>\n", name);
+		munmap(segment, sizeof(struct debugger_shm_ring));
+		return 0;
+	}
+	const char* policy = getenv("DEBUGGER_TRANSPORT_POLICY");
+	debugger_shm_block = policy != NULL && strcmp(policy, "block") == 0;
+	debugger_shm_pid = getpid();
+	debugger_shm = ring;
+	return 1;
+}
+
+#endif
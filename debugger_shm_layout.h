@@ -0,0 +1,111 @@
+#ifndef DEBUGGER_SHM_LAYOUT_H
+#define DEBUGGER_SHM_LAYOUT_H
+
+/**
+ *  the layout of the shared-memory segment between the instrumented processes and "debugger_collector".
+ *  it is included by both <debugger_shm.h> and the collector, thus it must stay c-compatible.
+ *
+ *  the segment is a bounded multi-producer ring of slots, each slot holding a piece of the output of one process.
+ *  a producer claims the slot at "head" when its sequence equals the position, takes it by swapping the sequence
+ *  for its "taken" mark, writes it, and publishes it by setting the sequence to position + 1. the collector consumes
+ *  the slot at "tail" and hands it back to the producers by setting its sequence to position + n_slots.
+ *
+ *  the collector skips a slot that stays unpublished for long: one claimed but not taken, by swapping its sequence
+ *  for position + n_slots, then the late producer fails to take it and claims another, or one taken by a process
+ *  that no longer exists. a slot taken by a live producer, however long it is stopped, is waited for.
+ *
+ *  the collector only sleeps on "sleeping" when the ring is empty, and a producer only wakes it up
+ *  when it finds the flag set, so there is no syscall per record while the collector keeps up.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define DEBUGGER_SHM_MAGIC 0x314d48534742444cUL  // "LDBGSHM1"
+#define DEBUGGER_SHM_DEFAULT_NAME "/debugger_collector"
+
+#ifndef DEBUGGER_SHM_SLOT
+#define DEBUGGER_SHM_SLOT 4096
+#endif
+
+#ifndef DEBUGGER_SHM_SLOTS
+#define DEBUGGER_SHM_SLOTS 4096  // must be a power of two
+#endif
+
+#define DEBUGGER_SHM_LINE 64
+#define DEBUGGER_SHM_TAKEN (1UL << 63)
+
+struct debugger_shm_slot
+{
+	uint64_t sequence;
+	uint32_t length;
+	uint32_t pid;
+	char data[DEBUGGER_SHM_SLOT - 16];
+};
+
+struct debugger_shm_ring
+{
+	uint64_t magic;
+	uint32_t n_slots;
+	uint32_t slot_size;
+	char header_pad[DEBUGGER_SHM_LINE - 16];
+
+	uint64_t head;       // next position claimed by a producer
+	char head_pad[DEBUGGER_SHM_LINE - 8];
+
+	uint64_t tail;       // next position read by the collector
+	uint64_t dropped;    // bytes discarded by producers finding the ring full
+	char tail_pad[DEBUGGER_SHM_LINE - 16];
+
+	uint32_t sleeping;   // futex word, 1 while the collector waits for an empty ring to be filled
+	char sleeping_pad[DEBUGGER_SHM_LINE - 4];
+
+	struct debugger_shm_slot slots[DEBUGGER_SHM_SLOTS];
+};
+
+/**
+ *  the sequence of a slot being written by "pid", the low half of the position tells it from the previous lap.
+ */
+
+static inline uint64_t debugger_shm_taken(uint64_t position, uint32_t pid)
+{
+	return DEBUGGER_SHM_TAKEN | (uint64_t) (pid & 0x7fffffff) << 32 | (position & 0xffffffffUL);
+}
+
+static inline uint32_t debugger_shm_taker(uint64_t sequence)
+{
+	return (uint32_t) (sequence >> 32) & 0x7fffffff;
+}
+
+/**
+ *  the futex is shared between processes, thus not FUTEX_PRIVATE. other systems poll instead.
+ */
+
+static inline void debugger_shm_wait(uint32_t* word, uint32_t value, long timeout_ns)
+{
+	struct timespec timeout = { timeout_ns / 1000000000L, timeout_ns % 1000000000L };
+#ifdef __linux__
+	syscall(SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0);
+#else
+	(void) word;
+	(void) value;
+	struct timespec poll = { 0, 1000000 };
+	nanosleep(timeout_ns < 1000000 ? &timeout : &poll, NULL);
+#endif
+}
+
+static inline void debugger_shm_wake(uint32_t* word)
+{
+#ifdef __linux__
+	syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+	(void) word;
+#endif
+}
+
+#endif
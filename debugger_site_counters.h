@@ -0,0 +1,198 @@
+#ifndef DEBUGGER_SITE_COUNTERS_H
+#define DEBUGGER_SITE_COUNTERS_H
+
+/**
+ *  this file is part of the runtime included by <debugger.h>.
+ *
+ *  with -fplugin-arg-<plugin>-counters=on the plugin gives every site a "debugger_site_counters",
+ *  gathered by the linker in the section "debugger_counters", and brackets the injected code of the site with
+ *  "debugger_counters_enter" and "debugger_counters_leave". a site counts
+ *      hits      the passes through the injected code (after the site switch admitted them)
+ *      ticks     the time spent in it, in cycles of the time stamp counter on x86, in nanoseconds elsewhere
+ *      bytes     what the runtime emitted for it: characters printed, ring buffer records, or captured bytes
+ *  at exit the sites are written to $DEBUGGER_COUNTERS (a path, or "-" for stderr) as tab separated lines,
+ *  and the DEBUGGER_COUNTERS_TOP most expensive sites are reported on stderr. $DEBUGGER_COUNTERS_TOP overrides
+ *  the number, 0 turns the report off. "debugger_report_counters" makes the report on demand, as does a datagram
+ *  "#" sent to $DEBUGGER_SITES_CONTROL.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __APPLE__
+#include <mach-o/getsect.h>
+#include <mach-o/ldsyms.h>
+#endif
+
+#define DEBUGGER_COUNTERS_TOP 10
+
+/**
+ *  the plugin initializes "line_no" and "file_name", the counters are added to by every thread.
+ */
+
+struct debugger_site_counters
+{
+	int line_no;
+	const char* file_name;
+	unsigned long hits;
+	unsigned long ticks;
+	unsigned long bytes;
+} __attribute__((aligned(64)));      // the stride of the section, and no false sharing between the sites
+
+static __thread unsigned long debugger_emitted_bytes;
+static __thread unsigned long debugger_counters_entered_ticks;
+static __thread unsigned long debugger_counters_entered_bytes;
+
+#ifndef __APPLE__
+extern struct debugger_site_counters __start_debugger_counters[] __attribute__((weak));
+extern struct debugger_site_counters __stop_debugger_counters[] __attribute__((weak));
+#endif
+
+static struct debugger_site_counters* debugger_site_counters_table(unsigned long* n)
+{
+#ifdef __APPLE__
+	unsigned long size = 0;
+	struct debugger_site_counters* first = (struct debugger_site_counters*) getsectiondata(&_mh_execute_header,
+		"__DATA", "__debugger_counters", &size);
+	*n = first != NULL ? size / sizeof(struct debugger_site_counters) : 0;
+	return first;
+#else
+	*n = __start_debugger_counters != NULL ? __stop_debugger_counters - __start_debugger_counters : 0;
+	return __start_debugger_counters;
+#endif
+}
+
+/**
+ *  called by the output of the runtime for everything it emits.
+ */
+
+static inline void debugger_count_emitted(long n)
+{
+	if (n > 0) debugger_emitted_bytes += n;
+}
+
+/**
+ *  rdtsc is not serializing, a site of a few instructions may be off by a few cycles, which is below its cost anyway.
+ *  clock_gettime of CLOCK_MONOTONIC is served by the vDSO without a system call.
+ */
+
+static inline unsigned long debugger_counters_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long) now.tv_sec * 1000000000UL + now.tv_nsec;
+#endif
+}
+
+/**
+ *  the injected code of a site calls no other site, so one mark per thread is enough.
+ */
+
+__attribute__((debugger_runtime("counters_enter")))
+void debugger_counters_enter(void)
+{
+	debugger_counters_entered_bytes = debugger_emitted_bytes;
+	debugger_counters_entered_ticks = debugger_counters_ticks();
+}
+
+__attribute__((debugger_runtime("counters_leave")))
+void debugger_counters_leave(struct debugger_site_counters* counters)
+{
+	unsigned long ticks = debugger_counters_ticks() - debugger_counters_entered_ticks;
+	__atomic_fetch_add(&counters->hits, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counters->ticks, ticks, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counters->bytes, debugger_emitted_bytes - debugger_counters_entered_bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ *  one line per site with "file line hits ticks bytes", for scripts.
+ */
+
+void debugger_write_counters(FILE* out)
+{
+	unsigned long n;
+	struct debugger_site_counters* sites = debugger_site_counters_table(&n);
+	fprintf(out, "# file\tline\thits\tticks\tbytes\n");
+	for (unsigned long i = 0; i < n; i++)
+	{
+		fprintf(out, "%s\t%d\t%lu\t%lu\t%lu\n", sites[i].file_name, sites[i].line_no,
+			__atomic_load_n(&sites[i].hits, __ATOMIC_RELAXED), __atomic_load_n(&sites[i].ticks, __ATOMIC_RELAXED),
+			__atomic_load_n(&sites[i].bytes, __ATOMIC_RELAXED));
+	}
+}
+
+static int debugger_counters_by_ticks(const void* a, const void* b)
+{
+	unsigned long ticks_a = (*(struct debugger_site_counters* const*) a)->ticks;
+	unsigned long ticks_b = (*(struct debugger_site_counters* const*) b)->ticks;
+	return ticks_a < ticks_b ? 1 : ticks_a > ticks_b ? -1 : 0;
+}
+
+/**
+ *  the "top" sites that took the most ticks, with their share of the ticks of all the sites.
+ */
+
+void debugger_report_counters(FILE* out, unsigned long top)
+{
+	unsigned long n;
+	struct debugger_site_counters* sites = debugger_site_counters_table(&n);
+	if (n == 0) return;
+	struct debugger_site_counters** sorted = (struct debugger_site_counters**) malloc(n * sizeof(*sorted));
+	if (sorted == NULL) return;
+	unsigned long total = 0;
+	for (unsigned long i = 0; i < n; i++)
+	{
+		sorted[i] = &sites[i];
+		total += sites[i].ticks;
+	}
+	qsort(sorted, n, sizeof(*sorted), debugger_counters_by_ticks);
+	if (top > n) top = n;
+	fprintf(out, "<__COUNTERS__ sites=\"%lu\" ticks=\"%lu\">\n", n, total);
+	for (unsigned long i = 0; i < top && sorted[i]->hits > 0; i++)
+	{
+		struct debugger_site_counters* site = sorted[i];
+		fprintf(out, "%5.1f%% %14lu ticks %10lu hits %8lu ticks/hit %12lu bytes  %s:%d\n",
+			total > 0 ? 100.0 * site->ticks / total : 0.0, site->ticks, site->hits,
+			site->ticks / site->hits, site->bytes, site->file_name, site->line_no);
+	}
+	fprintf(out, "</__COUNTERS__>\n");
+	free(sorted);
+}
+
+static void debugger_counters_at_exit(void)
+{
+	const char* path = getenv("DEBUGGER_COUNTERS");
+	if (path != NULL)
+	{
+		FILE* out = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+		if (out == NULL) perror(path);
+		else
+		{
+			debugger_write_counters(out);
+			if (out != stderr) fclose(out);
+		}
+	}
+	const char* top = getenv("DEBUGGER_COUNTERS_TOP");
+	unsigned long n_top = top != NULL ? strtoul(top, NULL, 10) : DEBUGGER_COUNTERS_TOP;
+	if (n_top > 0) debugger_report_counters(stderr, n_top);
+}
+
+/**
+ *  every unit registers the constructor, which is a single COMDAT copy, see <plugin_linkage.h>.
+ */
+
+__attribute__((constructor))
+void debugger_site_counters_init(void)
+{
+	static int started;
+	if (__atomic_exchange_n(&started, 1, __ATOMIC_RELAXED)) return;
+	unsigned long n;
+	debugger_site_counters_table(&n);
+	if (n > 0) atexit(debugger_counters_at_exit);
+}
+
+#endif
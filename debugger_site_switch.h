@@ -0,0 +1,379 @@
+#ifndef DEBUGGER_SITE_SWITCH_H
+#define DEBUGGER_SITE_SWITCH_H
+
+/**
+ *  this file is part of the runtime included by <debugger.h>.
+ *
+ *  the plugin gives every site a "debugger_site_switch" and skips the injected code when it is off,
+ *  which costs a load and a branch predicted not taken. the switches of all the translation units are gathered
+ *  by the linker in the section "debugger_sites", and can be flipped while the process runs:
+ *      $DEBUGGER_SITES            applied at startup
+ *      $DEBUGGER_SITES_CONTROL    the path of a unix datagram socket, each datagram is applied as it arrives
+ *      "debugger_set_sites"       from the program itself
+ *  a specification is a list of "+pattern" or "-pattern" separated by commas, applied in order,
+ *  where a pattern is "*", a file name suffix, or a file name suffix and a line as in "plugin1_test.c:27".
+ *  e.g. DEBUGGER_SITES="-*,+plugin1_test.c:27" keeps a single site. a datagram "?" lists the sites on stderr,
+ *  "#" reports the counters of <debugger_site_counters.h>.
+ *
+ *  a site may also be sampled, then it asks "debugger_site_admit" at every pass. its policy (see <debugger_shared.h>)
+ *  comes from -fplugin-arg-<plugin>-sample=<policy>, from $DEBUGGER_SAMPLING for every site,
+ *  or from a specification as in "+plugin1_test.c:27@every:100".
+ *  with $DEBUGGER_OVERHEAD (or -fplugin-arg-<plugin>-overhead), e.g. 0.05, every site is sampled, and the time spent
+ *  in the sites is measured against the cpu time of the process: every DEBUGGER_SAMPLING_WINDOW_MS
+ *  the share of the passes kept is adjusted to stay under that fraction.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __APPLE__
+#include <mach-o/getsect.h>
+#include <mach-o/ldsyms.h>
+#endif
+
+#define DEBUGGER_SAMPLING_WINDOW_MS 100
+#define DEBUGGER_SAMPLING_KEEP_ALL (1UL << 32)
+#define DEBUGGER_SAMPLING_KEEP_MIN (1UL << 12)
+
+/**
+ *  the plugin initializes the fields up to "burst", the others are the state of the policy.
+ */
+
+struct debugger_site_switch
+{
+	volatile unsigned char enabled;  // enum debugger_site_state
+	unsigned char policy;            // enum debugger_sampling_policy
+	int line_no;
+	const char* file_name;
+	unsigned long parameter;
+	unsigned long burst;
+	unsigned long hits;
+	unsigned long next_ns;           // when the bucket of SAMPLE_RATE is empty again
+} __attribute__((aligned(64)));      // the stride of the section, gcc would otherwise pad large objects to 32 bytes
+
+static double debugger_sampling_budget;                                // 0 without an overhead budget
+static unsigned long debugger_sampling_keep = DEBUGGER_SAMPLING_KEEP_ALL; // passes kept out of 2^32, above the policies
+static unsigned long debugger_sampling_spent_ns;
+static unsigned long debugger_sampling_window_ns;
+static unsigned long debugger_sampling_window_cpu_ns;
+static __thread unsigned long debugger_site_entered_ns;
+static __thread unsigned long debugger_sampling_random;
+
+#ifndef __APPLE__
+extern struct debugger_site_switch __start_debugger_sites[] __attribute__((weak));
+extern struct debugger_site_switch __stop_debugger_sites[] __attribute__((weak));
+#endif
+
+static struct debugger_site_switch* debugger_site_switches(unsigned long* n)
+{
+#ifdef __APPLE__
+	unsigned long size = 0;
+	struct debugger_site_switch* first = (struct debugger_site_switch*) getsectiondata(&_mh_execute_header,
+		"__DATA", "__debugger_sites", &size);
+	*n = first != NULL ? size / sizeof(struct debugger_site_switch) : 0;
+	return first;
+#else
+	*n = __start_debugger_sites != NULL ? __stop_debugger_sites - __start_debugger_sites : 0;
+	return __start_debugger_sites;
+#endif
+}
+
+static unsigned long debugger_clock_ns(clockid_t clock)
+{
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return (unsigned long) now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/**
+ *  32 random bits from a xorshift generator per thread.
+ */
+
+static unsigned long debugger_sampling_next_random(void)
+{
+	unsigned long x = debugger_sampling_random;
+	if (x == 0) x = ((unsigned long) &x ^ debugger_clock_ns(CLOCK_MONOTONIC)) | 1;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	debugger_sampling_random = x;
+	return (x * 0x2545F4914F6CDD1DUL) >> 32;
+}
+
+/**
+ *  turns a site on, sampled if it has a policy or if there is an overhead budget.
+ *  the policy is written before the state, which is what the injected code reads first.
+ */
+
+static void debugger_enable_site(struct debugger_site_switch* site)
+{
+	int sampled = site->policy != SAMPLE_ALWAYS || debugger_sampling_budget > 0;
+	__atomic_store_n(&site->enabled, sampled ? DEBUGGER_SITE_SAMPLED : DEBUGGER_SITE_ON, __ATOMIC_RELEASE);
+}
+
+static void debugger_set_site_policy(struct debugger_site_switch* site, unsigned int policy, unsigned long parameter, unsigned long burst)
+{
+	site->policy = policy;
+	site->parameter = parameter;
+	site->burst = burst;
+	site->hits = 0;
+	site->next_ns = 0;
+}
+
+/**
+ *  the plugin finds the type of the switches through this function.
+ */
+
+__attribute__((debugger_runtime("site_switch")))
+void debugger_set_site(struct debugger_site_switch* site, int enabled)
+{
+	if (enabled) debugger_enable_site(site);
+	else __atomic_store_n(&site->enabled, DEBUGGER_SITE_OFF, __ATOMIC_RELEASE);
+}
+
+static int debugger_site_policy_admits(struct debugger_site_switch* site, unsigned long now_ns)
+{
+	switch (site->policy)
+	{
+		case SAMPLE_EVERY:
+			return site->parameter <= 1 || __atomic_fetch_add(&site->hits, 1, __ATOMIC_RELAXED) % site->parameter == 0;
+		case SAMPLE_PROBABILITY:
+			return debugger_sampling_next_random() < (site->parameter << 32) / 1000000;
+		case SAMPLE_RATE:
+		{
+			// the generic cell rate algorithm, a pass is admitted when the bucket is not ahead of now by more than a burst
+			if (site->parameter == 0) return 0;
+			unsigned long interval = 1000000000UL / site->parameter;
+			unsigned long tolerance = interval * (site->burst > 1 ? site->burst - 1 : 0);
+			unsigned long next = __atomic_load_n(&site->next_ns, __ATOMIC_RELAXED);
+			for (;;)
+			{
+				if (next > now_ns + tolerance) return 0;
+				unsigned long updated = (next > now_ns ? next : now_ns) + interval;
+				if (__atomic_compare_exchange_n(&site->next_ns, &next, updated, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return 1;
+			}
+		}
+		default:
+			return 1;
+	}
+}
+
+/**
+ *  called by the thread closing a window, scales the share of passes kept by budget / overhead, at most doubling it.
+ */
+
+static void debugger_sampling_adjust(void)
+{
+	unsigned long cpu_ns = debugger_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	unsigned long window_cpu_ns = cpu_ns - debugger_sampling_window_cpu_ns;
+	debugger_sampling_window_cpu_ns = cpu_ns;
+	unsigned long spent_ns = __atomic_exchange_n(&debugger_sampling_spent_ns, 0, __ATOMIC_RELAXED);
+	if (window_cpu_ns == 0) return;
+	double overhead = (double) spent_ns / window_cpu_ns;
+	double factor = overhead * 2 > debugger_sampling_budget ? debugger_sampling_budget / overhead : 2;
+	double keep = __atomic_load_n(&debugger_sampling_keep, __ATOMIC_RELAXED) * factor;
+	if (keep > DEBUGGER_SAMPLING_KEEP_ALL) keep = DEBUGGER_SAMPLING_KEEP_ALL;
+	if (keep < DEBUGGER_SAMPLING_KEEP_MIN) keep = DEBUGGER_SAMPLING_KEEP_MIN;
+	__atomic_store_n(&debugger_sampling_keep, (unsigned long) keep, __ATOMIC_RELAXED);
+}
+
+/**
+ *  asked by a site which is not simply on, returns 1 if the injected code has to run this time.
+ */
+
+__attribute__((debugger_runtime("site_admit")))
+int debugger_site_admit(struct debugger_site_switch* site)
+{
+	if (__atomic_load_n(&site->enabled, __ATOMIC_ACQUIRE) == DEBUGGER_SITE_OFF) return 0;
+	unsigned long now_ns = debugger_clock_ns(CLOCK_MONOTONIC);
+	if (!debugger_site_policy_admits(site, now_ns)) return 0;
+	if (debugger_sampling_budget > 0)
+	{
+		unsigned long window_ns = __atomic_load_n(&debugger_sampling_window_ns, __ATOMIC_RELAXED);
+		if (now_ns - window_ns >= DEBUGGER_SAMPLING_WINDOW_MS * 1000000UL
+			&& __atomic_compare_exchange_n(&debugger_sampling_window_ns, &window_ns, now_ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		{
+			debugger_sampling_adjust();
+		}
+		unsigned long keep = __atomic_load_n(&debugger_sampling_keep, __ATOMIC_RELAXED);
+		if (keep < DEBUGGER_SAMPLING_KEEP_ALL && debugger_sampling_next_random() >= keep) return 0;
+		debugger_site_entered_ns = now_ns;
+	}
+	return 1;
+}
+
+/**
+ *  called at the end of the injected code of a site which is not simply on, accounts for the time spent since the admission.
+ */
+
+__attribute__((debugger_runtime("site_done")))
+void debugger_site_done(struct debugger_site_switch* site)
+{
+	(void) site;
+	unsigned long entered_ns = debugger_site_entered_ns;
+	if (entered_ns == 0) return;
+	debugger_site_entered_ns = 0;
+	__atomic_fetch_add(&debugger_sampling_spent_ns, debugger_clock_ns(CLOCK_MONOTONIC) - entered_ns, __ATOMIC_RELAXED);
+}
+
+static int debugger_site_matches(const struct debugger_site_switch* site, const char* pattern, size_t length)
+{
+	if (length == 1 && pattern[0] == '*') return 1;
+	const char* colon = (const char*) memchr(pattern, ':', length);
+	size_t file_length = colon != NULL ? (size_t) (colon - pattern) : length;
+	if (colon != NULL && atoi(colon + 1) != site->line_no) return 0;
+	size_t name_length = strlen(site->file_name);
+	return file_length <= name_length && memcmp(site->file_name + name_length - file_length, pattern, file_length) == 0;
+}
+
+/**
+ *  applies a specification, returns the number of switches it has set.
+ */
+
+int debugger_set_sites(const char* specification)
+{
+	unsigned long n;
+	struct debugger_site_switch* sites = debugger_site_switches(&n);
+	int n_set = 0;
+	while (*specification != '\0')
+	{
+		size_t length = strcspn(specification, ",\n");
+		const char* pattern = specification;
+		const char* next = specification + length;
+		int enabled = 1;
+		if (length > 0 && (*pattern == '+' || *pattern == '-'))
+		{
+			enabled = *pattern == '+';
+			pattern++;
+			length--;
+		}
+		unsigned int policy = SAMPLE_ALWAYS;
+		unsigned long parameter = 0, burst = 0;
+		const char* at = (const char*) memchr(pattern, '@', length);
+		if (at != NULL)
+		{
+			char sampling[64];
+			snprintf(sampling, sizeof(sampling), "%.*s", (int) (next - at - 1), at + 1);
+			if (!debugger_parse_sampling(sampling, &policy, &parameter, &burst)) fprintf(stderr, "<__SITES_ERROR__ sampling=\"%s\"/>\n", sampling);
+			length = at - pattern;
+		}
+		for (unsigned long i = 0; i < n && length > 0; i++)
+		{
+			if (!debugger_site_matches(&sites[i], pattern, length)) continue;
+			if (at != NULL) debugger_set_site_policy(&sites[i], policy, parameter, burst);
+			debugger_set_site(&sites[i], enabled);
+			n_set++;
+		}
+		specification = next;
+		if (*specification != '\0') specification++;
+	}
+	return n_set;
+}
+
+void debugger_list_sites(FILE* out)
+{
+	unsigned long n;
+	struct debugger_site_switch* sites = debugger_site_switches(&n);
+	for (unsigned long i = 0; i < n; i++)
+	{
+		fprintf(out, "<__SITE__ file=\"%s\" line=\"%d\" enabled=\"%d\" policy=\"%d\" parameter=\"%lu\"/>\n",
+			sites[i].file_name, sites[i].line_no, sites[i].enabled, sites[i].policy, sites[i].parameter);
+	}
+	if (debugger_sampling_budget > 0)
+	{
+		fprintf(out, "<__SAMPLING__ budget=\"%f\" kept=\"%f\"/>\n", debugger_sampling_budget,
+			(double) __atomic_load_n(&debugger_sampling_keep, __ATOMIC_RELAXED) / DEBUGGER_SAMPLING_KEEP_ALL);
+	}
+}
+
+static void* debugger_site_control_main(void* arg)
+{
+	int fd = (int) (long) arg;
+	char specification[4096];
+	for (;;)
+	{
+		ssize_t n = recv(fd, specification, sizeof(specification) - 1, 0);
+		if (n < 0) break;
+		specification[n] = '\0';
+		if (strcmp(specification, "?") == 0 || strcmp(specification, "?\n") == 0) debugger_list_sites(stderr);
+		else if (strcmp(specification, "#") == 0 || strcmp(specification, "#\n") == 0) debugger_report_counters(stderr, DEBUGGER_COUNTERS_TOP);
+		else debugger_set_sites(specification);
+	}
+	close(fd);
+	return NULL;
+}
+
+static void debugger_site_control_open(const char* path)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path)) return;
+	strcpy(address.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd < 0) return;
+	unlink(path);
+	pthread_t thread;
+	if (bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0
+		|| pthread_create(&thread, NULL, debugger_site_control_main, (void*) (long) fd) != 0)
+	{
+		perror(path);
+		close(fd);
+		return;
+	}
+	pthread_detach(thread);
+}
+
+#ifdef DEBUGGER_OPTION_OVERHEAD
+#define DEBUGGER_STRINGIFY_OPTION(x) #x
+#define DEBUGGER_OPTION_STRING(x) DEBUGGER_STRINGIFY_OPTION(x)
+#define DEBUGGER_DEFAULT_OVERHEAD DEBUGGER_OPTION_STRING(DEBUGGER_OPTION_OVERHEAD)
+#else
+#define DEBUGGER_DEFAULT_OVERHEAD NULL
+#endif
+
+/**
+ *  runs before main, so that the environment holds from the first site on.
+ *  $DEBUGGER_SAMPLING and the budget apply to every site that is on, $DEBUGGER_SITES comes last to refine them.
+ *  it runs once even though every unit registers it.
+ */
+
+__attribute__((constructor))
+void debugger_site_switch_init(void)
+{
+	static int started;
+	if (__atomic_exchange_n(&started, 1, __ATOMIC_RELAXED)) return;
+	unsigned long n;
+	struct debugger_site_switch* sites = debugger_site_switches(&n);
+	const char* sampling = getenv("DEBUGGER_SAMPLING");
+	unsigned int policy;
+	unsigned long parameter, burst;
+	if (sampling != NULL && !debugger_parse_sampling(sampling, &policy, &parameter, &burst))
+	{
+		fprintf(stderr, "<__SITES_ERROR__ sampling=\"%s\"/>\n", sampling);
+		sampling = NULL;
+	}
+	const char* overhead = getenv("DEBUGGER_OVERHEAD");
+	if (overhead == NULL) overhead = DEBUGGER_DEFAULT_OVERHEAD;
+	if (overhead != NULL) debugger_sampling_budget = atof(overhead);
+	debugger_sampling_window_ns = debugger_clock_ns(CLOCK_MONOTONIC);
+	debugger_sampling_window_cpu_ns = debugger_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	for (unsigned long i = 0; i < n; i++)
+	{
+		if (sites[i].enabled == DEBUGGER_SITE_OFF) continue;
+		if (sampling != NULL) debugger_set_site_policy(&sites[i], policy, parameter, burst);
+		debugger_enable_site(&sites[i]);
+	}
+
+	const char* specification = getenv("DEBUGGER_SITES");
+	if (specification != NULL) debugger_set_sites(specification);
+	const char* control = getenv("DEBUGGER_SITES_CONTROL");
+	if (control != NULL) debugger_site_control_open(control);
+}
+
+#endif
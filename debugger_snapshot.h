@@ -0,0 +1,254 @@
+#ifndef DEBUGGER_SNAPSHOT_H
+#define DEBUGGER_SNAPSHOT_H
+
+/**
+ *  this file is included at the end of <debugger.h> as it prints through the functions defined there.
+ *
+ *  for every site the plugin emits a "debugger_site" holding the markup and the layout of the tracked variables,
+ *  and a single call to "debugger_snapshot" with the addresses of the variables in "slots".
+ *  the layout of a type is described once by a "debugger_schema" shared by all the sites of the translation unit.
+ */
+
+struct debugger_schema;
+
+struct debugger_op
+{
+	unsigned short code;   // enum snapshot_op_code
+	unsigned short kind;   // enum base_type
+	unsigned int jump;
+	long offset;
+	long count;
+	long stride;
+	const char* text;
+	const struct debugger_schema* schema;
+};
+
+struct debugger_schema
+{
+	const char* type_name;
+	unsigned long size;
+	unsigned int n_ops;
+	const struct debugger_op* ops;
+};
+
+struct debugger_site
+{
+	const char* file_name;
+	int line_no;
+	unsigned int n_ops;
+	const struct debugger_op* ops;
+};
+
+#define DEBUGGER_SNAPSHOT_DEPTH 64
+
+/**
+ *  "debugger_frame" is pushed by the operations that open a block.
+ *  "resume" is where a segfault continues for OP_GUARD, and the first operation of the body for OP_LOOP.
+ */
+
+struct debugger_frame
+{
+	unsigned int code;
+	unsigned int resume;
+	const char* cursor;
+	long index;
+};
+
+struct debugger_run
+{
+	const struct debugger_op* ops;
+	unsigned int n_ops;
+	unsigned int pc;
+	unsigned int depth;
+	const char* cursor;
+	const char* base;      // the variable, whose previous bytes are "shadow" in delta mode
+	const char* shadow;
+	unsigned long size;
+	struct debugger_frame frames[DEBUGGER_SNAPSHOT_DEPTH];
+};
+
+void debugger_print_value(unsigned int kind, const void* p)
+{
+	switch (kind)
+	{
+		case SIGNED_CHAR:    print_char(*(const char*) p); break;
+		case UNSIGNED_CHAR:  print_uchar(*(const unsigned char*) p); break;
+		case SIGNED_SHORT:   print_short(*(const short*) p); break;
+		case UNSIGNED_SHORT: print_ushort(*(const unsigned short*) p); break;
+		case SIGNED_INT:     print_int(*(const int*) p); break;
+		case UNSIGNED_INT:   print_uint(*(const unsigned int*) p); break;
+		case SIGNED_LONG:    print_long(*(const long*) p); break;
+		case UNSIGNED_LONG:  print_ulong(*(const unsigned long*) p); break;
+		case REAL_FLOAT:     print_float(*(const float*) p); break;
+		case REAL_DOUBLE:    print_double(*(const double*) p); break;
+		case POINTER:        print_pointer(*(void* const*) p); break;
+		case CHAR_POINTER:   print_char_pointer(*(const char* const*) p); break;
+	}
+}
+
+static int debugger_run_push(struct debugger_run* run, unsigned int code, unsigned int resume)
+{
+	if (run->depth == DEBUGGER_SNAPSHOT_DEPTH) return 0;
+	struct debugger_frame* frame = &run->frames[run->depth++];
+	frame->code = code;
+	frame->resume = resume;
+	frame->cursor = run->cursor;
+	frame->index = 0;
+	return 1;
+}
+
+void debugger_run_ops(struct debugger_run* run)
+{
+	while (run->pc < run->n_ops)
+	{
+		const struct debugger_op* op = &run->ops[run->pc++];
+		switch (op->code)
+		{
+			case OP_TEXT:
+				print_string_literal(op->text);
+				break;
+			case OP_VALUE:
+				debugger_print_value(op->kind, run->cursor + op->offset);
+				break;
+			case OP_CHARS:
+				print_chars(run->cursor + op->offset, op->count);
+				break;
+			case OP_ITEMS:
+				debugger_print_items(op->kind, run->cursor + op->offset, op->count, op->stride, op->jump);
+				break;
+			case OP_HEAP:
+			{
+				const char* block = *(const char* const*) (run->cursor + op->offset);
+				long n = debugger_heap_items(block, op->stride);
+				if (n <= 0) break;
+				debugger_print_items(op->kind, block, n, op->stride, op->count);
+				run->pc = op->jump;
+				break;
+			}
+			case OP_GUARD:
+				if (!debugger_run_push(run, OP_GUARD, op->jump)) run->pc = op->jump;
+				break;
+			case OP_DEREF:
+				if (!debugger_run_push(run, OP_DEREF, op->jump)) run->pc = op->jump;
+				else
+				{
+					run->cursor = *(const char* const*) (run->cursor + op->offset);
+					debugger_check_readable(run->cursor, op->count);
+				}
+				break;
+			case OP_LOOP:
+				if (op->count <= 0 || !debugger_run_push(run, OP_LOOP, run->pc)) run->pc = op->jump;
+				else run->cursor += op->offset;
+				break;
+			case OP_END_LOOP:
+			{
+				struct debugger_frame* frame = &run->frames[run->depth - 1];
+				const struct debugger_op* loop = &run->ops[frame->resume - 1];
+				if (++frame->index < loop->count)
+				{
+					run->cursor = frame->cursor + loop->offset + frame->index * loop->stride;
+					run->pc = frame->resume;
+					break;
+				}
+				run->cursor = frame->cursor;
+				run->depth--;
+				break;
+			}
+			case OP_END_GUARD:
+			case OP_LEAVE:
+				run->cursor = run->frames[--run->depth].cursor;
+				break;
+			case OP_FIELD:
+			{
+				// also skips a pointee lying in the variable itself, as the shadow holds the same bytes
+				long at = run->cursor + op->offset - run->base;
+				if (run->shadow != NULL && op->count > 0 && at >= 0 && at + op->count <= (long) run->size
+					&& memcmp(run->cursor + op->offset, run->shadow + at, op->count) == 0) run->pc = op->jump;
+				break;
+			}
+		}
+	}
+}
+
+/**
+ *  called after a segfault, drops the frames up to the innermost OP_GUARD and continues after it.
+ */
+
+void debugger_run_recover(struct debugger_run* run)
+{
+	while (run->depth > 0)
+	{
+		struct debugger_frame* frame = &run->frames[--run->depth];
+		run->cursor = frame->cursor;
+		if (frame->code == OP_GUARD)
+		{
+			run->pc = frame->resume;
+			return;
+		}
+	}
+	run->pc = run->n_ops;
+}
+
+/**
+ *  the run lives in the frame of the caller: the locals of the frame calling _setjmp that change before the jump
+ *  back are indeterminate after it, "run" does not change and what it points to is not local.
+ */
+
+__attribute__((noinline))
+static void debugger_run_guarded(struct debugger_run* run)
+{
+	if (_setjmp(entering_risk()) != 0) debugger_run_recover(run);
+	debugger_run_ops(run);
+	exiting_risk();
+}
+
+/**
+ *  with a "shadow" the fields whose bytes are the same in the shadow are skipped.
+ */
+
+void debugger_run_schema_against(const struct debugger_schema* schema, const void* base, const char* shadow)
+{
+	struct debugger_run run;
+	run.ops = schema->ops;
+	run.n_ops = schema->n_ops;
+	run.pc = 0;
+	run.depth = 0;
+	run.cursor = (const char*) base;
+	run.base = (const char*) base;
+	run.shadow = shadow;
+	run.size = schema->size;
+	debugger_run_guarded(&run);
+}
+
+void debugger_run_schema(const struct debugger_schema* schema, const void* base)
+{
+	debugger_run_schema_against(schema, base, NULL);
+}
+
+/**
+ *  runs the operations [first_op, last_op) of the site.
+ *  the plugin splits a site into several calls when a variable in the middle has to be expanded inline, e.g. by a tracker.
+ */
+
+__attribute__((debugger_runtime("snapshot")))
+void debugger_snapshot(const struct debugger_site* site, const void* const* slots, unsigned int first_op, unsigned int last_op)
+{
+	for (unsigned int pc = first_op; pc < last_op; pc++)
+	{
+		const struct debugger_op* op = &site->ops[pc];
+		switch (op->code)
+		{
+			case OP_TEXT:
+				print_string_literal(op->text);
+				break;
+			case OP_CONTEXT:
+				build_debug_context(site->file_name, site->line_no);
+				break;
+			case OP_SCHEMA:
+				debugger_run_schema(op->schema, slots[op->count]);
+				break;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef DEBUGGER_TRACE_FORMAT_H
+#define DEBUGGER_TRACE_FORMAT_H
+
+/**
+ *  this file describes the binary trace written by "debugger_capture" and read back by "debugger_decode".
+ *  it is included by both <debugger_capture.h> and the decoder, thus it must stay c-compatible.
+ *
+ *  a trace is a "debugger_trace_header" followed by records, every record starts with a "debugger_trace_record".
+ *  the descriptors of schemas and sites are written once, the first time they are met, and are identified
+ *  by their address in the traced process. the trace is in the byte order of the traced process.
+ *
+ *  with DEBUGGER_TRACE_DIR the same records are written to segments instead, see "debugger_segment_header".
+ */
+
+#include <stdint.h>
+
+#define DEBUGGER_TRACE_MAGIC "DBGTRACE"
+#define DEBUGGER_TRACE_VERSION 2
+
+struct debugger_trace_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t pointer_size;
+};
+
+enum debugger_trace_tag
+{
+	TRACE_SCHEMA = 1,  // a debugger_trace_schema, its name, then its operations
+	TRACE_SITE,        // a debugger_trace_site, its file name, then its operations
+	TRACE_CAPTURE      // a debugger_trace_capture, then the raw bytes of every OP_SCHEMA in [first_op, last_op)
+};
+
+/**
+ *  "length" is the number of bytes following the record header.
+ */
+
+struct debugger_trace_record
+{
+	uint32_t tag;
+	uint32_t length;
+	uint64_t id;
+};
+
+/**
+ *  an operation is followed by "text_length" bytes of text, "schema" is the id of the schema of an OP_SCHEMA.
+ */
+
+struct debugger_trace_op
+{
+	uint16_t code;
+	uint16_t kind;
+	uint32_t jump;
+	int64_t offset;
+	int64_t count;
+	int64_t stride;
+	uint64_t schema;
+	uint32_t text_length;
+	uint32_t reserved;
+};
+
+struct debugger_trace_schema
+{
+	uint64_t size;
+	uint32_t n_ops;
+	uint32_t name_length;
+};
+
+struct debugger_trace_site
+{
+	int32_t line_no;
+	uint32_t n_ops;
+	uint32_t file_name_length;
+	uint32_t reserved;
+};
+
+struct debugger_trace_capture
+{
+	uint32_t first_op;
+	uint32_t last_op;
+	uint64_t time_ns;  // CLOCK_REALTIME
+};
+
+/**
+ *  a segment is a file of a fixed size written through mmap: a "debugger_segment_header", then records as in a trace,
+ *  each one padded to DEBUGGER_SEGMENT_ALIGN bytes, and a segment repeats the descriptors its captures need.
+ *  a segment is sealed when it is full or at exit: the file is cut at "data_end" and followed by the footer,
+ *  made of the table of sites, the table of schemas, and the index of captures sorted by site then time.
+ *  a segment that was never sealed, e.g. after a crash, ends at the first record with a zero tag and has no footer.
+ */
+
+#define DEBUGGER_SEGMENT_MAGIC "DBGSEGM1"
+#define DEBUGGER_SEGMENT_ALIGN 8
+
+struct debugger_segment_header
+{
+	char magic[8];
+	uint32_t version;        // DEBUGGER_TRACE_VERSION
+	uint32_t pointer_size;
+	uint32_t sealed;
+	uint32_t n_sites;
+	uint64_t data_end;       // records are in [sizeof(struct debugger_segment_header), data_end)
+	uint64_t sites_offset;   // n_sites debugger_segment_site sorted by site
+	uint64_t schemas_offset; // n_schemas debugger_segment_schema sorted by schema
+	uint64_t n_schemas;
+	uint64_t index_offset;   // n_captures debugger_segment_entry
+	uint64_t n_captures;
+	uint64_t first_ns;
+	uint64_t last_ns;
+};
+
+struct debugger_segment_entry
+{
+	uint64_t site;
+	uint64_t offset;         // of the TRACE_CAPTURE record
+	uint64_t time_ns;
+};
+
+/**
+ *  the captures of "site" are the index entries [first_entry, first_entry + n_entries).
+ */
+
+struct debugger_segment_site
+{
+	uint64_t site;
+	uint64_t descriptor;     // offset of the TRACE_SITE record
+	uint64_t first_entry;
+	uint64_t n_entries;
+	uint64_t first_ns;
+	uint64_t last_ns;
+};
+
+struct debugger_segment_schema
+{
+	uint64_t schema;
+	uint64_t descriptor;     // offset of the TRACE_SCHEMA record
+};
+
+#endif
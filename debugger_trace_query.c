@@ -0,0 +1,348 @@
+/**
+ *  "debugger_trace_query" reads the segments written with DEBUGGER_TRACE_DIR (see <debugger_trace_segment.h>).
+ *  a segment is mapped, not read, and only the captures selected by its index are decoded.
+ *
+ *  usage: debugger_trace_query [-s file:line] [-v variable] [-t from:to] segment...
+ *      -s  the captures of the sites whose file name ends with "file", at "line" if given
+ *      -v  the value of one variable only, by its name in the source
+ *      -t  the captures made in [from, to], in seconds since the epoch, either bound may be left out
+ *  without -s nor -v, the sites of every segment are listed with their number of captures.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "debugger_trace_reader.h"
+
+struct query_segment
+{
+	const char* path;
+	const char* base;
+	const char* data_end;
+	size_t size;
+	const struct debugger_segment_header* header;
+	const struct debugger_segment_site* sites;
+	size_t n_sites;
+	const struct debugger_segment_schema* schemas;
+	size_t n_schemas;
+	const struct debugger_segment_entry* index;
+	struct decode_descriptor** decoded;  // the schemas, decoded when first needed
+};
+
+static const char* query_file;
+static long query_line = -1;
+static const char* query_variable;
+static uint64_t query_from;
+static uint64_t query_to = UINT64_MAX;
+
+static int compare_entries(const void* a, const void* b)
+{
+	const struct debugger_segment_entry* x = (const struct debugger_segment_entry*) a;
+	const struct debugger_segment_entry* y = (const struct debugger_segment_entry*) b;
+	if (x->site != y->site) return x->site < y->site ? -1 : 1;
+	if (x->time_ns != y->time_ns) return x->time_ns < y->time_ns ? -1 : 1;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static int compare_schemas(const void* a, const void* b)
+{
+	uint64_t x = ((const struct debugger_segment_schema*) a)->schema;
+	uint64_t y = ((const struct debugger_segment_schema*) b)->schema;
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t aligned_record_length(const struct debugger_trace_record* record)
+{
+	uint64_t length = sizeof(*record) + record->length;
+	return (length + DEBUGGER_SEGMENT_ALIGN - 1) & ~(uint64_t) (DEBUGGER_SEGMENT_ALIGN - 1);
+}
+
+/**
+ *  builds in memory the footer a segment left unsealed would have had, by scanning its records.
+ */
+
+static void scan_unsealed(struct query_segment* segment)
+{
+	size_t n_records = 0;
+	const char* p = segment->base + sizeof(struct debugger_segment_header);
+	const char* end = segment->base + segment->size;
+	for (const char* q = p; q + sizeof(struct debugger_trace_record) <= end;)
+	{
+		const struct debugger_trace_record* record = (const struct debugger_trace_record*) q;
+		if (record->tag == 0 || q + aligned_record_length(record) > end) break;
+		q += aligned_record_length(record);
+		n_records++;
+	}
+	struct debugger_segment_entry* index = (struct debugger_segment_entry*) calloc(n_records + 1, sizeof(*index));
+	struct debugger_segment_schema* sites = (struct debugger_segment_schema*) calloc(n_records + 1, sizeof(*sites));
+	struct debugger_segment_schema* schemas = (struct debugger_segment_schema*) calloc(n_records + 1, sizeof(*schemas));
+	size_t n_captures = 0, n_site_descriptors = 0;
+	for (size_t i = 0; i < n_records; i++)
+	{
+		const struct debugger_trace_record* record = (const struct debugger_trace_record*) p;
+		struct debugger_segment_schema descriptor = { record->id, (uint64_t) (p - segment->base) };
+		if (record->tag == TRACE_CAPTURE)
+		{
+			const struct debugger_trace_capture* capture = (const struct debugger_trace_capture*) (record + 1);
+			index[n_captures].site = record->id;
+			index[n_captures].offset = descriptor.descriptor;
+			index[n_captures++].time_ns = capture->time_ns;
+		}
+		else if (record->tag == TRACE_SITE) sites[n_site_descriptors++] = descriptor;
+		else if (record->tag == TRACE_SCHEMA) schemas[segment->n_schemas++] = descriptor;
+		p += aligned_record_length(record);
+	}
+	segment->data_end = p;
+	qsort(index, n_captures, sizeof(*index), compare_entries);
+	qsort(sites, n_site_descriptors, sizeof(*sites), compare_schemas);
+	qsort(schemas, segment->n_schemas, sizeof(*schemas), compare_schemas);
+
+	struct debugger_segment_site* table = (struct debugger_segment_site*) calloc(n_captures + 1, sizeof(*table));
+	for (size_t i = 0; i < n_captures; i++)
+	{
+		if (segment->n_sites > 0 && table[segment->n_sites - 1].site == index[i].site)
+		{
+			table[segment->n_sites - 1].n_entries++;
+			table[segment->n_sites - 1].last_ns = index[i].time_ns;
+			continue;
+		}
+		struct debugger_segment_schema key = { index[i].site, 0 };
+		const struct debugger_segment_schema* found = (const struct debugger_segment_schema*) bsearch(&key, sites,
+			n_site_descriptors, sizeof(key), compare_schemas);
+		struct debugger_segment_site* row = &table[segment->n_sites++];
+		row->site = index[i].site;
+		row->descriptor = found != NULL ? found->descriptor : 0;
+		row->first_entry = i;
+		row->n_entries = 1;
+		row->first_ns = row->last_ns = index[i].time_ns;
+	}
+	free(sites);
+	segment->sites = table;
+	segment->schemas = schemas;
+	segment->index = index;
+}
+
+static int open_segment(const char* path, struct query_segment* segment)
+{
+	memset(segment, 0, sizeof(*segment));
+	segment->path = path;
+	int fd = open(path, O_RDONLY);
+	struct stat status;
+	if (fd < 0 || fstat(fd, &status) != 0)
+	{
+		perror(path);
+		if (fd >= 0) close(fd);
+		return 0;
+	}
+	segment->size = status.st_size;
+	void* base = segment->size > 0 ? mmap(NULL, segment->size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	const struct debugger_segment_header* header = (const struct debugger_segment_header*) base;
+	if (base == MAP_FAILED || segment->size < sizeof(*header) || memcmp(header->magic, DEBUGGER_SEGMENT_MAGIC, sizeof(header->magic)) != 0
+		|| header->version != DEBUGGER_TRACE_VERSION || header->pointer_size != sizeof(void*))
+	{
+		fprintf(stderr, "%s: not a segment of this version and machine.\n", path);
+		if (base != MAP_FAILED) munmap(base, segment->size);
+		return 0;
+	}
+	segment->base = (const char*) base;
+	segment->header = header;
+	if (!header->sealed)
+	{
+		fprintf(stderr, "%s: not sealed, scanning its records.\n", path);
+		scan_unsealed(segment);
+	}
+	else if (header->index_offset + header->n_captures * sizeof(struct debugger_segment_entry) > segment->size)
+	{
+		fprintf(stderr, "%s: truncated footer.\n", path);
+		munmap(base, segment->size);
+		return 0;
+	}
+	else
+	{
+		segment->data_end = segment->base + header->data_end;
+		segment->sites = (const struct debugger_segment_site*) (segment->base + header->sites_offset);
+		segment->n_sites = header->n_sites;
+		segment->schemas = (const struct debugger_segment_schema*) (segment->base + header->schemas_offset);
+		segment->n_schemas = header->n_schemas;
+		segment->index = (const struct debugger_segment_entry*) (segment->base + header->index_offset);
+	}
+	segment->decoded = (struct decode_descriptor**) calloc(segment->n_schemas + 1, sizeof(struct decode_descriptor*));
+	return 1;
+}
+
+/**
+ *  reads the descriptor record at "offset", returns 0 if it is missing or corrupted.
+ */
+
+static int read_segment_descriptor(const struct query_segment* segment, uint64_t offset, struct decode_descriptor* descriptor)
+{
+	const char* p = segment->base + offset;
+	if (offset < sizeof(struct debugger_segment_header) || p + sizeof(struct debugger_trace_record) > segment->data_end) return 0;
+	const struct debugger_trace_record* record = (const struct debugger_trace_record*) p;
+	const char* payload = p + sizeof(*record);
+	if (payload + record->length > segment->data_end) return 0;
+	return read_descriptor(record, payload, payload + record->length, descriptor);
+}
+
+static const struct decode_descriptor* find_schema(uint64_t id, void* context)
+{
+	struct query_segment* segment = (struct query_segment*) context;
+	struct debugger_segment_schema key = { id, 0 };
+	const struct debugger_segment_schema* found = (const struct debugger_segment_schema*) bsearch(&key, segment->schemas,
+		segment->n_schemas, sizeof(key), compare_schemas);
+	if (found == NULL) return NULL;
+	size_t i = found - segment->schemas;
+	if (segment->decoded[i] == NULL)
+	{
+		struct decode_descriptor* schema = (struct decode_descriptor*) calloc(1, sizeof(struct decode_descriptor));
+		if (!read_segment_descriptor(segment, found->descriptor, schema))
+		{
+			free(schema);
+			return NULL;
+		}
+		segment->decoded[i] = schema;
+	}
+	return segment->decoded[i];
+}
+
+static int site_selected(const struct decode_descriptor* site)
+{
+	if (query_line >= 0 && site->line_no != query_line) return 0;
+	if (query_file == NULL) return 1;
+	size_t length = strlen(query_file);
+	return length <= site->name_length && memcmp(site->name + site->name_length - length, query_file, length) == 0;
+}
+
+/**
+ *  prints the variable named "query_variable" alone, the bytes of a capture are those of its OP_SCHEMA in order.
+ */
+
+static int decode_variable(FILE* out, const struct decode_descriptor* site, struct query_segment* segment,
+	const char* p, const char* end)
+{
+	const struct debugger_trace_capture* capture = (const struct debugger_trace_capture*) p;
+	if (p + sizeof(*capture) > end || capture->last_op > site->n_ops) return 0;
+	p += sizeof(*capture);
+	for (uint32_t pc = capture->first_op; pc < capture->last_op; pc++)
+	{
+		const struct debugger_trace_op* op = site->ops[pc].op;
+		if (op->code != OP_SCHEMA) continue;
+		const struct decode_descriptor* schema = find_schema(op->schema, segment);
+		if (schema == NULL || p + schema->size > end) return 0;
+		if (op->text_length == strlen(query_variable) && memcmp(site->ops[pc].text, query_variable, op->text_length) == 0)
+		{
+			fprintf(out, "<vars_info>\n    %.*s:%d:\n    <IDENTIFIER_%s>\n", (int) site->name_length, site->name, site->line_no,
+				query_variable);
+			decode_schema(out, schema, p);
+			fprintf(out, "    </IDENTIFIER_%s>\n</vars_info>\n", query_variable);
+			return 1;
+		}
+		p += schema->size;
+	}
+	return 1;
+}
+
+static void list_site(const struct query_segment* segment, const struct debugger_segment_site* row,
+	const struct decode_descriptor* site)
+{
+	printf("%s: %.*s:%d captures=%lu from=%.6f to=%.6f\n", segment->path, (int) site->name_length, site->name, site->line_no,
+		(unsigned long) row->n_entries, row->first_ns / 1e9, row->last_ns / 1e9);
+}
+
+/**
+ *  the entries of a site are sorted by time, thus the first one in range is found by a binary search.
+ */
+
+static size_t query_site(struct query_segment* segment, const struct debugger_segment_site* row, const struct decode_descriptor* site)
+{
+	size_t low = row->first_entry, high = row->first_entry + row->n_entries;
+	while (low < high)
+	{
+		size_t middle = (low + high) / 2;
+		if (segment->index[middle].time_ns < query_from) low = middle + 1;
+		else high = middle;
+	}
+	size_t n_failed = 0;
+	for (size_t i = low; i < row->first_entry + row->n_entries && segment->index[i].time_ns <= query_to; i++)
+	{
+		const char* p = segment->base + segment->index[i].offset;
+		const struct debugger_trace_record* record = (const struct debugger_trace_record*) p;
+		const char* payload = p + sizeof(*record);
+		const char* end = payload + record->length;
+		if (end > segment->data_end) n_failed++;
+		else if (query_variable != NULL) n_failed += !decode_variable(stdout, site, segment, payload, end);
+		else n_failed += !decode_capture(stdout, site, find_schema, segment, payload, end);
+	}
+	return n_failed;
+}
+
+static void run_query(struct query_segment* segment)
+{
+	if (segment->header->sealed && segment->header->n_captures > 0
+		&& (segment->header->last_ns < query_from || segment->header->first_ns > query_to)) return;
+	size_t n_failed = 0;
+	for (size_t i = 0; i < segment->n_sites; i++)
+	{
+		const struct debugger_segment_site* row = &segment->sites[i];
+		if (row->last_ns < query_from || row->first_ns > query_to) continue;
+		struct decode_descriptor site;
+		if (!read_segment_descriptor(segment, row->descriptor, &site))
+		{
+			n_failed += row->n_entries;
+			continue;
+		}
+		if (query_file == NULL && query_line < 0 && query_variable == NULL) list_site(segment, row, &site);
+		else if (site_selected(&site)) n_failed += query_site(segment, row, &site);
+		free(site.ops);
+	}
+	if (n_failed > 0) fprintf(stderr, "%s: %zu captures could not be decoded.\n", segment->path, n_failed);
+}
+
+static uint64_t parse_seconds(const char* text, uint64_t otherwise)
+{
+	if (*text == '\0' || *text == ':') return otherwise;
+	return (uint64_t) (strtod(text, NULL) * 1e9);
+}
+
+int main(int argc, char** argv)
+{
+	int option;
+	while ((option = getopt(argc, argv, "s:v:t:")) != -1)
+	{
+		if (option == 's')
+		{
+			char* colon = strrchr(optarg, ':');
+			if (colon != NULL)
+			{
+				*colon = '\0';
+				query_line = atol(colon + 1);
+			}
+			query_file = *optarg != '\0' ? optarg : NULL;
+		}
+		else if (option == 'v') query_variable = optarg;
+		else if (option == 't')
+		{
+			const char* colon = strchr(optarg, ':');
+			query_from = parse_seconds(optarg, 0);
+			query_to = colon != NULL ? parse_seconds(colon + 1, UINT64_MAX) : UINT64_MAX;
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [-s file:line] [-v variable] [-t from:to] segment...\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind == argc)
+	{
+		fprintf(stderr, "usage: %s [-s file:line] [-v variable] [-t from:to] segment...\n", argv[0]);
+		return 1;
+	}
+	for (int i = optind; i < argc; i++)
+	{
+		struct query_segment segment;
+		if (open_segment(argv[i], &segment)) run_query(&segment);
+	}
+	return 0;
+}
@@ -0,0 +1,241 @@
+#ifndef DEBUGGER_TRACE_READER_H
+#define DEBUGGER_TRACE_READER_H
+
+/**
+ *  the decoding shared by "debugger_decode" and "debugger_trace_query", not a part of the runtime.
+ *
+ *  the operations are replayed against the captured bytes the same way "debugger_snapshot" replays them against memory,
+ *  except that a dereference can not be followed and is printed as <__NOT_CAPTURED__/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debugger_shared.h"
+#include "debugger_trace_format.h"
+
+#define DECODE_DEPTH 64
+
+struct decode_op
+{
+	const struct debugger_trace_op* op;
+	const char* text;
+};
+
+struct decode_descriptor
+{
+	uint64_t id;
+	uint32_t tag;
+	const char* name;
+	uint32_t name_length;
+	uint64_t size;     // size of a schema
+	int32_t line_no;   // line of a site
+	uint32_t n_ops;
+	struct decode_op* ops;
+};
+
+static int read_ops(const char* p, const char* end, struct decode_descriptor* descriptor)
+{
+	descriptor->ops = (struct decode_op*) calloc(descriptor->n_ops + 1, sizeof(struct decode_op));
+	for (uint32_t i = 0; i < descriptor->n_ops; i++)
+	{
+		if (p + sizeof(struct debugger_trace_op) > end) return 0;
+		const struct debugger_trace_op* op = (const struct debugger_trace_op*) p;
+		p += sizeof(struct debugger_trace_op);
+		if (p + op->text_length > end) return 0;
+		descriptor->ops[i].op = op;
+		descriptor->ops[i].text = p;
+		p += op->text_length;
+	}
+	return 1;
+}
+
+/**
+ *  fills "descriptor" from a TRACE_SCHEMA or TRACE_SITE record, the operations point into the trace.
+ */
+
+static int read_descriptor(const struct debugger_trace_record* record, const char* p, const char* end, struct decode_descriptor* out)
+{
+	struct decode_descriptor descriptor;
+	memset(&descriptor, 0, sizeof(descriptor));
+	descriptor.id = record->id;
+	descriptor.tag = record->tag;
+	if (record->tag == TRACE_SCHEMA)
+	{
+		const struct debugger_trace_schema* schema = (const struct debugger_trace_schema*) p;
+		if (p + sizeof(*schema) > end) return 0;
+		descriptor.size = schema->size;
+		descriptor.n_ops = schema->n_ops;
+		descriptor.name_length = schema->name_length;
+		p += sizeof(*schema);
+	}
+	else
+	{
+		const struct debugger_trace_site* site = (const struct debugger_trace_site*) p;
+		if (p + sizeof(*site) > end) return 0;
+		descriptor.line_no = site->line_no;
+		descriptor.n_ops = site->n_ops;
+		descriptor.name_length = site->file_name_length;
+		p += sizeof(*site);
+	}
+	if (p + descriptor.name_length > end) return 0;
+	descriptor.name = p;
+	if (!read_ops(p + descriptor.name_length, end, &descriptor)) return 0;
+	*out = descriptor;
+	return 1;
+}
+
+/**
+ *  prints the value of "kind" stored at "p", in the formats of the print functions of <debugger.h>.
+ */
+
+static void print_value(FILE* out, unsigned int kind, const char* p)
+{
+	switch (kind)
+	{
+		case SIGNED_CHAR:    { char v; memcpy(&v, p, sizeof(v)); fprintf(out, "%c", v); break; }
+		case UNSIGNED_CHAR:  { unsigned char v; memcpy(&v, p, sizeof(v)); fprintf(out, "%c", v); break; }
+		case SIGNED_SHORT:   { short v; memcpy(&v, p, sizeof(v)); fprintf(out, "%hd", v); break; }
+		case UNSIGNED_SHORT: { unsigned short v; memcpy(&v, p, sizeof(v)); fprintf(out, "%hu", v); break; }
+		case SIGNED_INT:     { int v; memcpy(&v, p, sizeof(v)); fprintf(out, "%d", v); break; }
+		case UNSIGNED_INT:   { unsigned int v; memcpy(&v, p, sizeof(v)); fprintf(out, "%u", v); break; }
+		case SIGNED_LONG:    { long v; memcpy(&v, p, sizeof(v)); fprintf(out, "%ld", v); break; }
+		case UNSIGNED_LONG:  { unsigned long v; memcpy(&v, p, sizeof(v)); fprintf(out, "%lu", v); break; }
+		case REAL_FLOAT:     { float v; memcpy(&v, p, sizeof(v)); fprintf(out, "%f", v); break; }
+		case REAL_DOUBLE:    { double v; memcpy(&v, p, sizeof(v)); fprintf(out, "%lf", v); break; }
+		case POINTER:
+		case CHAR_POINTER:   { void* v; memcpy(&v, p, sizeof(v)); fprintf(out, "%p", v); break; }
+	}
+}
+
+static long value_size(unsigned int kind)
+{
+	switch (kind)
+	{
+		case SIGNED_CHAR:
+		case UNSIGNED_CHAR:  return sizeof(char);
+		case SIGNED_SHORT:
+		case UNSIGNED_SHORT: return sizeof(short);
+		case SIGNED_INT:
+		case UNSIGNED_INT:   return sizeof(int);
+		case SIGNED_LONG:
+		case UNSIGNED_LONG:  return sizeof(long);
+		case REAL_FLOAT:     return sizeof(float);
+		case REAL_DOUBLE:    return sizeof(double);
+		default:             return sizeof(void*);
+	}
+}
+
+/**
+ *  the counterpart of "debugger_run_ops" over the captured bytes of a single variable.
+ */
+
+static void decode_schema(FILE* out, const struct decode_descriptor* schema, const char* bytes)
+{
+	struct { uint32_t resume; long base; long index; } frames[DECODE_DEPTH];
+	uint32_t depth = 0;
+	long cursor = 0;
+	uint32_t pc = 0;
+	while (pc < schema->n_ops)
+	{
+		const struct debugger_trace_op* op = schema->ops[pc].op;
+		const char* text = schema->ops[pc].text;
+		pc++;
+		switch (op->code)
+		{
+			case OP_TEXT:
+				fwrite(text, 1, op->text_length, out);
+				break;
+			case OP_VALUE:
+				if (cursor + op->offset < 0 || cursor + op->offset + value_size(op->kind) > (long) schema->size) break;
+				print_value(out, op->kind, bytes + cursor + op->offset);
+				break;
+			case OP_CHARS:
+			{
+				long at = cursor + op->offset;
+				if (at < 0 || at >= (long) schema->size) break;
+				long limit = (long) schema->size - at < op->count ? (long) schema->size - at : op->count;
+				fprintf(out, "%.*s", (int) strnlen(bytes + at, limit), bytes + at);
+				break;
+			}
+			case OP_ITEMS:
+				for (long i = 0; i < op->count; i++)
+				{
+					long at = cursor + op->offset + i * op->stride;
+					if (at < 0 || at + value_size(op->kind) > (long) schema->size) break;
+					fprintf(out, "%*s<item>\n%*s", (int) op->jump, "", (int) op->jump + 4, "");
+					print_value(out, op->kind, bytes + at);
+					fprintf(out, "\n%*s</item>\n", (int) op->jump, "");
+				}
+				break;
+			case OP_DEREF:
+				fputs("<__NOT_CAPTURED__/>\n", out);
+				pc = op->jump;
+				break;
+			case OP_LOOP:
+				if (op->count <= 0 || depth == DECODE_DEPTH)
+				{
+					pc = op->jump;
+					break;
+				}
+				frames[depth].resume = pc;
+				frames[depth].base = cursor;
+				frames[depth].index = 0;
+				depth++;
+				cursor += op->offset;
+				break;
+			case OP_END_LOOP:
+			{
+				const struct debugger_trace_op* loop = schema->ops[frames[depth - 1].resume - 1].op;
+				if (++frames[depth - 1].index < loop->count)
+				{
+					cursor = frames[depth - 1].base + loop->offset + frames[depth - 1].index * loop->stride;
+					pc = frames[depth - 1].resume;
+					break;
+				}
+				cursor = frames[--depth].base;
+				break;
+			}
+			default: // guards have nothing to protect in a copy
+				break;
+		}
+	}
+}
+
+/**
+ *  "find_schema" gives the descriptor of a schema id, as the decoder and the segment reader keep them differently.
+ */
+
+typedef const struct decode_descriptor* (*schema_finder)(uint64_t id, void* context);
+
+static int decode_capture(FILE* out, const struct decode_descriptor* site, schema_finder find_schema, void* context,
+	const char* p, const char* end)
+{
+	const struct debugger_trace_capture* capture = (const struct debugger_trace_capture*) p;
+	if (site == NULL || p + sizeof(*capture) > end || capture->last_op > site->n_ops) return 0;
+	p += sizeof(*capture);
+	for (uint32_t pc = capture->first_op; pc < capture->last_op; pc++)
+	{
+		const struct debugger_trace_op* op = site->ops[pc].op;
+		switch (op->code)
+		{
+			case OP_TEXT:
+				fwrite(site->ops[pc].text, 1, op->text_length, out);
+				break;
+			case OP_CONTEXT:
+				fprintf(out, "%.*s:%d:", (int) site->name_length, site->name, site->line_no);
+				break;
+			case OP_SCHEMA:
+			{
+				const struct decode_descriptor* schema = find_schema(op->schema, context);
+				if (schema == NULL || p + schema->size > end) return 0;
+				decode_schema(out, schema, p);
+				p += schema->size;
+				break;
+			}
+		}
+	}
+	return 1;
+}
+
+#endif
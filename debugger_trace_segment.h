@@ -0,0 +1,395 @@
+#ifndef DEBUGGER_TRACE_SEGMENT_H
+#define DEBUGGER_TRACE_SEGMENT_H
+
+/**
+ *  this file is included by <debugger_capture.h>.
+ *
+ *  with $DEBUGGER_TRACE_DIR the captures are written to <dir>/segment-<pid>-<n>.dts, files of $DEBUGGER_TRACE_SEGMENT bytes
+ *  (64 MB by default) mapped in memory, see <debugger_trace_format.h> for the layout. a capture reserves its bytes
+ *  with an atomic add and copies them, without a lock nor a syscall. the thread finding a segment full opens the next one
+ *  and seals the full one, the last one is sealed at exit. "debugger_trace_query" reads them back.
+ */
+
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef DEBUGGER_SEGMENT_SIZE
+#define DEBUGGER_SEGMENT_SIZE (64UL << 20)
+#endif
+
+#define DEBUGGER_SEGMENT_MIN_SIZE (1UL << 16)
+
+/**
+ *  a segment is never freed, as a thread may still hold it between loading "debugger_segment_current" and entering it.
+ */
+
+struct debugger_segment
+{
+	char* base;
+	uint64_t capacity;
+	uint64_t used;                           // bytes reserved, including the header
+	unsigned long writers;                   // captures in progress
+	int fd;
+	const void* seen[DEBUGGER_CAPTURE_SEEN]; // descriptors written in this segment
+};
+
+struct debugger_segment_list
+{
+	char* items;
+	size_t n;
+	size_t capacity;
+	size_t item_size;
+};
+
+static struct debugger_segment* debugger_segment_current;
+static pthread_mutex_t debugger_segment_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char* debugger_segment_directory;
+static uint64_t debugger_segment_size = DEBUGGER_SEGMENT_SIZE;
+static unsigned int debugger_segment_count;
+
+static uint64_t debugger_segment_align(uint64_t length)
+{
+	return (length + DEBUGGER_SEGMENT_ALIGN - 1) & ~(uint64_t) (DEBUGGER_SEGMENT_ALIGN - 1);
+}
+
+static struct debugger_segment* debugger_segment_create(void)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/segment-%d-%u.dts", debugger_segment_directory, (int) getpid(), debugger_segment_count++);
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, debugger_segment_size) != 0)
+	{
+		perror(path);
+		if (fd >= 0) close(fd);
+		return NULL;
+	}
+	void* base = mmap(NULL, debugger_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	struct debugger_segment* segment = (struct debugger_segment*) calloc(1, sizeof(struct debugger_segment));
+	if (base == MAP_FAILED || segment == NULL)
+	{
+		perror(path);
+		if (base != MAP_FAILED) munmap(base, debugger_segment_size);
+		close(fd);
+		free(segment);
+		return NULL;
+	}
+	struct debugger_segment_header* header = (struct debugger_segment_header*) base;
+	memcpy(header->magic, DEBUGGER_SEGMENT_MAGIC, sizeof(header->magic));
+	header->version = DEBUGGER_TRACE_VERSION;
+	header->pointer_size = sizeof(void*);
+	segment->base = (char*) base;
+	segment->capacity = debugger_segment_size;
+	segment->used = sizeof(struct debugger_segment_header);
+	segment->fd = fd;
+	return segment;
+}
+
+/**
+ *  a writer announces itself before checking that the segment is still the current one,
+ *  so that the sealer, which replaces the segment before waiting for its writers, can not miss it.
+ */
+
+static struct debugger_segment* debugger_segment_enter(void)
+{
+	for (;;)
+	{
+		struct debugger_segment* segment = __atomic_load_n(&debugger_segment_current, __ATOMIC_ACQUIRE);
+		if (segment == NULL) return NULL;
+		__atomic_fetch_add(&segment->writers, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&debugger_segment_current, __ATOMIC_SEQ_CST) == segment) return segment;
+		__atomic_fetch_sub(&segment->writers, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void debugger_segment_leave(struct debugger_segment* segment)
+{
+	__atomic_fetch_sub(&segment->writers, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ *  returns NULL when the segment is full, the record then goes to the next one.
+ */
+
+static char* debugger_segment_reserve(struct debugger_segment* segment, size_t length)
+{
+	uint64_t aligned = debugger_segment_align(length);
+	uint64_t offset = __atomic_fetch_add(&segment->used, aligned, __ATOMIC_RELAXED);
+	if (offset + aligned > segment->capacity) return NULL;
+	return segment->base + offset;
+}
+
+/**
+ *  the tag is written last, thus a segment left unsealed by a crash ends at the first record not completely written.
+ */
+
+static void debugger_segment_publish(char* out, uint32_t tag, size_t length, const void* id)
+{
+	struct debugger_trace_record* record = (struct debugger_trace_record*) out;
+	record->length = (uint32_t) length;
+	record->id = (uint64_t) (uintptr_t) id;
+	__atomic_store_n(&record->tag, tag, __ATOMIC_RELEASE);
+}
+
+static void debugger_segment_write_descriptor(struct debugger_segment* segment, uint32_t tag, const void* id)
+{
+	size_t length;
+	char* buffer = debugger_capture_descriptor(tag, id, &length);
+	if (buffer == NULL) return;
+	char* out = debugger_segment_reserve(segment, length);
+	if (out != NULL)
+	{
+		size_t header_length = sizeof(struct debugger_trace_record);
+		memcpy(out + header_length, buffer + header_length, length - header_length);
+		debugger_segment_publish(out, tag, length - header_length, id);
+	}
+	free(buffer); // a descriptor which did not fit is added by the sealer
+}
+
+static void debugger_segment_write_site(struct debugger_segment* segment, const struct debugger_site* site)
+{
+	debugger_segment_write_descriptor(segment, TRACE_SITE, site);
+	for (unsigned int i = 0; i < site->n_ops; i++)
+	{
+		const struct debugger_schema* schema = site->ops[i].schema;
+		if (site->ops[i].code == OP_SCHEMA && debugger_capture_first_seen(segment->seen, schema))
+		{
+			debugger_segment_write_descriptor(segment, TRACE_SCHEMA, schema);
+		}
+	}
+}
+
+static void* debugger_segment_push(struct debugger_segment_list* list)
+{
+	if (list->n == list->capacity)
+	{
+		size_t capacity = list->capacity == 0 ? 256 : list->capacity * 2;
+		char* items = (char*) realloc(list->items, capacity * list->item_size);
+		if (items == NULL) return NULL;
+		list->items = items;
+		list->capacity = capacity;
+	}
+	return list->items + list->n++ * list->item_size;
+}
+
+static int debugger_segment_compare_entries(const void* a, const void* b)
+{
+	const struct debugger_segment_entry* x = (const struct debugger_segment_entry*) a;
+	const struct debugger_segment_entry* y = (const struct debugger_segment_entry*) b;
+	if (x->site != y->site) return x->site < y->site ? -1 : 1;
+	if (x->time_ns != y->time_ns) return x->time_ns < y->time_ns ? -1 : 1;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static int debugger_segment_compare_descriptors(const void* a, const void* b)
+{
+	uint64_t x = ((const struct debugger_segment_schema*) a)->schema;
+	uint64_t y = ((const struct debugger_segment_schema*) b)->schema;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ *  returns the offset of the descriptor of "id" in "descriptors", which is kept sorted.
+ *  a descriptor missing from the records is appended after them at "*data_end", from the memory of the process.
+ */
+
+static uint64_t debugger_segment_ensure(int fd, struct debugger_segment_list* descriptors, uint64_t* data_end,
+	uint32_t tag, const void* id)
+{
+	struct debugger_segment_schema key = { (uint64_t) (uintptr_t) id, 0 };
+	struct debugger_segment_schema* found = (struct debugger_segment_schema*) bsearch(&key, descriptors->items,
+		descriptors->n, sizeof(key), debugger_segment_compare_descriptors);
+	if (found != NULL) return found->descriptor;
+
+	size_t length;
+	char* buffer = debugger_capture_descriptor(tag, id, &length);
+	if (buffer == NULL) return 0;
+	size_t aligned = debugger_segment_align(length);
+	buffer = (char*) realloc(buffer, aligned);
+	if (buffer == NULL) return 0;
+	memset(buffer + length, 0, aligned - length);
+	if (pwrite(fd, buffer, aligned, *data_end) != (ssize_t) aligned)
+	{
+		free(buffer);
+		return 0;
+	}
+	free(buffer);
+	key.descriptor = *data_end;
+	*data_end += aligned;
+	struct debugger_segment_schema* slot = (struct debugger_segment_schema*) debugger_segment_push(descriptors);
+	if (slot == NULL) return key.descriptor;
+	*slot = key;
+	qsort(descriptors->items, descriptors->n, sizeof(key), debugger_segment_compare_descriptors);
+	return key.descriptor;
+}
+
+/**
+ *  called with "debugger_segment_lock" held, once the segment is no longer the current one.
+ *  the records are scanned once to build the index, which is then written after them with the tables.
+ */
+
+static void debugger_segment_seal(struct debugger_segment* segment)
+{
+	while (__atomic_load_n(&segment->writers, __ATOMIC_SEQ_CST) != 0) sched_yield();
+
+	struct debugger_segment_list index = { NULL, 0, 0, sizeof(struct debugger_segment_entry) };
+	struct debugger_segment_list sites = { NULL, 0, 0, sizeof(struct debugger_segment_schema) };
+	struct debugger_segment_list schemas = { NULL, 0, 0, sizeof(struct debugger_segment_schema) };
+	uint64_t end = segment->used < segment->capacity ? segment->used : segment->capacity;
+	uint64_t offset = sizeof(struct debugger_segment_header);
+	while (offset + sizeof(struct debugger_trace_record) <= end)
+	{
+		const struct debugger_trace_record* record = (const struct debugger_trace_record*) (segment->base + offset);
+		uint32_t tag = __atomic_load_n(&record->tag, __ATOMIC_ACQUIRE);
+		uint64_t length = debugger_segment_align(sizeof(*record) + record->length);
+		if (tag == 0 || offset + length > end) break;
+		if (tag == TRACE_CAPTURE)
+		{
+			const struct debugger_trace_capture* capture = (const struct debugger_trace_capture*) (record + 1);
+			struct debugger_segment_entry* entry = (struct debugger_segment_entry*) debugger_segment_push(&index);
+			if (entry != NULL) *entry = (struct debugger_segment_entry) { record->id, offset, capture->time_ns };
+		}
+		else
+		{
+			struct debugger_segment_list* descriptors = tag == TRACE_SITE ? &sites : &schemas;
+			struct debugger_segment_schema* descriptor = (struct debugger_segment_schema*) debugger_segment_push(descriptors);
+			if (descriptor != NULL) *descriptor = (struct debugger_segment_schema) { record->id, offset };
+		}
+		offset += length;
+	}
+	munmap(segment->base, segment->capacity);
+	segment->base = NULL;
+
+	struct debugger_segment_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DEBUGGER_SEGMENT_MAGIC, sizeof(header.magic));
+	header.version = DEBUGGER_TRACE_VERSION;
+	header.pointer_size = sizeof(void*);
+	uint64_t data_end = offset;
+	int fd = segment->fd;
+	if (ftruncate(fd, data_end) != 0) perror("debugger_segment_seal");
+
+	qsort(index.items, index.n, index.item_size, debugger_segment_compare_entries);
+	qsort(sites.items, sites.n, sites.item_size, debugger_segment_compare_descriptors);
+	qsort(schemas.items, schemas.n, schemas.item_size, debugger_segment_compare_descriptors);
+	struct debugger_segment_list table = { NULL, 0, 0, sizeof(struct debugger_segment_site) };
+	struct debugger_segment_entry* entries = (struct debugger_segment_entry*) index.items;
+	for (size_t i = 0; i < index.n; i++)
+	{
+		if (i == 0 || entries[i].time_ns < header.first_ns) header.first_ns = entries[i].time_ns;
+		if (entries[i].time_ns > header.last_ns) header.last_ns = entries[i].time_ns;
+		struct debugger_segment_site* last = (struct debugger_segment_site*) table.items + table.n - 1;
+		if (table.n > 0 && last->site == entries[i].site)
+		{
+			last->n_entries++;
+			last->last_ns = entries[i].time_ns;
+			continue;
+		}
+		const struct debugger_site* site = (const struct debugger_site*) (uintptr_t) entries[i].site;
+		struct debugger_segment_site* row = (struct debugger_segment_site*) debugger_segment_push(&table);
+		if (row == NULL) break;
+		row->site = entries[i].site;
+		row->descriptor = debugger_segment_ensure(fd, &sites, &data_end, TRACE_SITE, site);
+		row->first_entry = i;
+		row->n_entries = 1;
+		row->first_ns = row->last_ns = entries[i].time_ns;
+		for (unsigned int pc = 0; pc < site->n_ops; pc++)
+		{
+			if (site->ops[pc].code == OP_SCHEMA) debugger_segment_ensure(fd, &schemas, &data_end, TRACE_SCHEMA, site->ops[pc].schema);
+		}
+	}
+
+	header.sealed = 1;
+	header.data_end = data_end;
+	header.n_sites = table.n;
+	header.sites_offset = data_end;
+	header.schemas_offset = header.sites_offset + table.n * table.item_size;
+	header.n_schemas = schemas.n;
+	header.index_offset = header.schemas_offset + schemas.n * schemas.item_size;
+	header.n_captures = index.n;
+	int failed = pwrite(fd, table.items, table.n * table.item_size, header.sites_offset) < 0
+		|| pwrite(fd, schemas.items, schemas.n * schemas.item_size, header.schemas_offset) < 0
+		|| pwrite(fd, index.items, index.n * index.item_size, header.index_offset) < 0
+		|| pwrite(fd, &header, sizeof(header), 0) < 0;
+	if (failed) perror("debugger_segment_seal");
+	close(fd);
+	free(index.items);
+	free(sites.items);
+	free(schemas.items);
+	free(table.items);
+}
+
+static void debugger_segment_rotate(struct debugger_segment* full)
+{
+	pthread_mutex_lock(&debugger_segment_lock);
+	if (__atomic_load_n(&debugger_segment_current, __ATOMIC_RELAXED) == full)
+	{
+		__atomic_store_n(&debugger_segment_current, debugger_segment_create(), __ATOMIC_SEQ_CST);
+		debugger_segment_seal(full);
+	}
+	pthread_mutex_unlock(&debugger_segment_lock);
+}
+
+/**
+ *  captures made by threads still running after the handler are dropped.
+ */
+
+void debugger_segment_close(void)
+{
+	pthread_mutex_lock(&debugger_segment_lock);
+	struct debugger_segment* last = __atomic_exchange_n(&debugger_segment_current, NULL, __ATOMIC_SEQ_CST);
+	if (last != NULL) debugger_segment_seal(last);
+	pthread_mutex_unlock(&debugger_segment_lock);
+}
+
+void debugger_segment_capture(const struct debugger_site* site, const void* const* slots, unsigned int first_op, unsigned int last_op)
+{
+	size_t length = debugger_capture_length(site, first_op, last_op);
+	size_t total_length = sizeof(struct debugger_trace_record) + length;
+	if (sizeof(struct debugger_segment_header) + debugger_segment_align(total_length) > debugger_segment_size) return;
+	for (;;)
+	{
+		struct debugger_segment* segment = debugger_segment_enter();
+		if (segment == NULL) return;
+		if (debugger_capture_first_seen(segment->seen, site)) debugger_segment_write_site(segment, site);
+		char* out = debugger_segment_reserve(segment, total_length);
+		if (out != NULL)
+		{
+			struct debugger_trace_capture capture = { first_op, last_op, debugger_capture_now_ns() };
+			char* p = debugger_capture_put(out + sizeof(struct debugger_trace_record), &capture, sizeof(capture));
+			for (unsigned int pc = first_op; pc < last_op; pc++)
+			{
+				const struct debugger_op* op = &site->ops[pc];
+				if (op->code == OP_SCHEMA) p = debugger_capture_put(p, slots[op->count], op->schema->size);
+			}
+			debugger_segment_publish(out, TRACE_CAPTURE, length, site);
+			debugger_segment_leave(segment);
+			debugger_count_emitted(total_length);
+			return;
+		}
+		debugger_segment_leave(segment);
+		debugger_segment_rotate(segment);
+	}
+}
+
+/**
+ *  returns 1 if $DEBUGGER_TRACE_DIR selects the segments, even if the first one could not be created.
+ */
+
+int debugger_segment_open(void)
+{
+	const char* directory = getenv("DEBUGGER_TRACE_DIR");
+	if (directory == NULL) return 0;
+	const char* size = getenv("DEBUGGER_TRACE_SEGMENT");
+	if (size != NULL) debugger_segment_size = debugger_segment_align(strtoull(size, NULL, 0));
+	if (debugger_segment_size < DEBUGGER_SEGMENT_MIN_SIZE) debugger_segment_size = DEBUGGER_SEGMENT_MIN_SIZE;
+	mkdir(directory, 0755);
+	debugger_segment_directory = directory;
+	__atomic_store_n(&debugger_segment_current, debugger_segment_create(), __ATOMIC_RELEASE);
+	atexit(debugger_segment_close);
+	return 1;
+}
+
+#endif
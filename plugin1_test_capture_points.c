@@ -0,0 +1,87 @@
+#include "debugger.h"
+
+/**
+ *  capture points, counted by test.sh in the markup the run writes to stderr.
+ */
+
+/**
+ *  one capture at the declaration, one per period of the loop, one when the loop is left:
+ *  8 of "evens" and 6 of "thirds".
+ */
+
+int periods(void)
+{
+	track_var_at("loop-exit:2") int evens = 0;
+	track_var_at("loop-exit:3") int thirds = 0;
+	for (int i = 0; i < 12; i++)
+	{
+		evens += i;
+		thirds += i;
+	}
+	return evens - thirds;
+}
+
+/**
+ *  a block is left at its end on the first pass and by a break on the second: 2 of "seen".
+ */
+
+int leave_by_break(void)
+{
+	int total = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		track_var_at("scope-exit") int seen = i;
+		total += seen;
+		if (i == 1) break;
+	}
+	return total;
+}
+
+/**
+ *  a block only left by a goto: 1 of "left".
+ */
+
+int leave_by_goto(int n)
+{
+	{
+		track_var_at("scope-exit") int left = n;
+		if (left > 0) goto done;
+		left = -1;
+	}
+done:
+	return n;
+}
+
+/**
+ *  the return captures what the returned expression writes: 4101, never 4100.
+ */
+
+int return_after_value(void)
+{
+	track_var_at("return") int count = 4100;
+	return count++;
+}
+
+/**
+ *  a block made of a return alone, whose return var is known before the return is looked at: 1 of "calls".
+ */
+
+int return_from_block(int n)
+{
+	if (n > 0)
+	{
+		track_var_at("return") static int calls;
+		return n;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	periods();
+	leave_by_break();
+	leave_by_goto(1);
+	return_after_value();
+	return_from_block(1);
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include "debugger.h"
+
+/**
+ *  the segfault guard without the plugin: guarded regions nested deeper than DEBUGGER_GUARD_DEPTH,
+ *  segfaults outside of any region going to the handler installed before the guard, a handler installed after it,
+ *  and the alternate stacks of exited threads.
+ *  exits with 0 when every check holds.
+ */
+
+static volatile int* volatile null_pointer;
+static int resumed_at;
+static sigjmp_buf user_recovery;
+static int user_handled;
+
+/**
+ *  the guard as injected around an expansion, "resumed_at" is the depth of the region left by the segfault.
+ */
+
+static void nest(int depth, int fault_at)
+{
+	volatile int faulted = 1;
+	if (_setjmp(entering_risk()) == 0)
+	{
+		if (depth == fault_at) (void) *null_pointer;
+		else nest(depth + 1, fault_at);
+		faulted = 0;
+	}
+	exiting_risk();
+	if (faulted && resumed_at == 0) resumed_at = depth;
+}
+
+static void user_handler(int sig)
+{
+	(void) sig;
+	user_handled++;
+	siglongjmp(user_recovery, 1);
+}
+
+/**
+ *  a thread faulting in a region, it reinstalls the guard and exits with its alternate stack.
+ */
+
+static void* fault_in_thread(void* unused)
+{
+	(void) unused;
+	volatile int faulted = 1;
+	if (_setjmp(entering_risk()) == 0)
+	{
+		(void) *null_pointer;
+		faulted = 0;
+	}
+	exiting_risk();
+	return (void*) (long) faulted;
+}
+
+static int fault_in_threads(int n_threads)
+{
+	int faulted = 0;
+	for (int i = 0; i < n_threads; i++)
+	{
+		pthread_t thread;
+		void* result = NULL;
+		if (pthread_create(&thread, NULL, fault_in_thread, NULL) != 0) return 0;
+		pthread_join(thread, &result);
+		faulted += result != NULL;
+	}
+	return faulted == n_threads;
+}
+
+int main(void)
+{
+	int failures = 0;
+	signal(SIGSEGV, user_handler);
+
+	// a fault below the deepest jmp_buf leaves the region that owns it, never a frame already returned from
+	nest(1, DEBUGGER_GUARD_DEPTH + 8);
+	if (resumed_at != DEBUGGER_GUARD_DEPTH || debugger_guard_depth != 0) failures++;
+	resumed_at = 0;
+	nest(1, DEBUGGER_GUARD_DEPTH / 2);
+	if (resumed_at != DEBUGGER_GUARD_DEPTH / 2 || debugger_guard_depth != 0) failures++;
+
+	// outside of any region the previous handler runs, every time, and the guard is still installed afterwards
+	for (int i = 0; i < 2; i++)
+		if (sigsetjmp(user_recovery, 1) == 0) (void) *null_pointer;
+	if (user_handled != 2) failures++;
+	resumed_at = 0;
+	nest(1, 1);
+	if (resumed_at != 1) failures++;
+
+	// a handler installed after the guard is replaced again by the next thread entering a region
+	signal(SIGSEGV, user_handler);
+	if (!fault_in_threads(1)) failures++;
+
+	// every exited thread frees its alternate stack
+	fault_in_threads(1);
+	struct mallinfo2 before = mallinfo2();
+	if (!fault_in_threads(200)) failures++;
+	struct mallinfo2 after = mallinfo2();
+	if (after.uordblks > before.uordblks + DEBUGGER_GUARD_STACK) failures++;
+
+	fprintf(stdout, "%s\n", failures == 0 ? "ok" : "failed");
+	return failures != 0;
+}
@@ -0,0 +1,58 @@
+#include "debugger.h"
+
+/**
+ *  "debugger_heap_items" without the plugin: the blocks of malloc are bounded, the memory that only looks like one
+ *  is not, even with a header of malloc written before it. exits with 0 when every check holds.
+ */
+
+#define BSS_WORDS (1 << 16)
+
+static size_t bss_words[BSS_WORDS]; // large enough for an anonymous mapping after the data of the binary
+static void* thread_block;
+
+static void* allocate_in_thread(void* unused)
+{
+	(void) unused;
+	thread_block = malloc(40);
+	return NULL;
+}
+
+/**
+ *  a header of an in-use chunk of "size" bytes before "words" + 2, as malloc would write it.
+ */
+
+static const void* fake_block(size_t* words, size_t size, size_t flags)
+{
+	words[0] = 0;
+	words[1] = size | flags;
+	words[size / sizeof(size_t) + 1] = 1;
+	return words + 2;
+}
+
+int main(void)
+{
+	int failures = 0;
+	setenv("DEBUGGER_MAPS_REFRESH_MS", "0", 1); // every miss refreshes the copy, the test does not wait for it
+
+	int* small = malloc(10 * sizeof(int));
+	if (debugger_heap_items(small, sizeof(int)) < 10) failures++;
+	int* large = malloc(1 << 20); // mapped on its own
+	if (debugger_heap_items(large, sizeof(int)) != DEBUGGER_HEAP_CAP / sizeof(int)) failures++;
+
+	// the .bss, within the data of the binary and in the anonymous mapping after it, and the stack
+	if (debugger_heap_items(fake_block(bss_words, 64, 1), sizeof(int)) != 0) failures++;
+	size_t page_words = sysconf(_SC_PAGESIZE) / sizeof(size_t);
+	size_t* bss_page = (size_t*) (((uintptr_t) (bss_words + BSS_WORDS / 2)) & ~(page_words * sizeof(size_t) - 1));
+	if (debugger_heap_items(fake_block(bss_page, page_words * sizeof(size_t), 2), sizeof(int)) != 0) failures++;
+	size_t stack_words[64];
+	if (debugger_heap_items(fake_block(stack_words, 64, 1), sizeof(int)) != 0) failures++;
+
+	// the arena of another thread is dereferenced once
+	pthread_t thread;
+	pthread_create(&thread, NULL, allocate_in_thread, NULL);
+	pthread_join(thread, NULL);
+	if (debugger_heap_items(thread_block, sizeof(int)) != 0) failures++;
+
+	fprintf(stdout, "%s\n", failures == 0 ? "ok" : "failed");
+	return failures != 0;
+}
@@ -0,0 +1,67 @@
+#include "debugger.h"
+#include <float.h>
+
+/**
+ *  "debugger_print_items" without the plugin: the markup of every item, at a padding that fits the buffer
+ *  and at one that does not, and of the longest values at a wide padding. exits with 0 when every check holds.
+ */
+
+static char output[1 << 20];
+
+/**
+ *  the bytes "debugger_print_items" writes to stderr.
+ */
+
+static size_t print_items_into_output(unsigned int kind, const void* items, long count, long stride, unsigned int padding)
+{
+	FILE* captured = tmpfile();
+	int saved = dup(2);
+	fflush(stderr);
+	dup2(fileno(captured), 2);
+	debugger_print_items(kind, items, count, stride, padding);
+	fflush(stderr);
+	dup2(saved, 2);
+	close(saved);
+	rewind(captured);
+	size_t length = fread(output, 1, sizeof(output) - 1, captured);
+	output[length] = 0;
+	fclose(captured);
+	return length;
+}
+
+static int check_items(unsigned int kind, const void* items, long count, unsigned int padding)
+{
+	long stride = kind == REAL_DOUBLE ? sizeof(double) : sizeof(int);
+	size_t length = print_items_into_output(kind, items, count, stride, padding);
+	const char* at = output;
+	for (long i = 0; i < count; i++)
+	{
+		char value[512];
+		int n = kind == REAL_DOUBLE
+			? sprintf(value, "%lf\n", ((const double*) items)[i])
+			: sprintf(value, "%d\n", ((const int*) items)[i]);
+		for (unsigned int j = 0; j < padding; j++) if (*at++ != ' ') return 0;
+		if (strncmp(at, "<item>\n", 7) != 0) return 0;
+		at += 7;
+		for (unsigned int j = 0; j < padding + 4; j++) if (*at++ != ' ') return 0;
+		if (strncmp(at, value, n) != 0) return 0;
+		at += n;
+		for (unsigned int j = 0; j < padding; j++) if (*at++ != ' ') return 0;
+		if (strncmp(at, "</item>\n", 8) != 0) return 0;
+		at += 8;
+	}
+	return at == output + length;
+}
+
+int main(void)
+{
+	int failures = 0;
+	int items[] = {3, -14, 159, 2653};
+	if (!check_items(SIGNED_INT, items, 4, 8)) failures++;
+	if (!check_items(SIGNED_INT, items, 4, DEBUGGER_ITEMS_BUFFER)) failures++;
+	static double longest[100];
+	for (int i = 0; i < 100; i++) longest[i] = -DBL_MAX;
+	if (!check_items(REAL_DOUBLE, longest, 100, 280)) failures++;
+	fprintf(stdout, "%s\n", failures == 0 ? "ok" : "failed");
+	return failures != 0;
+}
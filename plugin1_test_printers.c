@@ -0,0 +1,28 @@
+#include "debugger.h"
+
+/**
+ *  two vars of a recursive type captured by one site expand the same whether their printers are outlined or inline:
+ *  every var shows its own fields, and the type again below it is a recursion. counted by test.sh.
+ */
+
+struct node
+{
+	int value;
+	struct node* next;
+};
+
+static void link_nodes(struct node* a, struct node* b)
+{
+	a->value = 1;
+	a->next = b;
+	b->value = 2;
+	b->next = a;
+}
+
+int main(void)
+{
+	track_var struct node first;
+	track_var struct node second;
+	link_nodes(&first, &second);
+	return 0;
+}
@@ -0,0 +1,42 @@
+#define DEBUGGER_RING_BUFFER
+#include "debugger.h"
+
+/**
+ *  the ring buffer without the plugin, when its drain thread cannot be started: the failure is reported,
+ *  and every record is still written, by the thread that emits it. exits with 0 when every check holds.
+ */
+
+static char output[1 << 16];
+
+/**
+ *  no thread can be created, as when the process is at its limit.
+ */
+
+int pthread_create(pthread_t* thread, const pthread_attr_t* attr, void* (*start)(void*), void* arg)
+{
+	(void) thread;
+	(void) attr;
+	(void) start;
+	(void) arg;
+	return EAGAIN;
+}
+
+int main(void)
+{
+	int failures = 0;
+	FILE* captured = tmpfile();
+	int saved = dup(2);
+	dup2(fileno(captured), 2);
+	print_string_literal("<value>\n");
+	print_int(7001);
+	print_char_pointer("\n</value>\n");
+	dup2(saved, 2);
+	close(saved);
+	rewind(captured);
+	output[fread(output, 1, sizeof(output) - 1, captured)] = 0;
+	fclose(captured);
+	if (strstr(output, "<__RING_ERROR__ reason=\"no drain thread\"/>\n") == NULL) failures++;
+	if (strstr(output, "<value>\n7001\n</value>\n") == NULL) failures++;
+	fprintf(stdout, "%s\n", failures == 0 ? "ok" : "failed");
+	return failures != 0;
+}
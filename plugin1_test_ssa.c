@@ -0,0 +1,24 @@
+#include "debugger.h"
+
+/**
+ *  a track_range pointer in a register, built with -O2 and -fplugin-arg-<plugin>-pass=ssa: its range is printed
+ *  with the bounds read after each store, 7001 to 7003 once, and a pointer to nothing is a fault, not a crash.
+ *  counted by test.sh.
+ */
+
+static int values[] = { 7001, 7002, 7003, 7004 };
+
+__attribute__((noinline)) static void observe(const int* p)
+{
+	__asm__ volatile ("" : : "r" (p) : "memory");
+}
+
+int main(void)
+{
+	long length = 3;
+	track_range(0, length) int* window = values;
+	observe(window);
+	window = (int*) 16;
+	observe(window);
+	return 0;
+}
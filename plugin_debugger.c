@@ -1,6 +1,9 @@
 #include "debugger_common.h"
 #include "attribute_handler.h"
 #include "ast_analyzer.h"
+#include "plugin_options.h"
+#include "plugin_linkage.h"
+#include "ssa_injector.h"
 // #include "data_print.h"
 
 
@@ -11,8 +14,11 @@
 
 void finish_func(void* event, void* __unused__)
 {
+    profile_scope scope(PROFILE_FINISH_FUNC, (tree) event);
     push_print_func((tree) event);
-    add_print_for_var((tree) event);
+    if (ssa_pass_enabled()) prepare_ssa_printers((tree) event);
+    else add_print_for_var((tree) event);
+    share_runtime_definition((tree) event);
 }
 
 int plugin_init(struct plugin_name_args *plugin_info, struct plugin_gcc_version *version)
@@ -29,15 +35,17 @@ int plugin_init(struct plugin_name_args *plugin_info, struct plugin_gcc_version
 
     const char * const plugin_name = plugin_info->base_name;
 
-    for (int i = 0; i < plugin_info->argc; i++) {
-        printf("Plugin config: %s = %s\n", plugin_info->argv[i].key, plugin_info->argv[i].value);
-    }
+    parse_plugin_options(plugin_info);
+    check_ssa_options();
 
     setvbuf(stdout, NULL, _IONBF, 0);
 
+    register_callback(plugin_name, PLUGIN_START_UNIT, define_plugin_options, NULL);
     register_callback(plugin_name, PLUGIN_ATTRIBUTES, register_attributes, NULL);
     register_callback(plugin_name, PLUGIN_FINISH_PARSE_FUNCTION, finish_func, NULL);
-    // register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &my_passinfo);
+    register_callback(plugin_name, PLUGIN_FINISH_DECL, finish_decl, NULL);
+    register_callback(plugin_name, PLUGIN_FINISH_UNIT, finish_unit, NULL);
+    if (ssa_pass_enabled()) register_ssa_pass(plugin_name);
 
     return 0;
 }
\ No newline at end of file
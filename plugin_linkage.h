@@ -0,0 +1,156 @@
+#ifndef PLUGIN_LINKAGE_H
+#define PLUGIN_LINKAGE_H
+
+#include "debugger_common.h"
+#include "attribute_handler.h"
+
+/**
+ *  the runtime is made of headers, thus every unit including <debugger.h> defines it again.
+ *  the public functions and variables of the runtime headers are emitted as COMDAT (weak and coalesced on mach-o),
+ *  so that the linker keeps a single copy of the runtime and of its state. the printers and schemas generated
+ *  for a type are COMDAT as well, named after a hash of the type that is the same in every unit.
+ *  all the units of a program have to be built with the same runtime macros, e.g. DEBUGGER_RING_BUFFER.
+ */
+
+static bool is_runtime_header(const char* path)
+{
+	if (path == NULL) return false;
+	const char* base = lbasename(path);
+	size_t length = strlen(base);
+	return strncmp(base, "debugger", 8) == 0 && length > 2 && strcmp(base + length - 2, ".h") == 0;
+}
+
+/**
+ *  called for every function definition and every declaration of the unit.
+ */
+
+void share_runtime_definition(tree decl)
+{
+	if (TREE_CODE(decl) != FUNCTION_DECL && TREE_CODE(decl) != VAR_DECL) return;
+	if (!TREE_PUBLIC(decl) || DECL_EXTERNAL(decl) || !TREE_STATIC(decl)) return;
+	if (!is_runtime_header(DECL_SOURCE_FILE(decl)) || DECL_ONE_ONLY(decl)) return;
+	if (TREE_CODE(decl) == VAR_DECL) DECL_COMMON(decl) = 0; // a tentative definition would be emitted as .comm otherwise
+	make_decl_one_only(decl, DECL_ASSEMBLER_NAME(decl));
+}
+
+void finish_decl(void* event, void* user_data __unused)
+{
+	share_runtime_definition((tree) event);
+}
+
+/**
+ *  FNV-1a over the structure of a type: its code, name, size and qualifiers, the names, offsets and types of its fields,
+ *  the types it points to, and the trackers it reaches. a type met again while it is being hashed, as in a linked list,
+ *  is hashed as its depth. returns false if the type reaches a tracker that is local to the unit.
+ */
+
+static void hash_bytes(unsigned long long& hash, const void* data, size_t length)
+{
+	const unsigned char* bytes = (const unsigned char*) data;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+}
+
+static void hash_long(unsigned long long& hash, long value)
+{
+	hash_bytes(hash, &value, sizeof(value));
+}
+
+static void hash_name(unsigned long long& hash, tree name)
+{
+	if (name != NULL_TREE && TREE_CODE(name) == TYPE_DECL) name = DECL_NAME(name);
+	const char* text = name != NULL_TREE && TREE_CODE(name) == IDENTIFIER_NODE ? IDENTIFIER_POINTER(name) : "";
+	hash_bytes(hash, text, strlen(text) + 1);
+}
+
+static bool hash_type(unsigned long long& hash, tree type, std::vector<tree>& open)
+{
+	for (size_t depth = 0; depth < open.size(); depth++)
+	{
+		if (open[depth] != TYPE_MAIN_VARIANT(type)) continue;
+		hash_long(hash, -1 - (long) depth);
+		return true;
+	}
+	hash_long(hash, TREE_CODE(type));
+	hash_name(hash, TYPE_NAME(type));
+	hash_long(hash, int_size_in_bytes(type));
+	hash_long(hash, TYPE_QUALS(type));
+	switch (TREE_CODE(type))
+	{
+		case POINTER_TYPE:
+		case ARRAY_TYPE:
+			return hash_type(hash, TREE_TYPE(type), open);
+		case RECORD_TYPE:
+		case UNION_TYPE:
+		{
+			tree tracker = retrieve_print_function(type);
+			if (tracker != NULL_TREE && !TREE_PUBLIC(tracker)) return false;
+			if (tracker != NULL_TREE) hash_name(hash, DECL_ASSEMBLER_NAME(tracker));
+			open.push_back(TYPE_MAIN_VARIANT(type));
+			bool shareable = true;
+			for (tree field = TYPE_FIELDS(type); field != NULL_TREE && shareable; field = TREE_CHAIN(field))
+			{
+				if (TREE_CODE(field) != FIELD_DECL) continue;
+				hash_name(hash, DECL_NAME(field));
+				hash_long(hash, int_byte_position(field));
+				hash_long(hash, DECL_BIT_FIELD(field));
+				shareable = hash_type(hash, TREE_TYPE(field), open);
+			}
+			open.pop_back();
+			return shareable;
+		}
+		default:
+			hash_long(hash, TYPE_PRECISION(type));
+			hash_long(hash, TYPE_UNSIGNED(type));
+			return true;
+	}
+}
+
+/**
+ *  the name of what is generated for "type" at "padding", e.g. "__debugger_printer_0123456789abcdef_8",
+ *  or an empty string if it cannot be shared.
+ */
+
+std::string shared_definition_name(const char* prefix, tree type, int padding)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	std::vector<tree> open;
+	if (!hash_type(hash, type, open)) return "";
+	char name[96];
+	sprintf(name, "__debugger_%s_%016llx_%d", prefix, hash, padding);
+	return name;
+}
+
+/**
+ *  two distinct types of the same structure, e.g. two anonymous structs, get the same name, which the unit
+ *  has to define only once.
+ */
+
+static std::unordered_map<std::string, tree> shared_definitions;
+
+tree find_shared_definition(const std::string& name)
+{
+	auto found = shared_definitions.find(name);
+	return found == shared_definitions.end() ? NULL_TREE : found->second;
+}
+
+/**
+ *  makes a generated decl, not finalized yet, the copy of "name" kept by the linker among all units.
+ *  it is hidden, as each shared object keeps its own copy anyway.
+ */
+
+void share_generated_definition(tree decl, const std::string& name)
+{
+	DECL_NAME(decl) = get_identifier(name.c_str());
+	SET_DECL_ASSEMBLER_NAME(decl, DECL_NAME(decl));
+	TREE_PUBLIC(decl) = 1;
+	DECL_VISIBILITY(decl) = VISIBILITY_HIDDEN;
+	DECL_VISIBILITY_SPECIFIED(decl) = 1;
+	make_decl_one_only(decl, DECL_ASSEMBLER_NAME(decl));
+	shared_definitions[name] = decl;
+}
+
+#endif
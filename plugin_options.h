@@ -0,0 +1,52 @@
+#ifndef PLUGIN_OPTIONS_H
+#define PLUGIN_OPTIONS_H
+
+#include "debugger_common.h"
+
+/**
+ *  "plugin_options" stores the arguments given by -fplugin-arg-<plugin>-<key>=<value>.
+ *  an argument given without a value is stored as "1".
+ */
+
+static std::unordered_map<std::string, std::string> plugin_options;
+
+void parse_plugin_options(struct plugin_name_args *plugin_info)
+{
+    for (int i = 0; i < plugin_info->argc; i++)
+    {
+        const char* value = plugin_info->argv[i].value;
+        plugin_options[plugin_info->argv[i].key] = value == NULL ? "1" : value;
+        debugger_info_printf("Plugin config: %s = %s\n", plugin_info->argv[i].key, value);
+    }
+}
+
+const char* get_plugin_option(const char* key, const char* default_value)
+{
+    auto found = plugin_options.find(key);
+    if (found == plugin_options.end()) return default_value;
+    return found->second.c_str();
+}
+
+bool plugin_option_is(const char* key, const char* value, const char* default_value)
+{
+    return strcmp(get_plugin_option(key, default_value), value) == 0;
+}
+
+/**
+ *  every option is visible to the runtime as a macro DEBUGGER_OPTION_<KEY>=<value>,
+ *  e.g. -fplugin-arg-<plugin>-port=14857 defines DEBUGGER_OPTION_PORT=14857 for <debugger_network.h>.
+ *  it is a callback of PLUGIN_START_UNIT, when the preprocessor is ready but nothing has been read yet.
+ */
+
+void define_plugin_options(void* event_data __unused, void* user_data __unused)
+{
+    for (auto& option: plugin_options)
+    {
+        std::string macro = "DEBUGGER_OPTION_";
+        for (char c: option.first) macro += ISALNUM(c) ? TOUPPER(c) : '_';
+        macro += "=" + option.second;
+        cpp_define(parse_in, macro.c_str());
+    }
+}
+
+#endif
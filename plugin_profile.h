@@ -0,0 +1,141 @@
+#ifndef PLUGIN_PROFILE_H
+#define PLUGIN_PROFILE_H
+
+#include <sys/resource.h>
+#include <time.h>
+#include "debugger_common.h"
+#include "plugin_options.h"
+
+/**
+ *  -fplugin-arg-<plugin>-profile[=<path>] measures the plugin itself. for every function, and for the whole
+ *  translation unit as function "*", each callback gets a tab separated line in <path> (stderr without a path):
+ *      <file> <function> <phase> <calls> <cpu us> <peak rss growth kb>
+ *  the phases nest: "finish_func" includes "push_print_func" and "add_print_for_var",
+ *  which includes "inject_snapshot", which includes "inject_print" for the vars printed inline.
+ *  the unit also reports, as phases of no time, the analyzer contexts allocated, which are recycled between
+ *  statements and functions, and the largest number of decls visited in one function.
+ */
+
+enum profile_phase
+{
+	PROFILE_FINISH_FUNC,
+	PROFILE_PUSH_PRINT_FUNC,
+	PROFILE_ADD_PRINT_FOR_VAR,
+	PROFILE_INJECT_SNAPSHOT,
+	PROFILE_INJECT_PRINT,
+	PROFILE_PHASES
+};
+
+static const char* profile_phase_names[PROFILE_PHASES] = {
+	"finish_func", "push_print_func", "add_print_for_var", "inject_snapshot", "inject_print"
+};
+
+struct profile_counter
+{
+	long calls;
+	long cpu_ns;
+	long rss_kb;
+};
+
+static profile_counter profile_function_counters[PROFILE_PHASES];
+static profile_counter profile_unit_counters[PROFILE_PHASES];
+static long profile_contexts_created;
+static FILE* profile_out;
+
+static bool profile_enabled()
+{
+	static int enabled = -1;
+	if (enabled < 0) enabled = get_plugin_option("profile", NULL) != NULL;
+	return enabled;
+}
+
+static FILE* profile_file()
+{
+	if (profile_out != NULL) return profile_out;
+	const char* path = get_plugin_option("profile", "1");
+	profile_out = strcmp(path, "1") == 0 ? NULL : fopen(path, "a");
+	if (profile_out == NULL) profile_out = stderr;
+	return profile_out;
+}
+
+static long profile_cpu_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static long profile_peak_rss_kb()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+static void profile_print(const char* function, profile_counter* counters)
+{
+	FILE* out = profile_file();
+	for (int phase = 0; phase < PROFILE_PHASES; phase++)
+	{
+		if (counters[phase].calls == 0) continue;
+		fprintf(out, "%s\t%s\t%s\t%ld\t%ld\t%ld\n", main_input_filename, function, profile_phase_names[phase],
+			counters[phase].calls, counters[phase].cpu_ns / 1000, counters[phase].rss_kb);
+	}
+}
+
+/**
+ *  measures its own lifetime as a call of "phase". the scope given the decl of the function being finished
+ *  reports that function when it ends.
+ */
+
+class profile_scope
+{
+	profile_phase phase;
+	tree func_decl;
+	bool active;
+	long cpu_ns;
+	long rss_kb;
+public:
+	profile_scope(profile_phase phase, tree func_decl = NULL_TREE)
+		: phase(phase), func_decl(func_decl), active(profile_enabled()), cpu_ns(0), rss_kb(0)
+	{
+		if (!active) return;
+		cpu_ns = profile_cpu_ns();
+		rss_kb = profile_peak_rss_kb();
+	}
+	~profile_scope()
+	{
+		if (!active) return;
+		long spent_ns = profile_cpu_ns() - cpu_ns;
+		long grown_kb = profile_peak_rss_kb() - rss_kb;
+		for (profile_counter* counters: { profile_function_counters, profile_unit_counters })
+		{
+			counters[phase].calls++;
+			counters[phase].cpu_ns += spent_ns;
+			counters[phase].rss_kb += grown_kb;
+		}
+		if (func_decl == NULL_TREE) return;
+		profile_print(IDENTIFIER_POINTER(DECL_NAME(func_decl)), profile_function_counters);
+		memset(profile_function_counters, 0, sizeof(profile_function_counters));
+	}
+};
+
+/**
+ *  a callback of PLUGIN_FINISH_UNIT through "finish_unit" of <ast_analyzer.h>.
+ */
+
+void profile_report_unit(size_t visited_peak)
+{
+	if (!profile_enabled()) return;
+	profile_print("*", profile_unit_counters);
+	FILE* out = profile_file();
+	fprintf(out, "%s\t*\tanalyzer_contexts\t%ld\t0\t0\n", main_input_filename, profile_contexts_created);
+	fprintf(out, "%s\t*\tvisited_peak\t%zu\t0\t0\n", main_input_filename, visited_peak);
+	fflush(out);
+}
+
+#endif
@@ -3,12 +3,16 @@
 
 #include "debugger_common.h"
 #include "analyzer_context.h"
+#include "plugin_options.h"
+#include "plugin_linkage.h"
+
+/**
+ *  the guard is "if (_setjmp(entering_risk()) == 0) goto body; else goto break; body: ... break: exiting_risk();",
+ *  entering_risk returns the jmp_buf of the calling thread, see <debugger_exception_handler.h>.
+ */
 
 tree inject_seg_protector(tree_stmt_iterator& it, analyzer_context* context)
 {
-	tree entering_risk_call = build_call_expr(entering_risk_decl, 0);
-	tsi_link_after(&it, entering_risk_call, TSI_CONTINUE_LINKING);
-
 	tree break_label_decl = build_decl(UNKNOWN_LOCATION, LABEL_DECL, NULL_TREE, void_type_node);
 	DECL_CONTEXT(break_label_decl) = context->context_func_decl;
 	tree break_label_expr = build1(LABEL_EXPR, void_type_node, break_label_decl);
@@ -17,8 +21,10 @@ tree inject_seg_protector(tree_stmt_iterator& it, analyzer_context* context)
 	DECL_CONTEXT(expansion_body_label_decl) = context->context_func_decl;
 	tree expansion_body_label_expr = build1(LABEL_EXPR, void_type_node, expansion_body_label_decl);
 
-	tree addr_of_jmp_buf = build1(ADDR_EXPR, build_pointer_type(integer_type_node), segf_jmp_buf_decl);
-	tree setjmp_expr = build_call_expr(setjmp_decl, 1, addr_of_jmp_buf);
+	tree setjmp_decl = get_setjmp_decl();
+	tree jmp_buf_type = TREE_VALUE(TYPE_ARG_TYPES(TREE_TYPE(setjmp_decl)));
+	tree thread_jmp_buf = fold_convert(jmp_buf_type, build_call_expr(entering_risk_decl, 0));
+	tree setjmp_expr = build_call_expr(setjmp_decl, 1, thread_jmp_buf);
 	tree compare_expr = build2(EQ_EXPR, integer_type_node, setjmp_expr, to_int_cst(0));
 	tree continue_expr = build1(GOTO_EXPR, void_type_node, expansion_body_label_decl);
 	tree break_expr = build1(GOTO_EXPR, void_type_node, break_label_decl);
@@ -37,22 +43,44 @@ void escape_seg_protector(tree_stmt_iterator& it, tree break_label_expr)
 	tsi_link_after(&it, exiting_risk_call, TSI_CONTINUE_LINKING);
 }
 
-static void inject_print_string_literal(tree_stmt_iterator& it, int padding_incr, analyzer_context* context, const char* fmt, ...)
+/**
+ *  "injection_padding" is the indentation of the markup being injected.
+ *  a positive "padding_incr" indents the markup after this one, a negative one outdents this one.
+ */
+
+static int injection_padding = 0;
+
+static std::string padded_literal_v(int& padding, int padding_incr, const char* fmt, va_list args)
 {
 	char buff[1024];
 
-	static int current_padding = 0;
-
-	if (padding_incr < 0) current_padding += padding_incr;
+	if (padding_incr < 0) padding += padding_incr;
 
-	for (int i = 0; i < current_padding; i++)
+	for (int i = 0; i < padding; i++)
     {
     	buff[i] = ' ';
     }
 
+    vsprintf(buff + padding, fmt, args);
+
+	if (padding_incr > 0) padding += padding_incr;
+	return buff;
+}
+
+static std::string padded_literal(int& padding, int padding_incr, const char* fmt, ...)
+{
 	va_list myargs;
     va_start(myargs, fmt);
-    vsprintf(buff + current_padding, fmt, myargs);
+    std::string literal = padded_literal_v(padding, padding_incr, fmt, myargs);
+    va_end(myargs);
+    return literal;
+}
+
+static void inject_print_string_literal(tree_stmt_iterator& it, int padding_incr, analyzer_context* context, const char* fmt, ...)
+{
+	va_list myargs;
+    va_start(myargs, fmt);
+    std::string literal = padded_literal_v(injection_padding, padding_incr, fmt, myargs);
     va_end(myargs);
 
 	tsi_link_after(
@@ -60,10 +88,8 @@ static void inject_print_string_literal(tree_stmt_iterator& it, int padding_incr
         build_call_expr(
         	get_string_literal_print(),
         	1,
-            to_str_cst(buff)),
+            to_str_cst(literal.c_str())),
         TSI_CONTINUE_LINKING);
-
-	if (padding_incr > 0) current_padding += padding_incr;
 }
 
 #define IN_DISPLAY(fmt, ...) inject_print_string_literal(it, 4, context, fmt, ##__VA_ARGS__)
@@ -183,6 +209,64 @@ static void build_for_loop(tree_stmt_iterator& it, analyzer_context* context, tr
         TSI_CONTINUE_LINKING);
 }
 
+/**
+ *  injects "debugger_check_readable(pointer, sizeof(*pointer))" before a dereference,
+ *  which leaves the enclosing guard without a segfault when the pointer is not readable, see <debugger_address_map.h>.
+ */
+
+static void inject_readable_check(tree_stmt_iterator& it, tree pointer)
+{
+	tree check_decl = get_debugger_runtime_decl("check_readable");
+	if (check_decl == NULL_TREE) return;
+	tree param_types = TYPE_ARG_TYPES(TREE_TYPE(check_decl));
+	tree pointee_size = TYPE_SIZE_UNIT(TREE_TYPE(TREE_TYPE(pointer)));
+	if (pointee_size == NULL_TREE || TREE_CODE(pointee_size) != INTEGER_CST) pointee_size = size_one_node;
+	tsi_link_after(
+		&it,
+		build_call_expr(
+			check_decl,
+			2,
+			fold_convert(TREE_VALUE(param_types), pointer),
+			fold_convert(TREE_VALUE(TREE_CHAIN(param_types)), pointee_size)),
+		TSI_CONTINUE_LINKING);
+}
+
+/**
+ *  the scalar elements from "first_element" on are printed by a single call to "debugger_print_items" of <debugger.h>,
+ *  which checks the whole range once, rather than by a loop guarding and printing every element.
+ *  returns false if the elements are not scalars, which are then expanded one by one.
+ */
+
+static bool is_bulk_scalar_type(tree type)
+{
+	base_type kind = get_base_type_from_type_tree(type);
+	return kind != ERR_BASE_TYPE && kind <= REAL_DOUBLE;
+}
+
+static bool inject_print_on_items(tree_stmt_iterator& it, tree first_element, tree count)
+{
+	tree element_type = TREE_TYPE(first_element);
+	tree print_items_decl = get_debugger_runtime_decl("print_items");
+	if (print_items_decl == NULL_TREE || !is_bulk_scalar_type(element_type)) return false;
+	tree param_types = TYPE_ARG_TYPES(TREE_TYPE(print_items_decl));
+	tree kind_type = TREE_VALUE(param_types);
+	tree first_type = TREE_VALUE(TREE_CHAIN(param_types));
+	tree count_type = TREE_VALUE(TREE_CHAIN(TREE_CHAIN(param_types)));
+	tree padding_type = TREE_VALUE(TREE_CHAIN(TREE_CHAIN(TREE_CHAIN(TREE_CHAIN(param_types)))));
+	tsi_link_after(
+		&it,
+		build_call_expr(
+			print_items_decl,
+			5,
+			build_int_cst(kind_type, get_base_type_from_type_tree(element_type)),
+			fold_convert(first_type, build_address_of(first_element)),
+			fold_convert(count_type, count),
+			fold_convert(count_type, TYPE_SIZE_UNIT(element_type)),
+			build_int_cst(padding_type, injection_padding)),
+		TSI_CONTINUE_LINKING);
+	return true;
+}
+
 static void build_ptr_ref(tree_stmt_iterator& it, analyzer_context* context, tree ptr, tree index)
 {
 	tree type_size = TYPE_SIZE(TREE_TYPE(TREE_TYPE(ptr)));  // Double TREE_TYPE: the first one gets POINTER_TYPE, the second one get the TYPE be pointed to
@@ -191,13 +275,60 @@ static void build_ptr_ref(tree_stmt_iterator& it, analyzer_context* context, tre
 	tree pointer_index = build2(MULT_EXPR, long_unsigned_type_node, build1(NOP_EXPR, long_unsigned_type_node, index), to_ptr_off_cst(size_byte));
 	tree pointer_plus = build2(POINTER_PLUS_EXPR, TREE_TYPE(ptr), build1(NOP_EXPR, TREE_TYPE(ptr), ptr), pointer_index);
 	tree element_on_index = build1(INDIRECT_REF, TREE_TYPE(TREE_TYPE(ptr)), pointer_plus);
+	inject_readable_check(it, pointer_plus);
 	inject_print_on_generic(it, context, element_on_index);
 }
 
-static void inject_print_on_pointer(tree_stmt_iterator& it, analyzer_context* context, tree pointer_type_expr)
+static void inject_print_on_dereference(tree_stmt_iterator& it, analyzer_context* context, tree pointer_type_expr)
+{
+	// The first TREE_TYPE results in a POINTER_TYPE, thus append a second TREE_TYPE to get the type that the pointer points to 
+	tree after_dereference = build1(INDIRECT_REF, TREE_TYPE(TREE_TYPE(pointer_type_expr)), pointer_type_expr);
+	IN_DISPLAY("<dereference>\n");
+	inject_readable_check(it, pointer_type_expr);
+	inject_print_on_generic(it, context, after_dereference);
+	OUT_DISPLAY("</dereference>\n");
+}
+
+/**
+ *  with -fplugin-arg-<plugin>-heap-bounds=on a pointer to scalars that starts a heap block is printed as the block,
+ *  "if ((n = debugger_heap_items(p, sizeof(*p))) > 0) items; else dereference;", see <debugger_heap.h>.
+ *  strings are still printed as such.
+ */
+
+static tree heap_items_decl_for(tree pointer_type)
+{
+	if (!plugin_option_is("heap-bounds", "on", "off") || is_char_pointer_like(pointer_type)) return NULL_TREE;
+	if (!is_bulk_scalar_type(TREE_TYPE(pointer_type)) || get_debugger_runtime_decl("print_items") == NULL_TREE) return NULL_TREE;
+	return get_debugger_runtime_decl("heap_items");
+}
+
+static void inject_print_on_heap_block(tree_stmt_iterator& it, analyzer_context* context, tree pointer_type_expr,
+	tree heap_items_decl)
+{
+	tree element_type = TREE_TYPE(TREE_TYPE(pointer_type_expr));
+	tree param_types = TYPE_ARG_TYPES(TREE_TYPE(heap_items_decl));
+	tree pointer = save_expr(pointer_type_expr);
+	tree count = save_expr(build_call_expr(heap_items_decl, 2,
+		fold_convert(TREE_VALUE(param_types), pointer),
+		fold_convert(TREE_VALUE(TREE_CHAIN(param_types)), TYPE_SIZE_UNIT(element_type))));
+	tree has_items = build2(GT_EXPR, boolean_type_node, count, build_int_cst(TREE_TYPE(count), 0));
+
+	tree items_list = alloc_stmt_list();
+	tree_stmt_iterator items_it = tsi_start(items_list);
+	inject_print_on_items(items_it, build1(INDIRECT_REF, element_type, pointer), count);
+	tree dereference_list = alloc_stmt_list();
+	tree_stmt_iterator dereference_it = tsi_start(dereference_list);
+	inject_print_on_dereference(dereference_it, context, pointer);
+	tsi_link_after(&it, build3(COND_EXPR, void_type_node, has_items, items_list, dereference_list), TSI_CONTINUE_LINKING);
+}
+
+/**
+ *  "option" gives the range of the pointer, if any.
+ */
+
+static void inject_print_on_pointer_in(tree_stmt_iterator& it, analyzer_context* context, tree pointer_type_expr,
+	const print_option& option)
 {
-	print_option option = print_option();
-	retrieve_print_option(pointer_type_expr, option);
 	IN_DISPLAY("<pointer>\n");
 	PADDING_DISPLAY();
 	tree break_label_expr = inject_seg_protector(it, context);
@@ -212,22 +343,37 @@ static void inject_print_on_pointer(tree_stmt_iterator& it, analyzer_context* co
 	// printf("Print_option: %d %p %p\n", option.has_range, option.range_start, option.range_end);
 	if (option.has_range)
 	{
-		tree end_index = build2(MINUS_EXPR, integer_type_node, option.range_end, to_int_cst(1)); // for loop uses LE (<=)
-		build_for_loop(it, context, option.range_start, end_index, pointer_type_expr, build_ptr_ref);
+		// the bounds are evaluated once per capture, they may be expressions over other vars
+		tree start = save_expr(fold_convert(long_integer_type_node, option.range_start));
+		tree end = save_expr(fold_convert(long_integer_type_node, option.range_end));
+		tree element_type = TREE_TYPE(TREE_TYPE(pointer_type_expr));
+		tree first = build2(POINTER_PLUS_EXPR, TREE_TYPE(pointer_type_expr), pointer_type_expr,
+			size_binop(MULT_EXPR, fold_convert(sizetype, start), TYPE_SIZE_UNIT(element_type)));
+		tree count = build2(MINUS_EXPR, long_integer_type_node, end, start);
+		if (!inject_print_on_items(it, build1(INDIRECT_REF, element_type, first), count))
+		{
+			tree end_index = build2(MINUS_EXPR, integer_type_node, fold_convert(integer_type_node, end), to_int_cst(1)); // for loop uses LE (<=)
+			build_for_loop(it, context, fold_convert(integer_type_node, start), end_index, pointer_type_expr, build_ptr_ref);
+		}
 		escape_seg_protector(it, break_label_expr);
 		OUT_DISPLAY("</pointer>\n");
 		return;
 	}
-	
-	// The first TREE_TYPE results in a POINTER_TYPE, thus append a second TREE_TYPE to get the type that the pointer points to 
-	tree after_dereference = build1(INDIRECT_REF, TREE_TYPE(TREE_TYPE(pointer_type_expr)), pointer_type_expr);
-	IN_DISPLAY("<dereference>\n");
-	inject_print_on_generic(it, context, after_dereference);
-	OUT_DISPLAY("</dereference>\n");
+
+	tree heap_items_decl = heap_items_decl_for(TREE_TYPE(pointer_type_expr));
+	if (heap_items_decl != NULL_TREE) inject_print_on_heap_block(it, context, pointer_type_expr, heap_items_decl);
+	else inject_print_on_dereference(it, context, pointer_type_expr);
 	escape_seg_protector(it, break_label_expr);
 	OUT_DISPLAY("</pointer>\n");
 }
 
+static void inject_print_on_pointer(tree_stmt_iterator& it, analyzer_context* context, tree pointer_type_expr)
+{
+	print_option option = print_option();
+	retrieve_print_option(pointer_type_expr, option);
+	inject_print_on_pointer_in(it, context, pointer_type_expr, option);
+}
+
 long int get_array_lower_bound(tree array_type)
 {
     return TREE_INT_CST_LOW(TYPE_MIN_VALUE(TYPE_DOMAIN(array_type)));
@@ -251,10 +397,15 @@ static void inject_print_on_array(tree_stmt_iterator& it, analyzer_context* cont
 		inject_print_on_generic(it, context, convert_to_char_pointer(array_type_expr));
 		return;
 	}
-	tree lb = to_int_cst(get_array_lower_bound(TREE_TYPE(array_type_expr)));
-    tree ub = to_int_cst(get_array_upper_bound(TREE_TYPE(array_type_expr)));
+	long lb = get_array_lower_bound(TREE_TYPE(array_type_expr));
+	long ub = get_array_upper_bound(TREE_TYPE(array_type_expr));
+	tree element_type = TREE_TYPE(TREE_TYPE(array_type_expr));
+	tree first = build4(ARRAY_REF, element_type, array_type_expr, to_int_cst(lb), NULL_TREE, NULL_TREE);
     IN_DISPLAY("<array>\n");
-    build_for_loop(it, context, lb, ub, array_type_expr, build_array_ref);
+	if (!inject_print_on_items(it, first, build_int_cst(long_integer_type_node, ub - lb + 1)))
+	{
+		build_for_loop(it, context, to_int_cst(lb), to_int_cst(ub), array_type_expr, build_array_ref);
+	}
     OUT_DISPLAY("</array>\n");
 }
 
@@ -325,8 +476,144 @@ static void inject_print_context(tree_stmt_iterator& it, analyzer_context* conte
         TSI_CONTINUE_LINKING);
 }
 
+/**
+ *  the expansion of a var that is not of a base type is outlined into a printer,
+ *  "static void __debugger_printer_<n>(T* value)" expanding "*value", which every site of the unit calls
+ *  for vars of the same type at the same padding. the printer is synthesized once, when a site first needs it,
+ *  and compiled with the rest of the unit, as a COMDAT named after the hash of the type (see <plugin_linkage.h>).
+ *  vars with a range, register vars and vars of variable size are expanded inline,
+ *  as is everything with -fplugin-arg-<plugin>-printers=inline.
+ *  a "range printer", "static void __debugger_printer_<n>(T** value, long start, long end)", prints the pointer "*value"
+ *  as a track_range var of bounds [start, end) would be, for the ssa pass (see <ssa_injector.h>).
+ */
+
+static std::map<std::pair<tree, int>, tree> outlined_printers;
+static std::map<std::pair<tree, int>, tree> outlined_range_printers;
+static int outlined_printer_count = 0;
+
+static tree build_printer_parm(tree printer_decl, const char* name, tree type)
+{
+	tree parm_decl = build_decl(UNKNOWN_LOCATION, PARM_DECL, get_identifier(name), type);
+	DECL_ARG_TYPE(parm_decl) = type;
+	DECL_CONTEXT(parm_decl) = printer_decl;
+	TREE_USED(parm_decl) = 1;
+	return parm_decl;
+}
+
+static tree build_outlined_printer(tree type, int padding, bool ranged)
+{
+	std::string shared_name = shared_definition_name(ranged ? "range_printer" : "printer", type, padding);
+	tree shared_decl = find_shared_definition(shared_name);
+	if (shared_decl != NULL_TREE) return shared_decl;
+
+	char name[64];
+	sprintf(name, "__debugger_printer_%d", outlined_printer_count++);
+	tree pointer_type = build_pointer_type(type);
+	tree printer_type = ranged
+		? build_function_type_list(void_type_node, pointer_type, long_integer_type_node, long_integer_type_node, NULL_TREE)
+		: build_function_type_list(void_type_node, pointer_type, NULL_TREE);
+	tree printer_decl = build_decl(UNKNOWN_LOCATION, FUNCTION_DECL, get_identifier(name), printer_type);
+	TREE_STATIC(printer_decl) = 1;
+	TREE_USED(printer_decl) = 1;
+	DECL_ARTIFICIAL(printer_decl) = 1;
+	DECL_IGNORED_P(printer_decl) = 1;
+	DECL_UNINLINABLE(printer_decl) = 1; // the point is to have a single copy
+
+	tree result_decl = build_decl(UNKNOWN_LOCATION, RESULT_DECL, NULL_TREE, void_type_node);
+	DECL_ARTIFICIAL(result_decl) = 1;
+	DECL_CONTEXT(result_decl) = printer_decl;
+	DECL_RESULT(printer_decl) = result_decl;
+
+	tree value_decl = build_printer_parm(printer_decl, "value", pointer_type);
+	DECL_ARGUMENTS(printer_decl) = value_decl;
+	print_option option = print_option();
+	if (ranged)
+	{
+		option.has_range = true;
+		option.range_start = build_printer_parm(printer_decl, "start", long_integer_type_node);
+		option.range_end = build_printer_parm(printer_decl, "end", long_integer_type_node);
+		DECL_CHAIN(value_decl) = option.range_start;
+		DECL_CHAIN(option.range_start) = option.range_end;
+	}
+
+	tree body = alloc_stmt_list();
+	tree_stmt_iterator it = tsi_start(body);
+	analyzer_context context(printer_decl);
+	int site_padding = injection_padding;
+	injection_padding = padding;
+	tree value = build1(INDIRECT_REF, type, value_decl);
+	if (ranged) inject_print_on_pointer_in(it, &context, value, option); // which guards itself as the generic injection
+	else inject_print_on_generic(it, &context, value);
+	injection_padding = site_padding;
+
+	tree block = make_node(BLOCK);
+	BLOCK_SUPERCONTEXT(block) = printer_decl;
+	TREE_USED(block) = 1;
+	DECL_INITIAL(printer_decl) = block;
+	DECL_SAVED_TREE(printer_decl) = build3(BIND_EXPR, void_type_node, NULL_TREE, body, block);
+
+	// called while the front end finishes a function, where cfun is already NULL
+	allocate_struct_function(printer_decl, false);
+	set_cfun(NULL);
+	if (!shared_name.empty()) share_generated_definition(printer_decl, shared_name);
+	cgraph_node::finalize_function(printer_decl, true);
+	return printer_decl;
+}
+
+/**
+ *  "build" is false once functions can no longer be added to the unit, only printers built before are found then.
+ */
+
+static tree outlined_printer_of_type(tree type, bool ranged, bool build)
+{
+	std::map<std::pair<tree, int>, tree>& printers = ranged ? outlined_range_printers : outlined_printers;
+	std::pair<tree, int> key(TYPE_MAIN_VARIANT(type), injection_padding);
+	auto found = printers.find(key);
+	if (found != printers.end()) return found->second;
+	if (!build) return NULL_TREE;
+	return printers[key] = build_outlined_printer(key.first, injection_padding, ranged);
+}
+
+static tree outlined_printer_of(tree var_decl, bool build = true)
+{
+	tree type = TREE_TYPE(var_decl);
+	if (is_base_type(type) || DECL_REGISTER(get_base_address(var_decl)) || variably_modified_type_p(type, NULL_TREE)
+		|| plugin_option_is("printers", "inline", "outlined")) return NULL_TREE;
+	print_option option = print_option();
+	if (DECL_P(var_decl)) retrieve_print_option(var_decl, option);
+	if (option.has_range) return NULL_TREE;
+	return outlined_printer_of_type(type, false, build);
+}
+
+static void inject_print_on_var(tree_stmt_iterator& it, analyzer_context* context, tree var_decl)
+{
+	std::string name = tracked_name(var_decl);
+	IN_DISPLAY("<IDENTIFIER_%s>\n", name.c_str());
+
+	tree break_label_expr = inject_seg_protector(it, context);
+
+	gcc_assert(is_tracked_var(var_decl));
+	tree printer_decl = outlined_printer_of(var_decl);
+	if (printer_decl != NULL_TREE)
+	{
+		tree value_type = TREE_VALUE(TYPE_ARG_TYPES(TREE_TYPE(printer_decl)));
+		tsi_link_after(&it, build_call_expr(printer_decl, 1, fold_convert(value_type, build_address_of(var_decl))),
+			TSI_CONTINUE_LINKING);
+	}
+	else
+	{
+		context->clear_expanded(); // every var is expanded from scratch, as its outlined printer would be
+		inject_print_on_generic(it, context, var_decl);
+	}
+
+	escape_seg_protector(it, break_label_expr);
+
+	OUT_DISPLAY("</IDENTIFIER_%s>\n", name.c_str());
+}
+
 void inject_print(tree_stmt_iterator& it, analyzer_context* context, std::deque<tree> vars_to_track)
 {
+	profile_scope scope(PROFILE_INJECT_PRINT);
 	context->clear_expanded();
 	if (vars_to_track.size() == 0) return;
 
@@ -339,19 +626,10 @@ void inject_print(tree_stmt_iterator& it, analyzer_context* context, std::deque<
 	NEWLINE_DISPLAY();
 	for (tree var_decl: vars_to_track)
 	{
-		IN_DISPLAY("<IDENTIFIER_%s>\n", IDENTIFIER_POINTER(DECL_NAME(var_decl)));
-
-		tree break_label_expr = inject_seg_protector(it, context);
-
-		gcc_assert(TREE_CODE(var_decl) == VAR_DECL || TREE_CODE(var_decl) == PARM_DECL);
-		inject_print_on_generic(it, context, var_decl);
-
-		escape_seg_protector(it, break_label_expr);
-
-		OUT_DISPLAY("</IDENTIFIER_%s>\n", IDENTIFIER_POINTER(DECL_NAME(var_decl)));
+		inject_print_on_var(it, context, var_decl);
 	}
 	OUT_DISPLAY("</vars_info>\n");
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,765 @@
+#ifndef SNAPSHOT_BUILDER_H
+#define SNAPSHOT_BUILDER_H
+
+#include "debugger_common.h"
+#include "attribute_handler.h"
+#include "print_injector.h"
+#include "plugin_options.h"
+
+/**
+ *  a "snapshot program" is the static form of what the injectors in "print_injector.h" expand inline.
+ *  the markup and the layout of the tracked variables are emitted once as data (see "debugger_snapshot.h"),
+ *  so that a site only costs a single call to "debugger_snapshot" with the addresses of its variables.
+ *  a variable whose type reaches a tracker is still expanded inline, as the tracker has to be called by the injected code.
+ */
+
+struct snapshot_op
+{
+	snapshot_op_code code;
+	base_type kind;
+	unsigned int jump;
+	long offset;
+	long count;
+	long stride;
+	std::string text;
+	tree schema;
+};
+
+struct snapshot_program
+{
+	std::vector<snapshot_op> ops;
+
+	/**
+	 *  "expanded" has the same role as in analyzer_context, but lives as long as one schema is built.
+	 */
+
+	std::unordered_set<tree> expanded;
+	int padding;
+	bool fusable = true;
+	bool text_barrier = false;
+public:
+	snapshot_program(int padding)
+	{
+		this->padding = padding;
+	}
+	unsigned int emit(snapshot_op_code code, base_type kind = ERR_BASE_TYPE, long offset = 0, long count = 0, long stride = 0)
+	{
+		snapshot_op op = snapshot_op();
+		op.code = code;
+		op.kind = kind;
+		op.offset = offset;
+		op.count = count;
+		op.stride = stride;
+		op.schema = NULL_TREE;
+		ops.push_back(op);
+		text_barrier = false;
+		return ops.size() - 1;
+	}
+	void text(int padding_incr, const char* fmt, ...)
+	{
+		va_list myargs;
+		va_start(myargs, fmt);
+		std::string literal = padded_literal_v(padding, padding_incr, fmt, myargs);
+		va_end(myargs);
+		if (!text_barrier && !ops.empty() && ops.back().code == OP_TEXT)
+		{
+			ops.back().text += literal;
+			return;
+		}
+		emit(OP_TEXT);
+		ops.back().text = literal;
+	}
+	void close(unsigned int open_at, snapshot_op_code end_code)
+	{
+		emit(end_code);
+		ops[open_at].jump = ops.size();
+	}
+	unsigned int split()
+	{
+		text_barrier = true;
+		return ops.size();
+	}
+};
+
+/**
+ *  a "schema builder" is the counterpart of an injector, it appends the operations printing a value of the type at "offset".
+ */
+
+typedef void (*schema_builder)(snapshot_program& program, tree type, long offset);
+
+static schema_builder schema_builder_from_tree_type(tree type);
+
+static void build_schema_on_generic(snapshot_program& program, tree type, long offset)
+{
+	schema_builder builder = schema_builder_from_tree_type(type);
+	if (builder == NULL)
+	{
+		debugger_err_printf("NULL schema builder encountered for tree_type < %s >.\n", get_tree_code_name(TREE_CODE(type)));
+		return;
+	}
+	builder(program, type, offset);
+}
+
+static void build_schema_on_base_type(snapshot_program& program, tree type, long offset)
+{
+	program.text(0, "");
+	program.emit(OP_VALUE, get_base_type_from_type_tree(type), offset);
+	program.text(0, "\n");
+}
+
+static void build_schema_on_pointer(snapshot_program& program, tree type, long offset)
+{
+	program.text(4, "<pointer>\n");
+	program.text(0, "");
+	unsigned int pointer_guard = program.emit(OP_GUARD);
+	program.emit(OP_VALUE, get_base_type_from_type_tree(type), offset);
+	program.text(0, "\n");
+	unsigned int heap_block = 0;
+	bool heap_bounds = heap_items_decl_for(type) != NULL_TREE; // as "inject_print_on_heap_block" does
+	if (heap_bounds)
+	{
+		long element_size = int_size_in_bytes(TREE_TYPE(type));
+		heap_block = program.emit(OP_HEAP, get_base_type_from_type_tree(TREE_TYPE(type)), offset, program.padding, element_size);
+	}
+	program.text(4, "<dereference>\n");
+	unsigned int dereference_guard = program.emit(OP_GUARD);
+	tree pointee_size = TYPE_SIZE_UNIT(TREE_TYPE(type));
+	long count = pointee_size != NULL_TREE && TREE_CODE(pointee_size) == INTEGER_CST ? TREE_INT_CST_LOW(pointee_size) : 1;
+	unsigned int dereference = program.emit(OP_DEREF, ERR_BASE_TYPE, offset, count);
+	build_schema_on_generic(program, TREE_TYPE(type), 0);
+	program.close(dereference, OP_LEAVE);
+	program.close(dereference_guard, OP_END_GUARD);
+	program.text(-4, "</dereference>\n");
+	if (heap_bounds) program.ops[heap_block].jump = program.split();
+	program.close(pointer_guard, OP_END_GUARD);
+	program.text(-4, "</pointer>\n");
+}
+
+static bool get_constant_array_bounds(tree array_type, long& lb, long& ub)
+{
+	tree domain = TYPE_DOMAIN(array_type);
+	if (domain == NULL_TREE) return false;
+	tree min_value = TYPE_MIN_VALUE(domain);
+	tree max_value = TYPE_MAX_VALUE(domain);
+	if (min_value == NULL_TREE || max_value == NULL_TREE) return false;
+	if (TREE_CODE(min_value) != INTEGER_CST || TREE_CODE(max_value) != INTEGER_CST) return false;
+	lb = TREE_INT_CST_LOW(min_value);
+	ub = TREE_INT_CST_LOW(max_value);
+	return true;
+}
+
+static void build_schema_on_array(snapshot_program& program, tree type, long offset)
+{
+	long lb, ub;
+	bool bounded = get_constant_array_bounds(type, lb, ub);
+	tree element_type = TREE_TYPE(type);
+	if (is_char_pointer_like(type)) // is array of char, printed as a string like inject_print_on_array does
+	{
+		program.text(4, "<pointer>\n");
+		program.text(0, "");
+		unsigned int guard = program.emit(OP_GUARD);
+		program.emit(OP_CHARS, CHAR_POINTER, offset, bounded ? ub - lb + 1 : LONG_MAX);
+		program.text(0, "\n");
+		program.text(4, "<dereference>\n");
+		build_schema_on_base_type(program, element_type, offset);
+		program.text(-4, "</dereference>\n");
+		program.close(guard, OP_END_GUARD);
+		program.text(-4, "</pointer>\n");
+		return;
+	}
+	long element_size = int_size_in_bytes(element_type);
+	if (!bounded || element_size < 0)
+	{
+		program.fusable = false;
+		return;
+	}
+	program.text(4, "<array>\n");
+	if (is_bulk_scalar_type(element_type)) // printed at once, as "inject_print_on_items" does
+	{
+		unsigned int items = program.emit(OP_ITEMS, get_base_type_from_type_tree(element_type), offset, ub - lb + 1, element_size);
+		program.ops[items].jump = program.padding;
+		program.text(-4, "</array>\n");
+		return;
+	}
+	unsigned int loop = program.emit(OP_LOOP, ERR_BASE_TYPE, offset, ub - lb + 1, element_size);
+	program.text(4, "<item>\n");
+	build_schema_on_generic(program, element_type, 0);
+	program.text(-4, "</item>\n");
+	program.close(loop, OP_END_LOOP);
+	program.text(-4, "</array>\n");
+}
+
+static void build_schema_on_record(snapshot_program& program, tree type, long offset)
+{
+	if (retrieve_print_function(type) != NULL_TREE)
+	{
+		program.fusable = false;
+		return;
+	}
+	if (program.expanded.count(type) > 0)
+	{
+		program.text(0, "<__RECURSION__/>\n");
+		return;
+	}
+	program.expanded.emplace(type);
+	for (tree element = TYPE_FIELDS(type); element != NULL_TREE; element = TREE_CHAIN(element))
+	{
+		if (TREE_CODE(element) != FIELD_DECL) continue;
+		if (DECL_NAME(element) == NULL_TREE || DECL_BIT_FIELD(element))
+		{
+			program.fusable = false;
+			return;
+		}
+		long field_offset = offset + int_byte_position(element);
+		unsigned int field = program.emit(OP_FIELD, ERR_BASE_TYPE, field_offset, int_size_in_bytes(TREE_TYPE(element)));
+		program.text(4, "<FIELD_%s>\n", IDENTIFIER_POINTER(DECL_NAME(element)));
+		build_schema_on_generic(program, TREE_TYPE(element), field_offset);
+		program.text(-4, "</FIELD_%s>\n", IDENTIFIER_POINTER(DECL_NAME(element)));
+		program.ops[field].jump = program.split();
+	}
+}
+
+static schema_builder schema_builder_from_tree_type(tree type)
+{
+	switch (TREE_CODE(type))
+	{
+		case POINTER_TYPE:
+			return build_schema_on_pointer;
+		case ARRAY_TYPE:
+			return build_schema_on_array;
+		case RECORD_TYPE:
+			return build_schema_on_record;
+		default:
+			break;
+	}
+	if (is_base_type(type)) return build_schema_on_base_type;
+	return NULL;
+}
+
+/**
+ *  the types of <debugger_snapshot.h> are found through the parameters of "debugger_snapshot".
+ */
+
+static tree find_field(tree record_type, const char* name)
+{
+	for (tree field = TYPE_FIELDS(record_type); field != NULL_TREE; field = TREE_CHAIN(field))
+	{
+		if (TREE_CODE(field) == FIELD_DECL && DECL_NAME(field) != NULL_TREE
+			&& strcmp(IDENTIFIER_POINTER(DECL_NAME(field)), name) == 0) return field;
+	}
+	debugger_err_printf("field < %s > is missing in the runtime.\n", name);
+	gcc_unreachable();
+}
+
+static tree pointed_record_type(tree pointer_type)
+{
+	return TYPE_MAIN_VARIANT(TREE_TYPE(pointer_type));
+}
+
+static tree snapshot_site_type()
+{
+	tree snapshot_decl = get_debugger_runtime_decl("snapshot");
+	return pointed_record_type(TREE_VALUE(TYPE_ARG_TYPES(TREE_TYPE(snapshot_decl))));
+}
+
+static tree snapshot_op_type()
+{
+	return pointed_record_type(TREE_TYPE(find_field(snapshot_site_type(), "ops")));
+}
+
+static tree snapshot_schema_type()
+{
+	return pointed_record_type(TREE_TYPE(find_field(snapshot_op_type(), "schema")));
+}
+
+/**
+ *  "static_initializer" builds the CONSTRUCTOR of a runtime struct, fields must be set in the order they are declared.
+ */
+
+struct static_initializer
+{
+	tree type;
+	vec<constructor_elt, va_gc>* elements = NULL;
+public:
+	static_initializer(tree type)
+	{
+		this->type = type;
+	}
+	static_initializer& set(const char* field_name, tree value)
+	{
+		tree field = find_field(type, field_name);
+		CONSTRUCTOR_APPEND_ELT(elements, field, fold_convert(TREE_TYPE(field), value));
+		return *this;
+	}
+	static_initializer& set_int(const char* field_name, long value)
+	{
+		return set(field_name, build_int_cst(TREE_TYPE(find_field(type, field_name)), value));
+	}
+	tree build()
+	{
+		tree constructor = build_constructor(type, elements);
+		TREE_CONSTANT(constructor) = 1;
+		TREE_STATIC(constructor) = 1;
+		return constructor;
+	}
+};
+
+static int snapshot_data_count = 0;
+
+/**
+ *  data given a "section" is writable by the runtime and kept even if nothing refers to it.
+ */
+
+static tree build_data_decl(const char* name, tree type, tree initializer, const char* section, const std::string& shared_name)
+{
+	tree decl = build_decl(UNKNOWN_LOCATION, VAR_DECL, get_identifier(name), type);
+	TREE_STATIC(decl) = 1;
+	TREE_READONLY(decl) = section == NULL;
+	TREE_USED(decl) = 1;
+	DECL_ARTIFICIAL(decl) = 1;
+	DECL_IGNORED_P(decl) = 1;
+	DECL_INITIAL(decl) = initializer;
+	if (section != NULL)
+	{
+		set_decl_section_name(decl, section);
+		DECL_PRESERVE_P(decl) = 1;
+	}
+	if (!shared_name.empty()) share_generated_definition(decl, shared_name);
+	varpool_node::finalize_decl(decl);
+	return decl;
+}
+
+static tree build_snapshot_data(const char* prefix, tree type, tree initializer, const char* section = NULL)
+{
+	char name[64];
+	sprintf(name, "__debugger_%s_%d", prefix, snapshot_data_count++);
+	return build_data_decl(name, type, initializer, section, "");
+}
+
+/**
+ *  data generated for a type alone is shared by all the units, see <plugin_linkage.h>.
+ */
+
+static tree build_shared_data(const std::string& shared_name, const char* prefix, tree type, tree initializer)
+{
+	if (shared_name.empty()) return build_snapshot_data(prefix, type, initializer);
+	tree shared_decl = find_shared_definition(shared_name);
+	if (shared_decl != NULL_TREE) return shared_decl;
+	return build_data_decl(shared_name.c_str(), type, initializer, NULL, shared_name);
+}
+
+static tree build_snapshot_ops(snapshot_program& program, const std::string& shared_name = "")
+{
+	tree op_type = snapshot_op_type();
+	vec<constructor_elt, va_gc>* elements = NULL;
+	for (size_t i = 0; i < program.ops.size(); i++)
+	{
+		snapshot_op& op = program.ops[i];
+		static_initializer initializer(op_type);
+		initializer.set_int("code", op.code)
+			.set_int("kind", op.kind)
+			.set_int("jump", op.jump)
+			.set_int("offset", op.offset)
+			.set_int("count", op.count)
+			.set_int("stride", op.stride);
+		if (!op.text.empty()) initializer.set("text", to_str_cst(op.text.c_str()));
+		if (op.schema != NULL_TREE) initializer.set("schema", build_address_of(op.schema));
+		CONSTRUCTOR_APPEND_ELT(elements, size_int(i), initializer.build());
+	}
+	tree array_type = build_array_type_nelts(op_type, program.ops.size());
+	tree constructor = build_constructor(array_type, elements);
+	TREE_CONSTANT(constructor) = 1;
+	TREE_STATIC(constructor) = 1;
+	return build_shared_data(shared_name, "ops", array_type, constructor);
+}
+
+static const char* type_display_name(tree type)
+{
+	tree name = TYPE_NAME(type);
+	if (name != NULL_TREE && TREE_CODE(name) == TYPE_DECL) name = DECL_NAME(name);
+	if (name != NULL_TREE && TREE_CODE(name) == IDENTIFIER_NODE) return IDENTIFIER_POINTER(name);
+	return get_tree_code_name(TREE_CODE(type));
+}
+
+/**
+ *  "snapshot_schemas" caches the schema of a type printed at a padding, NULL_TREE if the type has to be expanded inline.
+ */
+
+static std::map<std::pair<tree, int>, tree> snapshot_schemas;
+
+tree get_snapshot_schema(tree type, int padding)
+{
+	std::pair<tree, int> key(type, padding);
+	auto found = snapshot_schemas.find(key);
+	if (found != snapshot_schemas.end()) return found->second;
+
+	snapshot_program program(padding);
+	build_schema_on_generic(program, type, 0);
+	tree schema = NULL_TREE;
+	if (program.fusable)
+	{
+		std::string shared_name = shared_definition_name("schema", type, padding);
+		tree ops = build_snapshot_ops(program, shared_name.empty() ? "" : shared_name + "_ops");
+		tree schema_type = snapshot_schema_type();
+		tree initializer = static_initializer(schema_type)
+			.set("type_name", to_str_cst(type_display_name(type)))
+			.set_int("size", int_size_in_bytes(type))
+			.set_int("n_ops", program.ops.size())
+			.set("ops", build_address_of(ops))
+			.build();
+		schema = build_shared_data(shared_name, "schema", schema_type, initializer);
+	}
+	snapshot_schemas[key] = schema;
+	return schema;
+}
+
+struct snapshot_var
+{
+	tree decl;
+	tree schema;
+	unsigned int split_at;
+	int padding;
+};
+
+static tree build_snapshot_slots(tree_stmt_iterator& it, analyzer_context* context, std::vector<snapshot_var>& vars, long n_slots)
+{
+	if (n_slots == 0) return NULL_TREE;
+	tree slots_type = build_array_type_nelts(const_ptr_type_node, n_slots);
+	tree slots_decl = build_decl(UNKNOWN_LOCATION, VAR_DECL, get_identifier("__snapshot_slots__"), slots_type);
+	DECL_CONTEXT(slots_decl) = context->context_func_decl;
+	DECL_SEEN_IN_BIND_EXPR_P(slots_decl) = 1; // cheat the gimplfy checker, as build_for_loop does
+	tsi_link_after(&it, build1(DECL_EXPR, slots_type, slots_decl), TSI_CONTINUE_LINKING);
+
+	long slot = 0;
+	for (snapshot_var& var: vars)
+	{
+		if (var.schema == NULL_TREE) continue;
+		tree slot_ref = build4(ARRAY_REF, const_ptr_type_node, slots_decl, to_int_cst(slot++), NULL_TREE, NULL_TREE);
+		tree address = build1(NOP_EXPR, const_ptr_type_node, build_address_of(var.decl));
+		tsi_link_after(&it, build2(MODIFY_EXPR, const_ptr_type_node, slot_ref, address), TSI_CONTINUE_LINKING);
+	}
+	return slots_decl;
+}
+
+/**
+ *  with -fplugin-arg-<plugin>-capture=raw the sites call "debugger_capture" of <debugger_capture.h>,
+ *  which records the raw bytes of the variables for "debugger_decode" instead of printing them.
+ *  with -fplugin-arg-<plugin>-snapshot=delta they call "debugger_delta" of <debugger_delta.h>, which only prints changes.
+ */
+
+static tree snapshot_entry_decl()
+{
+	if (plugin_option_is("capture", "raw", "text")) return get_debugger_runtime_decl("capture");
+	if (plugin_option_is("snapshot", "delta", "fused")) return get_debugger_runtime_decl("delta");
+	return get_debugger_runtime_decl("snapshot");
+}
+
+static void inject_snapshot_call(tree_stmt_iterator& it, tree site_decl, tree slots_decl, unsigned int first_op, unsigned int last_op)
+{
+	if (first_op == last_op) return;
+	tree snapshot_decl = snapshot_entry_decl();
+	tree param_types = TYPE_ARG_TYPES(TREE_TYPE(snapshot_decl));
+	tree site_param_type = TREE_VALUE(param_types);
+	tree slots_param_type = TREE_VALUE(TREE_CHAIN(param_types));
+	tree slots = slots_decl == NULL_TREE ? null_pointer_node : build_address_of(slots_decl);
+	tsi_link_after(
+		&it,
+		build_call_expr(
+			snapshot_decl,
+			4,
+			build1(NOP_EXPR, site_param_type, build_address_of(site_decl)),
+			build1(NOP_EXPR, slots_param_type, slots),
+			build_int_cst(unsigned_type_node, first_op),
+			build_int_cst(unsigned_type_node, last_op)),
+		TSI_CONTINUE_LINKING);
+}
+
+/**
+ *  the switch of a site is a "debugger_site_switch" of <debugger_site_switch.h>, put in the section the runtime reads
+ *  the switches of the whole program from. the injected code of the site becomes
+ *      state = switch.enabled;
+ *      if (state == DEBUGGER_SITE_OFF
+ *          || (__builtin_expect(state == DEBUGGER_SITE_SAMPLED, 0) && debugger_site_admit(&switch) == 0)) goto skip;
+ *      ...
+ *      if (__builtin_expect(state == DEBUGGER_SITE_SAMPLED, 0)) debugger_site_done(&switch);
+ *      skip:
+ *  the state is loaded once, so a disabled site costs one load and one branch.
+ *  -fplugin-arg-<plugin>-sample=<policy> makes every site sampled, see "debugger_parse_sampling".
+ *  -fplugin-arg-<plugin>-site-switch=off leaves the sites unconditional.
+ */
+
+struct site_switch
+{
+	tree decl;
+	tree state_decl;
+	tree skip_label_expr;
+};
+
+static tree site_switch_type()
+{
+	tree set_site_decl = get_debugger_runtime_decl("site_switch");
+	return pointed_record_type(TREE_VALUE(TYPE_ARG_TYPES(TREE_TYPE(set_site_decl))));
+}
+
+static tree build_site_switch(analyzer_context* context)
+{
+	unsigned int policy = SAMPLE_ALWAYS;
+	unsigned long parameter = 0, burst = 0;
+	const char* sampling = get_plugin_option("sample", NULL);
+	if (sampling != NULL && !debugger_parse_sampling(sampling, &policy, &parameter, &burst))
+	{
+		debugger_err_printf("sampling policy < %s > is not understood.\n", sampling);
+	}
+	tree switch_type = site_switch_type();
+	return build_snapshot_data("switch", switch_type,
+		static_initializer(switch_type)
+			.set_int("enabled", policy == SAMPLE_ALWAYS ? DEBUGGER_SITE_ON : DEBUGGER_SITE_SAMPLED)
+			.set_int("policy", policy)
+			.set_int("line_no", context->line_no)
+			.set("file_name", build_string_literal_of_source_file_path(context->file_name))
+			.set_int("parameter", parameter)
+			.set_int("burst", burst)
+			.build(),
+		TARGET_MACHO ? "__DATA,__debugger_sites" : "debugger_sites");
+}
+
+/**
+ *  the state is loaded anew at every pass, as other threads flip it.
+ */
+
+static tree build_site_state(tree switch_decl)
+{
+	tree enabled_field = find_field(TREE_TYPE(switch_decl), "enabled");
+	tree enabled = build3(COMPONENT_REF, TREE_TYPE(enabled_field), switch_decl, enabled_field, NULL_TREE);
+	TREE_THIS_VOLATILE(enabled) = 1;
+	TREE_SIDE_EFFECTS(enabled) = 1;
+	return enabled;
+}
+
+static tree build_site_state_is(tree state_decl, debugger_site_state state)
+{
+	return build2(EQ_EXPR, integer_type_node, state_decl, build_int_cst(TREE_TYPE(state_decl), state));
+}
+
+static tree build_unlikely(tree condition)
+{
+	tree expected = build_call_expr(builtin_decl_explicit(BUILT_IN_EXPECT), 2,
+		fold_convert(long_integer_type_node, condition), build_int_cst(long_integer_type_node, 0));
+	return build2(NE_EXPR, integer_type_node, expected, build_int_cst(long_integer_type_node, 0));
+}
+
+static tree build_if(tree condition, tree then_expr)
+{
+	return build3(COND_EXPR, void_type_node, condition, then_expr, build_empty_stmt(UNKNOWN_LOCATION));
+}
+
+static bool site_switch_enabled()
+{
+	return get_debugger_runtime_decl("site_switch") != NULL_TREE && !plugin_option_is("site-switch", "off", "on");
+}
+
+site_switch inject_site_switch(tree_stmt_iterator& it, analyzer_context* context)
+{
+	site_switch site = { NULL_TREE, NULL_TREE, NULL_TREE };
+	if (!site_switch_enabled()) return site;
+	site.decl = build_site_switch(context);
+
+	tree state = build_site_state(site.decl);
+	site.state_decl = build_decl(UNKNOWN_LOCATION, VAR_DECL, get_identifier("__site_state__"), TYPE_MAIN_VARIANT(TREE_TYPE(state)));
+	DECL_CONTEXT(site.state_decl) = context->context_func_decl;
+	DECL_SEEN_IN_BIND_EXPR_P(site.state_decl) = 1; // cheat the gimplfy checker, as build_for_loop does
+	tsi_link_after(&it, build1(DECL_EXPR, TREE_TYPE(site.state_decl), site.state_decl), TSI_CONTINUE_LINKING);
+	tsi_link_after(&it, build2(MODIFY_EXPR, TREE_TYPE(site.state_decl), site.state_decl, state), TSI_CONTINUE_LINKING);
+
+	tree skip_label_decl = build_decl(UNKNOWN_LOCATION, LABEL_DECL, NULL_TREE, void_type_node);
+	DECL_CONTEXT(skip_label_decl) = context->context_func_decl;
+	site.skip_label_expr = build1(LABEL_EXPR, void_type_node, skip_label_decl);
+
+	tree admit_call = build_call_expr(get_debugger_runtime_decl("site_admit"), 1, build_address_of(site.decl));
+	tree refused = build2(TRUTH_ANDIF_EXPR, integer_type_node,
+		build_unlikely(build_site_state_is(site.state_decl, DEBUGGER_SITE_SAMPLED)),
+		build2(EQ_EXPR, integer_type_node, admit_call, to_int_cst(0)));
+	tree skipped = build2(TRUTH_ORIF_EXPR, integer_type_node, build_site_state_is(site.state_decl, DEBUGGER_SITE_OFF), refused);
+	tsi_link_after(&it, build_if(skipped, build1(GOTO_EXPR, void_type_node, skip_label_decl)), TSI_CONTINUE_LINKING);
+	return site;
+}
+
+void escape_site_switch(tree_stmt_iterator& it, site_switch site)
+{
+	if (site.decl == NULL_TREE) return;
+	tree done_call = build_call_expr(get_debugger_runtime_decl("site_done"), 1, build_address_of(site.decl));
+	tree sampled = build_unlikely(build_site_state_is(site.state_decl, DEBUGGER_SITE_SAMPLED));
+	tsi_link_after(&it, build_if(sampled, done_call), TSI_CONTINUE_LINKING);
+	tsi_link_after(&it, site.skip_label_expr, TSI_CONTINUE_LINKING);
+}
+
+/**
+ *  with -fplugin-arg-<plugin>-counters=on the injected code of the site, inside its switch, is bracketed by
+ *  "debugger_counters_enter()" and "debugger_counters_leave(&counters)" of <debugger_site_counters.h>.
+ */
+
+static tree site_counters_type()
+{
+	tree leave_decl = get_debugger_runtime_decl("counters_leave");
+	return pointed_record_type(TREE_VALUE(TYPE_ARG_TYPES(TREE_TYPE(leave_decl))));
+}
+
+static tree build_site_counters(analyzer_context* context)
+{
+	if (get_debugger_runtime_decl("counters_leave") == NULL_TREE || !plugin_option_is("counters", "on", "off")) return NULL_TREE;
+	tree counters_type = site_counters_type();
+	return build_snapshot_data("counters", counters_type,
+		static_initializer(counters_type)
+			.set_int("line_no", context->line_no)
+			.set("file_name", build_string_literal_of_source_file_path(context->file_name))
+			.build(),
+		TARGET_MACHO ? "__DATA,__debugger_counters" : "debugger_counters");
+}
+
+tree inject_site_counters(tree_stmt_iterator& it, analyzer_context* context)
+{
+	tree counters_decl = build_site_counters(context);
+	if (counters_decl == NULL_TREE) return NULL_TREE;
+	tsi_link_after(&it, build_call_expr(get_debugger_runtime_decl("counters_enter"), 0), TSI_CONTINUE_LINKING);
+	return counters_decl;
+}
+
+void escape_site_counters(tree_stmt_iterator& it, tree counters_decl)
+{
+	if (counters_decl == NULL_TREE) return;
+	tree leave_call = build_call_expr(get_debugger_runtime_decl("counters_leave"), 1, build_address_of(counters_decl));
+	tsi_link_after(&it, leave_call, TSI_CONTINUE_LINKING);
+}
+
+/**
+ *  the data of a site printing "vars_to_track". the vars without a schema are only marked in "vars" by where
+ *  the program has to be interrupted for them, "n_ops" is the length of the whole program.
+ *  with "markup" the program also prints the identifiers around them, for a caller that only calls their printers.
+ */
+
+static tree build_site_data(analyzer_context* context, std::deque<tree>& vars_to_track,
+	std::vector<snapshot_var>& vars, long& n_slots, unsigned int& n_ops, bool markup = false)
+{
+	snapshot_program site(injection_padding);
+
+	site.text(4, "<vars_info>\n");
+	site.text(0, "");
+	site.emit(OP_CONTEXT);
+	site.text(0, "\n");
+	for (tree var_decl: vars_to_track)
+	{
+		gcc_assert(is_tracked_var(var_decl));
+		std::string name = tracked_name(var_decl);
+		snapshot_var var;
+		var.decl = var_decl;
+		var.padding = site.padding;
+		print_option option = print_option();
+		retrieve_print_option(var_decl, option);
+		// the bounds of a range are evaluated by the site, which prints the var inline
+		var.schema = option.has_range ? NULL_TREE : get_snapshot_schema(TREE_TYPE(var_decl), site.padding + 4);
+		if (var.schema == NULL_TREE)
+		{
+			if (markup) site.text(4, "<IDENTIFIER_%s>\n", name.c_str());
+			var.split_at = site.split();
+			if (markup) site.text(-4, "</IDENTIFIER_%s>\n", name.c_str());
+			vars.push_back(var);
+			continue;
+		}
+		site.text(4, "<IDENTIFIER_%s>\n", name.c_str());
+		site.emit(OP_SCHEMA, ERR_BASE_TYPE, 0, n_slots++);
+		site.ops.back().schema = var.schema;
+		site.ops.back().text = name; // the name indexed by the trace segments
+		site.text(-4, "</IDENTIFIER_%s>\n", name.c_str());
+		vars.push_back(var);
+	}
+	site.text(-4, "</vars_info>\n");
+
+	n_ops = site.ops.size();
+	tree site_type = snapshot_site_type();
+	return build_snapshot_data("site", site_type,
+		static_initializer(site_type)
+			.set("file_name", build_string_literal_of_source_file_path(context->file_name))
+			.set_int("line_no", context->line_no)
+			.set_int("n_ops", site.ops.size())
+			.set("ops", build_address_of(build_snapshot_ops(site)))
+			.build());
+}
+
+static void inject_site(tree_stmt_iterator& it, analyzer_context* context, std::deque<tree>& vars_to_track)
+{
+	if (snapshot_entry_decl() == NULL_TREE || plugin_option_is("snapshot", "inline", "fused"))
+	{
+		inject_print(it, context, vars_to_track);
+		return;
+	}
+	context->clear_expanded();
+	if (vars_to_track.size() == 0) return;
+
+	int site_padding = injection_padding;
+	std::vector<snapshot_var> vars;
+	long n_slots = 0;
+	unsigned int n_ops = 0;
+	tree site_decl = build_site_data(context, vars_to_track, vars, n_slots, n_ops);
+
+	tree slots_decl = build_snapshot_slots(it, context, vars, n_slots);
+	unsigned int first_op = 0;
+	for (snapshot_var& var: vars)
+	{
+		if (var.schema != NULL_TREE) continue;
+		inject_snapshot_call(it, site_decl, slots_decl, first_op, var.split_at);
+		injection_padding = var.padding;
+		inject_print_on_var(it, context, var.decl);
+		first_op = var.split_at;
+	}
+	inject_snapshot_call(it, site_decl, slots_decl, first_op, n_ops);
+	injection_padding = site_padding;
+}
+
+/**
+ *  the snapshot of a var after a statement is redundant when the next statement of the same straight line
+ *  writes the var again without observing it, i.e. without reading it or calling anything: only the last of
+ *  consecutive writes is kept. "find_observation" is the walk_tree callback finding what observes "decl"
+ *  (given as data), a dereference being one if the address of "decl" is taken.
+ *  -fplugin-arg-<plugin>-redundant=keep keeps every snapshot.
+ */
+
+static bool redundant_snapshots_dropped()
+{
+	return !plugin_option_is("redundant", "keep", "drop");
+}
+
+static tree find_observation(tree* node, int* walk_subtrees __unused, void* data)
+{
+	tree decl = (tree) data;
+	switch (TREE_CODE(*node))
+	{
+		case CALL_EXPR: return *node;
+		case SSA_NAME: return SSA_NAME_VAR(*node) == decl ? *node : NULL_TREE;
+		case INDIRECT_REF:
+		case MEM_REF:
+		case TARGET_MEM_REF: return TREE_ADDRESSABLE(decl) ? *node : NULL_TREE;
+		default: return *node == decl ? *node : NULL_TREE;
+	}
+}
+
+/**
+ *  the entry of injection for a site, "inject_print" is kept for -fplugin-arg-<plugin>-snapshot=inline
+ *  and for runtimes without "debugger_snapshot".
+ */
+
+void inject_snapshot(tree_stmt_iterator& it, analyzer_context* context, std::deque<tree> vars_to_track)
+{
+	profile_scope scope(PROFILE_INJECT_SNAPSHOT);
+	if (vars_to_track.size() == 0)
+	{
+		context->clear_expanded();
+		return;
+	}
+	site_switch site = inject_site_switch(it, context);
+	tree counters_decl = inject_site_counters(it, context);
+	inject_site(it, context, vars_to_track);
+	escape_site_counters(it, counters_decl);
+	escape_site_switch(it, site);
+}
+
+#endif
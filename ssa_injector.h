@@ -0,0 +1,458 @@
+#ifndef SSA_INJECTOR_H
+#define SSA_INJECTOR_H
+
+#include "debugger_common.h"
+#include "attribute_handler.h"
+#include "print_injector.h"
+#include "snapshot_builder.h"
+#include "plugin_options.h"
+#include "tree-ssa.h"
+#include "tree-cfg.h"
+#include "cfghooks.h"
+#include "tree-into-ssa.h"
+#include "tree-ssanames.h"
+#include "gimplify.h"
+#include "gimplify-me.h"
+
+/**
+ *  with -fplugin-arg-<plugin>-pass=ssa the sites are not injected into GENERIC when a function is parsed,
+ *  but by a GIMPLE pass right after the construction of SSA ("debugger_ssa", after "ssa"), so that they survive
+ *  -O2 and -O3: the optimizer inlines, schedules and vectorizes around them as around any call.
+ *  every statement storing to a tracked var becomes a site of that var, right after the store:
+ *      state = switch.enabled;
+ *      if (state == DEBUGGER_SITE_OFF) ;
+ *      else if (state == DEBUGGER_SITE_ON) { slots; debugger_snapshot(&site, slots, 0, n); }
+ *      else if (debugger_site_admit(&switch) != 0) { slots; debugger_snapshot(&site, slots, 0, n); debugger_site_done(&switch); }
+ *  a var in a register is an SSA name by then, its new value is copied into an addressable temporary for the slots
+ *  and the printers, once per site.
+ *  the data of the sites is built as for GENERIC (see <snapshot_builder.h>), the printers of the vars without a schema
+ *  are outlined when the function is parsed, as no function can be added to the unit from a pass. a track_range
+ *  pointer gets a range printer, called with its bounds evaluated after the store; the vars the bounds read are
+ *  kept in memory for that. a var of variable size cannot be tracked in this mode, nor can -fplugin-arg-<plugin>-
+ *  printers=inline be given with it, both are errors.
+ *  the site is guarded as in GENERIC, without a _setjmp of its own: "debugger_snapshot" runs every schema under
+ *  the guard of the runtime, and an outlined printer guards its expansion itself.
+ */
+
+static bool ssa_pass_enabled()
+{
+	return plugin_option_is("pass", "ssa", "generic");
+}
+
+/**
+ *  the padding of a var in the program of a site, see "build_site_data".
+ */
+
+static int ssa_printer_padding()
+{
+	return injection_padding + 8;
+}
+
+/**
+ *  the outlined printer of "var_decl" at "padding", a range printer for a track_range pointer.
+ */
+
+static tree ssa_printer_of(tree var_decl, int padding, bool build)
+{
+	print_option option = print_option();
+	retrieve_print_option(var_decl, option);
+	int site_padding = injection_padding;
+	injection_padding = padding;
+	bool ranged = option.has_range && POINTER_TYPE_P(TREE_TYPE(var_decl));
+	tree printer_decl = outlined_printer_of_type(TREE_TYPE(var_decl), ranged, build);
+	injection_padding = site_padding;
+	return printer_decl;
+}
+
+static tree keep_in_memory(tree* node, int* walk_subtrees __unused, void* data __unused)
+{
+	if (TREE_CODE(*node) == VAR_DECL || TREE_CODE(*node) == PARM_DECL) TREE_ADDRESSABLE(*node) = 1;
+	return NULL_TREE;
+}
+
+static std::unordered_set<tree> ssa_prepared_vars;
+
+static void prepare_ssa_printer_of(tree var)
+{
+	if (!is_var_marked_track(var) || !ssa_prepared_vars.insert(var).second) return;
+	if (variably_modified_type_p(TREE_TYPE(var), NULL_TREE))
+	{
+		error_at(DECL_SOURCE_LOCATION(var), "%qD is of variable size, which %<pass=ssa%> cannot track", var);
+		return;
+	}
+	print_option option = print_option();
+	retrieve_print_option(var, option);
+	if (option.has_range)
+	{
+		walk_tree_without_duplicates(&option.range_start, keep_in_memory, NULL);
+		walk_tree_without_duplicates(&option.range_end, keep_in_memory, NULL);
+	}
+	else if (get_snapshot_schema(TREE_TYPE(var), ssa_printer_padding()) != NULL_TREE) return;
+	ssa_printer_of(var, ssa_printer_padding(), true);
+}
+
+/**
+ *  the vars of the blocks, and the vars stored to, which may be global.
+ */
+
+static tree prepare_ssa_printer(tree* node, int* walk_subtrees __unused, void* data __unused)
+{
+	if (TREE_CODE(*node) == VAR_DECL) prepare_ssa_printer_of(*node);
+	if (TREE_CODE(*node) != BIND_EXPR) return NULL_TREE;
+	for (tree var = BIND_EXPR_VARS(*node); var != NULL_TREE; var = DECL_CHAIN(var))
+	{
+		if (TREE_CODE(var) == VAR_DECL) prepare_ssa_printer_of(var);
+	}
+	return NULL_TREE;
+}
+
+/**
+ *  called instead of "add_print_for_var" when a function is parsed, builds what the pass cannot.
+ */
+
+void prepare_ssa_printers(tree func_decl)
+{
+	profile_scope scope(PROFILE_ADD_PRINT_FOR_VAR);
+	for (tree parm = DECL_ARGUMENTS(func_decl); parm != NULL_TREE; parm = DECL_CHAIN(parm)) prepare_ssa_printer_of(parm);
+	walk_tree_without_duplicates(&DECL_SAVED_TREE(func_decl), prepare_ssa_printer, NULL);
+}
+
+/**
+ *  with the ssa pass every printer is outlined, an inline expansion has no place to go.
+ */
+
+void check_ssa_options()
+{
+	if (ssa_pass_enabled() && plugin_option_is("printers", "inline", "outlined"))
+	{
+		error("%<printers=inline%> cannot be given with %<pass=ssa%>, the ssa pass only calls outlined printers");
+	}
+}
+
+/**
+ *  the tracked var stored to by "stmt", NULL_TREE if none.
+ */
+
+static tree stored_tracked_var(gimple* stmt)
+{
+	if (is_gimple_debug(stmt) || gimple_clobber_p(stmt)) return NULL_TREE;
+	tree lhs = gimple_get_lhs(stmt);
+	if (lhs == NULL_TREE) return NULL_TREE;
+	tree base = TREE_CODE(lhs) == SSA_NAME ? SSA_NAME_VAR(lhs) : get_base_address(lhs);
+	if (base == NULL_TREE || (TREE_CODE(base) != VAR_DECL && TREE_CODE(base) != PARM_DECL)) return NULL_TREE;
+	return is_var_marked_track(base) ? base : NULL_TREE;
+}
+
+/**
+ *  whether the statement after "store" in its block overwrites "var_decl" without observing it,
+ *  as "is_overwritten_unobserved" of <ast_analyzer.h>.
+ */
+
+static bool is_overwritten_unobserved(gimple* store, tree var_decl)
+{
+	gimple_stmt_iterator gsi = gsi_for_stmt(store);
+	gsi_next_nondebug(&gsi);
+	if (gsi_end_p(gsi)) return false;
+	gimple* next = gsi_stmt(gsi);
+	if (!is_gimple_assign(next) || stored_tracked_var(next) != var_decl) return false;
+	tree lhs = gimple_assign_lhs(next);
+	for (tree ref = lhs; handled_component_p(ref); ref = TREE_OPERAND(ref, 0))
+	{
+		for (int i = 1; i < TREE_OPERAND_LENGTH(ref); i++)
+		{
+			if (walk_tree_without_duplicates(&TREE_OPERAND(ref, i), find_observation, var_decl) != NULL_TREE) return false;
+		}
+	}
+	for (unsigned int i = 1; i < gimple_num_ops(next); i++)
+	{
+		if (walk_tree_without_duplicates(gimple_op_ptr(next, i), find_observation, var_decl) != NULL_TREE) return false;
+	}
+	return true;
+}
+
+/**
+ *  what the pass keeps for a function: one slots array for all its sites, and the temporaries of its register vars.
+ */
+
+struct ssa_function_state
+{
+	tree slots_decl = NULL_TREE;
+	long n_slots = 0;
+	std::unordered_map<tree, tree> value_copies;
+};
+
+struct ssa_site
+{
+	gimple* store;
+	tree var_decl;
+	tree site_decl;
+	tree counters_decl;
+	std::vector<snapshot_var> vars;
+	long n_slots;
+	unsigned int n_ops;
+};
+
+static void insert_after(gimple_stmt_iterator& gsi, gimple* stmt, location_t location)
+{
+	gimple_set_location(stmt, location);
+	gsi_insert_after(&gsi, stmt, GSI_NEW_STMT);
+}
+
+static tree ssa_slots_decl(ssa_function_state& state, long n_slots)
+{
+	if (state.slots_decl != NULL_TREE && state.n_slots >= n_slots) return state.slots_decl;
+	state.slots_decl = create_tmp_var(build_array_type_nelts(const_ptr_type_node, n_slots), "snapshot_slots");
+	TREE_ADDRESSABLE(state.slots_decl) = 1;
+	state.n_slots = n_slots;
+	return state.slots_decl;
+}
+
+/**
+ *  the address the runtime reads "var_decl" from after "store".
+ */
+
+static tree ssa_value_address(gimple_stmt_iterator& gsi, ssa_function_state& state, ssa_site& site, location_t location)
+{
+	tree lhs = gimple_get_lhs(site.store);
+	if (TREE_CODE(lhs) != SSA_NAME)
+	{
+		TREE_ADDRESSABLE(site.var_decl) = 1; // already in memory, nothing changes but the verifier is satisfied
+		return build_fold_addr_expr(site.var_decl);
+	}
+	tree& copy = state.value_copies[site.var_decl];
+	if (copy == NULL_TREE)
+	{
+		copy = create_tmp_var(TREE_TYPE(site.var_decl), IDENTIFIER_POINTER(DECL_NAME(site.var_decl)));
+		TREE_ADDRESSABLE(copy) = 1;
+	}
+	insert_after(gsi, gimple_build_assign(copy, lhs), location);
+	return build_fold_addr_expr(copy);
+}
+
+static void insert_call(gimple_stmt_iterator& gsi, tree callee, tree arg, location_t location)
+{
+	tree arg_type = TREE_VALUE(TYPE_ARG_TYPES(TREE_TYPE(callee)));
+	insert_after(gsi, gimple_build_call(callee, 1, fold_convert(arg_type, arg)), location);
+}
+
+/**
+ *  the value of a bound of a range, computed after "gsi".
+ */
+
+static tree ssa_range_bound(gimple_stmt_iterator& gsi, tree bound, location_t location)
+{
+	gimple_seq stmts = NULL;
+	tree value = force_gimple_operand(fold_convert(long_integer_type_node, unshare_expr(bound)), &stmts, true, NULL_TREE);
+	annotate_all_with_location(stmts, location);
+	gsi_insert_seq_after(&gsi, stmts, GSI_CONTINUE_LINKING);
+	return value;
+}
+
+static void insert_printer_call(gimple_stmt_iterator& gsi, tree printer_decl, tree var_decl, tree address,
+	location_t location)
+{
+	print_option option = print_option();
+	retrieve_print_option(var_decl, option);
+	if (!option.has_range || !POINTER_TYPE_P(TREE_TYPE(var_decl)))
+	{
+		insert_call(gsi, printer_decl, address, location);
+		return;
+	}
+	tree start = ssa_range_bound(gsi, option.range_start, location);
+	tree end = ssa_range_bound(gsi, option.range_end, location);
+	tree value_type = TREE_VALUE(TYPE_ARG_TYPES(TREE_TYPE(printer_decl)));
+	insert_after(gsi, gimple_build_call(printer_decl, 3, fold_convert(value_type, address), start, end), location);
+}
+
+static void insert_snapshot_call(gimple_stmt_iterator& gsi, ssa_site& site, tree slots, unsigned int first_op,
+	unsigned int last_op, location_t location)
+{
+	if (first_op == last_op) return;
+	tree snapshot_decl = snapshot_entry_decl();
+	tree param_types = TYPE_ARG_TYPES(TREE_TYPE(snapshot_decl));
+	gcall* call = gimple_build_call(
+		snapshot_decl,
+		4,
+		fold_convert(TREE_VALUE(param_types), build_fold_addr_expr(site.site_decl)),
+		fold_convert(TREE_VALUE(TREE_CHAIN(param_types)), slots),
+		build_int_cst(unsigned_type_node, first_op),
+		build_int_cst(unsigned_type_node, last_op));
+	insert_after(gsi, call, location);
+}
+
+/**
+ *  the body of a site, at the end of the block of "gsi", as "inject_site" and "inject_snapshot" make it.
+ */
+
+static void insert_site_body(gimple_stmt_iterator& gsi, ssa_function_state& state, ssa_site& site)
+{
+	location_t location = gimple_location(site.store);
+	if (site.counters_decl != NULL_TREE)
+	{
+		insert_after(gsi, gimple_build_call(get_debugger_runtime_decl("counters_enter"), 0), location);
+	}
+	tree address = ssa_value_address(gsi, state, site, location); // shared by the slots and the printers
+	tree slots = null_pointer_node;
+	if (site.n_slots > 0)
+	{
+		tree slots_decl = ssa_slots_decl(state, site.n_slots);
+		tree slot_ref = build4(ARRAY_REF, const_ptr_type_node, slots_decl, size_int(0), NULL_TREE, NULL_TREE);
+		insert_after(gsi, gimple_build_assign(slot_ref, fold_convert(const_ptr_type_node, address)), location);
+		slots = build_fold_addr_expr(slots_decl);
+	}
+	unsigned int first_op = 0;
+	for (snapshot_var& var: site.vars)
+	{
+		if (var.schema != NULL_TREE) continue;
+		insert_snapshot_call(gsi, site, slots, first_op, var.split_at, location);
+		tree printer_decl = ssa_printer_of(var.decl, var.padding + 4, false);
+		gcc_assert(printer_decl != NULL_TREE); // built by "prepare_ssa_printers" for every var without a schema
+		insert_printer_call(gsi, printer_decl, var.decl, address, location);
+		first_op = var.split_at;
+	}
+	insert_snapshot_call(gsi, site, slots, first_op, site.n_ops, location);
+	if (site.counters_decl != NULL_TREE)
+	{
+		insert_call(gsi, get_debugger_runtime_decl("counters_leave"), build_fold_addr_expr(site.counters_decl), location);
+	}
+}
+
+/**
+ *  ends the block of "gsi" with "if (lhs code rhs)", the two new blocks both join the rest of the block.
+ *  the block may be empty, as one made by a previous split.
+ */
+
+static void split_on_condition(gimple_stmt_iterator& gsi, tree_code code, tree lhs, tree rhs,
+	profile_probability true_probability, basic_block& true_bb, basic_block& false_bb, location_t location)
+{
+	gcond* cond = gimple_build_cond(code, lhs, rhs, NULL_TREE, NULL_TREE);
+	insert_after(gsi, cond, location);
+	edge false_edge = split_block(gimple_bb(cond), cond);
+	basic_block cond_bb = false_edge->src;
+	basic_block join_bb = false_edge->dest;
+	false_edge->flags = EDGE_FALSE_VALUE;
+	false_edge->probability = true_probability.invert();
+	false_bb = split_edge(false_edge);
+	edge true_edge = make_edge(cond_bb, join_bb, EDGE_TRUE_VALUE);
+	true_edge->probability = true_probability;
+	true_bb = split_edge(true_edge);
+}
+
+static void inject_ssa_site(ssa_function_state& state, ssa_site& site, analyzer_context* context)
+{
+	gimple_stmt_iterator gsi = gsi_for_stmt(site.store);
+	location_t location = gimple_location(site.store);
+	if (!site_switch_enabled())
+	{
+		insert_site_body(gsi, state, site);
+		return;
+	}
+	tree switch_decl = build_site_switch(context);
+	tree enabled = build_site_state(switch_decl);
+	tree enabled_value = make_ssa_name(TREE_TYPE(enabled));
+	insert_after(gsi, gimple_build_assign(enabled_value, enabled), location);
+
+	basic_block off_bb, not_off_bb, on_bb, not_on_bb, admitted_bb, refused_bb;
+	split_on_condition(gsi, EQ_EXPR, enabled_value, build_int_cst(TREE_TYPE(enabled), DEBUGGER_SITE_OFF),
+		profile_probability::even(), off_bb, not_off_bb, location);
+	gimple_stmt_iterator not_off_gsi = gsi_last_bb(not_off_bb);
+	split_on_condition(not_off_gsi, EQ_EXPR, enabled_value, build_int_cst(TREE_TYPE(enabled), DEBUGGER_SITE_ON),
+		profile_probability::very_likely(), on_bb, not_on_bb, location);
+	gimple_stmt_iterator on_gsi = gsi_last_bb(on_bb);
+	insert_site_body(on_gsi, state, site);
+
+	gimple_stmt_iterator not_on_gsi = gsi_last_bb(not_on_bb);
+	tree admit_decl = get_debugger_runtime_decl("site_admit");
+	tree admitted = make_ssa_name(TREE_TYPE(TREE_TYPE(admit_decl)));
+	gcall* admit_call = gimple_build_call(admit_decl, 1, build_fold_addr_expr(switch_decl));
+	gimple_call_set_lhs(admit_call, admitted);
+	insert_after(not_on_gsi, admit_call, location);
+	split_on_condition(not_on_gsi, NE_EXPR, admitted, build_int_cst(TREE_TYPE(admitted), 0),
+		profile_probability::even(), admitted_bb, refused_bb, location);
+	gimple_stmt_iterator admitted_gsi = gsi_last_bb(admitted_bb);
+	insert_site_body(admitted_gsi, state, site);
+	insert_call(admitted_gsi, get_debugger_runtime_decl("site_done"), build_fold_addr_expr(switch_decl), location);
+}
+
+/**
+ *  the stores are gathered first, as injecting splits the blocks being walked.
+ *  a store ending its block, as of the result of setjmp, has no place after it and is left out.
+ */
+
+static unsigned int inject_ssa_sites(function* fun)
+{
+	if (snapshot_entry_decl() == NULL_TREE) return 0;
+	profile_scope scope(PROFILE_INJECT_SNAPSHOT);
+	std::vector<ssa_site> sites;
+	basic_block bb;
+	FOR_EACH_BB_FN(bb, fun)
+	{
+		for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi); gsi_next(&gsi))
+		{
+			tree var_decl = stored_tracked_var(gsi_stmt(gsi));
+			if (var_decl == NULL_TREE || stmt_ends_bb_p(gsi_stmt(gsi))) continue;
+			if (redundant_snapshots_dropped() && is_overwritten_unobserved(gsi_stmt(gsi), var_decl)) continue;
+			ssa_site site;
+			site.store = gsi_stmt(gsi);
+			site.var_decl = var_decl;
+			sites.push_back(site);
+		}
+	}
+	if (sites.empty()) return 0;
+
+	free_dominance_info(CDI_DOMINATORS);
+	ssa_function_state state;
+	for (ssa_site& site: sites)
+	{
+		analyzer_context context(fun->decl);
+		context.set_location(gimple_filename(site.store), gimple_lineno(site.store));
+		std::deque<tree> vars_to_track(1, site.var_decl);
+		site.n_slots = 0;
+		site.site_decl = build_site_data(&context, vars_to_track, site.vars, site.n_slots, site.n_ops, true);
+		site.counters_decl = build_site_counters(&context);
+		inject_ssa_site(state, site, &context);
+		debugger_info_printf("var < %s > is registered for printing.\n", IDENTIFIER_POINTER(DECL_NAME(site.var_decl)));
+	}
+	mark_virtual_operands_for_renaming(fun);
+	return TODO_update_ssa;
+}
+
+const pass_data ssa_injection_pass_data =
+{
+	GIMPLE_PASS,
+	"debugger_ssa",
+	OPTGROUP_NONE,
+	TV_NONE,
+	PROP_cfg | PROP_ssa,
+	0,
+	0,
+	0,
+	TODO_cleanup_cfg
+};
+
+struct ssa_injection_pass: gimple_opt_pass
+{
+	ssa_injection_pass(gcc::context* ctxt): gimple_opt_pass(ssa_injection_pass_data, ctxt)
+	{
+	}
+	virtual unsigned int execute(function* fun)
+	{
+		return inject_ssa_sites(fun);
+	}
+};
+
+/**
+ *  registered through PLUGIN_PASS_MANAGER_SETUP by "plugin_init".
+ */
+
+void register_ssa_pass(const char* plugin_name)
+{
+	static struct register_pass_info pass_info;
+	pass_info.pass = new ssa_injection_pass(g);
+	pass_info.reference_pass_name = "ssa";
+	pass_info.ref_pass_instance_number = 1;
+	pass_info.pos_op = PASS_POS_INSERT_AFTER;
+	register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+}
+
+#endif
@@ -0,0 +1,96 @@
+#!/bin/sh
+# checks of the runtime and of the injected code, one plugin1_test_<topic>.c per topic:
+#   runtime tests are built without the plugin and exit with 0 when every check holds
+#   plugin tests are built with the plugin, then the markup their run writes to stderr is counted
+#
+#   sh test.sh     CC and PLUGIN may be overridden from the environment, the plugin tests are skipped without PLUGIN
+
+CC=${CC:-gcc}
+PLUGIN=${PLUGIN:-./plugin1.so}
+CFLAGS="-O0 -w -pthread -I."
+PLUGIN_NAME=$(basename "$PLUGIN" .so)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+FAILED=0
+OPTIMIZE=
+
+fail() {
+    echo "FAIL $*"
+    FAILED=$((FAILED + 1))
+}
+
+# runtime <topic> [cflags...]
+runtime() {
+    topic=$1
+    shift
+    if ! $CC $CFLAGS "$@" "plugin1_test_$topic.c" -o "$WORK/$topic"; then
+        fail "$topic: build"
+    elif ! "$WORK/$topic" > "$WORK/$topic.out" 2>&1; then
+        fail "$topic: $(tail -n 1 "$WORK/$topic.out")"
+    else
+        echo "ok   $topic $*"
+    fi
+}
+
+# plugin <topic> [plugin args...]: builds and runs the test, its stderr is kept in $OUT for "expect"
+#   $OPTIMIZE is added to the flags of the build
+plugin() {
+    topic=$1
+    shift
+    LABEL="$topic $*"
+    OUT="$WORK/$topic.err"
+    ARGS=""
+    for arg in "$@"; do ARGS="$ARGS -fplugin-arg-$PLUGIN_NAME-$arg"; done
+    : > "$OUT"
+    if ! $CC $CFLAGS $OPTIMIZE -fplugin="$PLUGIN" $ARGS "plugin1_test_$topic.c" -o "$WORK/$topic"; then
+        fail "$LABEL: build"
+        return 1
+    fi
+    "$WORK/$topic" > /dev/null 2> "$OUT"
+    echo "ok   $LABEL"
+}
+
+# expect <count> <pattern>: the number of lines of $OUT matching the pattern
+expect() {
+    count=$(grep -c -e "$2" "$OUT")
+    [ "$count" = "$1" ] || fail "$LABEL: $count lines of \"$2\" instead of $1"
+}
+
+runtime guard
+runtime guard -DDEBUGGER_RING_BUFFER
+runtime items
+runtime ring
+runtime heap
+
+if [ ! -f "$PLUGIN" ]; then
+    echo "skip plugin tests, $PLUGIN is missing, build it as in compile.sh"
+else
+    if plugin capture_points; then
+        expect 8 "<IDENTIFIER_evens>"
+        expect 6 "<IDENTIFIER_thirds>"
+        expect 2 "<IDENTIFIER_seen>"
+        expect 1 "<IDENTIFIER_left>"
+        expect 1 "^ *4101$"
+        expect 0 "^ *4100$"
+        expect 1 "<IDENTIFIER_calls>"
+    fi
+    for printers in outlined inline; do
+        if plugin printers snapshot=inline printers=$printers; then
+            expect 1 "<IDENTIFIER_first>"
+            expect 1 "<IDENTIFIER_second>"
+            expect 2 "<FIELD_value>"
+            expect 2 "<__RECURSION__/>"
+        fi
+    done
+    OPTIMIZE=-O2
+    if plugin ssa pass=ssa; then
+        expect 1 "^ *7001$"
+        expect 1 "^ *7003$"
+        expect 0 "^ *7004$"
+        expect 1 "<__SEGFAULT__/>"
+    fi
+    OPTIMIZE=
+fi
+
+[ $FAILED -eq 0 ] && echo "all passed" || echo "$FAILED failed"
+[ $FAILED -eq 0 ]